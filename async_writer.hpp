@@ -0,0 +1,209 @@
+#ifndef async_writer_h
+#define async_writer_h
+
+#include <cerrno>
+#include <cstdint>
+#include <pthread.h>
+#include <unistd.h>
+#include <vector>
+#include "frame_queue.hpp"
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/**
+ * @file async_writer.hpp
+ * @brief Asynchronous file writer keeping several writes in flight per thread.
+ *
+ * The io_uring backend (built when liburing is available) submits writes to the kernel and
+ * collects their completions later. The portable backend hands the writes to a small set of
+ * I/O threads doing pwrite(). Both keep up to queueDepth writes in flight, so a single saver
+ * thread can keep the disk busy.
+ */
+
+struct asyncWrite {
+  /**
+ * @brief A write request, tag is returned untouched with the completion.
+ */
+  int fd;
+  const char* data;
+  size_t length;
+  uint64_t offset;
+  uint64_t tag;
+};
+
+struct asyncResult {
+  /**
+ * @brief Completion of a write request.
+ */
+  int fd;
+  uint64_t tag;
+  bool ok;
+};
+
+class AsyncRawWriter {
+  /**
+ * @brief Keeps up to queueDepth writes in flight and reports their completions.
+ *
+ * Not thread-safe: every saver thread owns its own writer.
+ */
+public:
+  explicit AsyncRawWriter(unsigned queueDepth)
+      : depth(queueDepth ? queueDepth : 1), requests(depth), completions(depth) {
+#ifdef HAVE_LIBURING
+    if (io_uring_queue_init(depth, &ring, 0) == 0) {
+      isUring = true;
+      return;
+    }
+#endif
+    // Portable backend: one I/O thread per in flight write
+    ioThreads.resize(depth);
+    for (pthread_t& thread : ioThreads) {
+      pthread_create(&thread, nullptr, ioLoop, this);
+    }
+  }
+
+  ~AsyncRawWriter() {
+    std::vector<asyncResult> done;
+    while (inFlight() > 0) {
+      reap(done, true);
+    }
+#ifdef HAVE_LIBURING
+    if (isUring) {
+      io_uring_queue_exit(&ring);
+      return;
+    }
+#endif
+    requests.close();
+    for (pthread_t thread : ioThreads) {
+      pthread_join(thread, nullptr);
+    }
+  }
+
+  AsyncRawWriter(const AsyncRawWriter&) = delete;
+  AsyncRawWriter& operator=(const AsyncRawWriter&) = delete;
+
+  const char* backend() const { return isUring ? "io_uring" : "threads"; }
+
+  unsigned queueDepth() const { return depth; }
+
+  unsigned inFlight() const { return pending; }
+
+  void submit(const asyncWrite& request, std::vector<asyncResult>& done) {
+    /**
+ * @brief Starts a write, first waiting for a completion if queueDepth writes are in flight.
+ *
+ * @param done Receives the completions collected while waiting.
+ */
+    while (pending >= depth) {
+      reap(done, true);
+    }
+    pending++;
+#ifdef HAVE_LIBURING
+    if (isUring) {
+      trackedWrite* tracked = new trackedWrite{request, 0};
+      queueUring(tracked);
+      io_uring_submit(&ring);
+      return;
+    }
+#endif
+    requests.push(request);
+  }
+
+  size_t reap(std::vector<asyncResult>& done, bool wait) {
+    /**
+ * @brief Collects the finished writes.
+ *
+ * @param done Receives the completions.
+ * @param wait Sleep until at least one write finishes (if any is in flight).
+ * @return size_t Number of completions added to done.
+ */
+    size_t before = done.size();
+#ifdef HAVE_LIBURING
+    if (isUring) {
+      while (pending > 0) {
+        io_uring_cqe* cqe;
+        int status = wait && done.size() == before ? io_uring_wait_cqe(&ring, &cqe) : io_uring_peek_cqe(&ring, &cqe);
+        if (status == -EINTR) {
+          continue;
+        }
+        if (status != 0) {
+          break;
+        }
+        trackedWrite* tracked = static_cast<trackedWrite*>(io_uring_cqe_get_data(cqe));
+        int result = cqe -> res;
+        io_uring_cqe_seen(&ring, cqe);
+        if (result > 0 && tracked -> written + result < tracked -> request.length) {
+          // Short write, submit the rest
+          tracked -> written += result;
+          queueUring(tracked);
+          io_uring_submit(&ring);
+          continue;
+        }
+        done.push_back({tracked -> request.fd, tracked -> request.tag, result > 0});
+        delete tracked;
+        pending--;
+      }
+      return done.size() - before;
+    }
+#endif
+    asyncResult result;
+    while (pending > 0) {
+      bool got = wait && done.size() == before ? completions.pop(result) : completions.tryPop(result);
+      if (!got) {
+        break;
+      }
+      done.push_back(result);
+      pending--;
+    }
+    return done.size() - before;
+  }
+
+private:
+#ifdef HAVE_LIBURING
+  struct trackedWrite {
+    asyncWrite request;
+    size_t written;
+  };
+
+  void queueUring(trackedWrite* tracked) {
+    io_uring_sqe* sqe = io_uring_get_sqe(&ring);
+    io_uring_prep_write(sqe, tracked -> request.fd, tracked -> request.data + tracked -> written,
+                        tracked -> request.length - tracked -> written, tracked -> request.offset + tracked -> written);
+    io_uring_sqe_set_data(sqe, tracked);
+  }
+
+  io_uring ring;
+#endif
+
+  static void* ioLoop(void* args) {
+    AsyncRawWriter* writer = static_cast<AsyncRawWriter*>(args);
+    asyncWrite request;
+    while (writer -> requests.pop(request)) {
+      size_t written = 0;
+      bool ok = true;
+      while (written < request.length) {
+        ssize_t n = ::pwrite(request.fd, request.data + written, request.length - written, request.offset + written);
+        if (n < 0 && errno == EINTR) {
+          continue;
+        }
+        if (n <= 0) {
+          ok = false;
+          break;
+        }
+        written += n;
+      }
+      writer -> completions.push({request.fd, request.tag, ok});
+    }
+    return NULL;
+  }
+
+  unsigned depth;
+  unsigned pending = 0;
+  bool isUring = false;
+  FrameQueue<asyncWrite> requests;
+  FrameQueue<asyncResult> completions;
+  std::vector<pthread_t> ioThreads;
+};
+
+#endif // async_writer_h
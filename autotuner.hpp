@@ -0,0 +1,148 @@
+#ifndef autotuner_h
+#define autotuner_h
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @file autotuner.hpp
+ * @brief Runtime sizing of the saver pool and of the queue depth from what the last second measured.
+ *
+ * The controller feeds the tuner one sample per second. While the queue is filling up the tuner adds
+ * savers one at a time and keeps a new saver only if the saved rate really went up, so it stops at the
+ * point where the disk, not the thread count, is the limit. Savers that are not needed any more are
+ * retired, and the queue depth is raised when there is nothing else to add (within the memory limit)
+ * and lowered again when the queue stays empty. When the savers already use every CPU and the queue
+ * still fills up, the tuner can ask for a cheaper output format.
+ */
+
+struct tunerLimits {
+  /**
+ * @brief Bounds of the tuned values.
+ */
+  int minSavers;
+  int maxSavers;        // CPU limit
+  size_t minDepth;
+  size_t maxDepth;      // Memory limit, in frames
+  bool canStepDownFormat; // A cheaper output format is available and allowed
+};
+
+struct tunerSample {
+  /**
+ * @brief What happened during the last second.
+ */
+  uint64_t generated; // Frames generated
+  uint64_t saved;     // Frames saved
+  uint64_t lost;      // Frames dropped by the queue policy
+  size_t queued;      // Frames in the queue at the end of the second
+  uint64_t busy;      // Nanoseconds the savers spent encoding and writing
+};
+
+struct tunerDecision {
+  /**
+ * @brief Values to apply after a sample, reason is nullptr when nothing changed.
+ */
+  int savers;
+  size_t depth;
+  bool stepDownFormat;
+  const char* reason;
+};
+
+class Autotuner {
+  /**
+ * @brief Hill climbing on the saver count, then on the queue depth, then on the format.
+ */
+public:
+  Autotuner(const tunerLimits& limits, int savers, size_t depth)
+      : limits(limits), savers(std::min(std::max(savers, limits.minSavers), limits.maxSavers)),
+        depth(std::min(std::max(depth, limits.minDepth), limits.maxDepth)), saverCeiling(limits.maxSavers) {}
+
+  tunerDecision step(const tunerSample& sample) {
+    /**
+ * @brief Takes the sample of the last second and decides the saver count and queue depth to use now.
+ */
+    tunerDecision decision = {savers, depth, false, nullptr};
+    if (settling > 0) {
+      settling--; // The last change is not reflected in the rates yet
+      return decision;
+    }
+    if (ceilingAge > 0 && --ceilingAge == 0) {
+      saverCeiling = limits.maxSavers; // The disk may be faster now, allow growing again
+    }
+
+    if (trialBaseline > 0) {
+      // A saver was added on trial, keep it only if the saved rate went up by at least TRIAL_GAIN
+      bool improved = sample.saved * 100 >= trialBaseline * (100 + TRIAL_GAIN);
+      trialBaseline = 0;
+      if (!improved) {
+        saverCeiling = savers - 1;
+        ceilingAge = CEILING_STEPS;
+        return change(decision, savers - 1, depth, "extra saver did not raise the saved rate, I/O-bound");
+      }
+    }
+
+    bool behind = sample.lost > 0 || sample.queued * 4 >= depth * 3;
+    bool idle = sample.lost == 0 && sample.queued * 10 <= depth;
+    idleSteps = idle ? idleSteps + 1 : 0;
+
+    if (behind) {
+      if (savers < saverCeiling) {
+        trialBaseline = std::max<uint64_t>(sample.saved, 1);
+        return change(decision, savers + 1, depth, "queue filling up, adding a saver");
+      }
+      if (depth < limits.maxDepth) {
+        return change(decision, savers, std::min(limits.maxDepth, depth * 2), "savers at their limit, deepening the queue");
+      }
+      if (savers >= limits.maxSavers && limits.canStepDownFormat && !isFormatSteppedDown) {
+        isFormatSteppedDown = true;
+        decision.stepDownFormat = true;
+        return change(decision, savers, depth, "every CPU saving and still behind, switching to a cheaper format");
+      }
+    } else if (idleSteps >= IDLE_STEPS) {
+      idleSteps = 0;
+      // Retire a saver only if the others can take its share and stay below RETIRE_LOAD percent busy
+      if (savers > limits.minSavers && sample.busy * 100 <= static_cast<uint64_t>(savers - 1) * RETIRE_LOAD * 1000000000ULL) {
+        return change(decision, savers - 1, depth, "queue empty, retiring a saver");
+      }
+      if (depth > limits.minDepth) {
+        return change(decision, savers, std::max(limits.minDepth, depth / 2), "queue empty, reducing the queue depth");
+      }
+    }
+    return decision;
+  }
+
+  int saverCount() const { return savers; }
+
+  size_t queueDepth() const { return depth; }
+
+private:
+  static const int SETTLE_STEPS = 1;   // Samples ignored after a change
+  static const int IDLE_STEPS = 3;     // Samples with an empty queue before shrinking
+  static const int CEILING_STEPS = 30; // Samples before trying again a saver count that did not help
+  static const uint64_t TRIAL_GAIN = 5; // Percent the saved rate has to grow for a new saver to stay
+  static const uint64_t RETIRE_LOAD = 70; // Percent of the second the remaining savers may be busy after a retirement
+
+  tunerDecision& change(tunerDecision& decision, int newSavers, size_t newDepth, const char* reason) {
+    savers = newSavers;
+    depth = newDepth;
+    decision.savers = newSavers;
+    decision.depth = newDepth;
+    decision.reason = reason;
+    settling = SETTLE_STEPS;
+    idleSteps = 0;
+    return decision;
+  }
+
+  tunerLimits limits;
+  int savers;
+  size_t depth;
+  int saverCeiling;       // Saver count above which adding savers did not help
+  int ceilingAge = 0;     // Samples left before saverCeiling is reset
+  uint64_t trialBaseline = 0; // Saved rate before the saver on trial was added, 0 if there is none
+  int settling = 0;
+  int idleSteps = 0;
+  bool isFormatSteppedDown = false;
+};
+
+#endif // autotuner_h
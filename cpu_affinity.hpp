@@ -0,0 +1,162 @@
+#ifndef cpu_affinity_h
+#define cpu_affinity_h
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <pthread.h>
+#include <sched.h>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * @file cpu_affinity.hpp
+ * @brief CPU lists, NUMA topology and thread pinning, without libnuma.
+ *
+ * The topology is read from /sys/devices/system, threads are pinned with pthread_attr_setaffinity_np()
+ * before they start, so their first allocations already happen on their node, and buffers are bound
+ * to a node with the mbind() system call. On a machine without NUMA everything is on node 0.
+ */
+
+namespace cpuAffinity {
+
+const int MPOL_PREFERRED_POLICY = 1; // MPOL_PREFERRED of <linux/mempolicy.h>
+
+inline std::vector<int> parseList(const std::string& list) {
+  /**
+ * @brief Reads a CPU list in the kernel's format, e.g. "0-3,8,10-11".
+ *
+ * @return std::vector<int> The CPUs in the order given, empty if the list is not valid.
+ */
+  std::vector<int> cpus;
+  size_t start = 0;
+  while (start < list.size()) {
+    size_t end = list.find(',', start);
+    std::string range = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    int first, last;
+    char dash;
+    int fields = sscanf(range.c_str(), "%d%c%d", &first, &dash, &last);
+    if (fields == 1) {
+      last = first;
+    } else if (fields != 3 || dash != '-') {
+      return {};
+    }
+    if (first < 0 || last < first || last >= CPU_SETSIZE) {
+      return {};
+    }
+    for (int cpu = first; cpu <= last; cpu++) {
+      cpus.push_back(cpu);
+    }
+    if (end == std::string::npos) {
+      break;
+    }
+    start = end + 1;
+  }
+  return cpus;
+}
+
+inline std::string formatList(const std::vector<int>& cpus) {
+  std::string text;
+  for (size_t i = 0; i < cpus.size(); i++) {
+    text += (i ? "," : "") + std::to_string(cpus[i]);
+  }
+  return text;
+}
+
+inline std::vector<int> allowedCpus() {
+  /**
+ * @brief CPUs the process may run on.
+ */
+  std::vector<int> cpus;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  if (sched_getaffinity(0, sizeof(set), &set) == 0) {
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+      if (CPU_ISSET(cpu, &set)) {
+        cpus.push_back(cpu);
+      }
+    }
+  }
+  return cpus;
+}
+
+inline int nodeOf(int cpu) {
+  /**
+ * @brief NUMA node of a CPU, from the nodeN link in its sysfs directory.
+ *
+ * @return int The node, 0 when the kernel exposes no NUMA topology.
+ */
+  std::error_code error;
+  std::filesystem::directory_iterator entries("/sys/devices/system/cpu/cpu" + std::to_string(cpu), error);
+  for (; !error && entries != std::filesystem::directory_iterator(); entries.increment(error)) {
+    std::string name = entries -> path().filename().string();
+    if (name.compare(0, 4, "node") == 0 && name.size() > 4 && isdigit(static_cast<unsigned char>(name[4]))) {
+      return std::atoi(name.c_str() + 4);
+    }
+  }
+  return 0;
+}
+
+inline std::vector<int> cpusOfNode(int node, const std::vector<int>& allowed) {
+  /**
+ * @brief CPUs of allowed that belong to a NUMA node.
+ */
+  std::vector<int> cpus;
+  for (int cpu : allowed) {
+    if (nodeOf(cpu) == node) {
+      cpus.push_back(cpu);
+    }
+  }
+  return cpus;
+}
+
+inline int createThread(pthread_t* thread, const std::vector<int>& cpus, void* (*routine)(void*), void* args) {
+  /**
+ * @brief pthread_create() of a thread that only runs on cpus, or anywhere if cpus is empty.
+ *
+ * @return int 0 on success, the pthread error otherwise.
+ */
+  if (cpus.empty()) {
+    return pthread_create(thread, nullptr, routine, args);
+  }
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (int cpu : cpus) {
+    CPU_SET(cpu, &set);
+  }
+  pthread_attr_t attributes;
+  pthread_attr_init(&attributes);
+  pthread_attr_setaffinity_np(&attributes, sizeof(set), &set);
+  int result = pthread_create(thread, &attributes, routine, args);
+  pthread_attr_destroy(&attributes);
+  return result;
+}
+
+inline int currentNode() {
+  /**
+ * @brief NUMA node of the CPU the calling thread runs on, stable once the thread is pinned to a node.
+ */
+  int cpu = sched_getcpu();
+  return cpu < 0 ? 0 : nodeOf(cpu);
+}
+
+inline bool bindMemory(void* address, size_t bytes, int node) {
+  /**
+ * @brief Asks the kernel to place the pages of a buffer on a node (MPOL_PREFERRED), before they are touched.
+ *
+ * @return bool false if the kernel refused, the pages then follow the first touch.
+ */
+  unsigned long mask[(1024 + 8 * sizeof(unsigned long) - 1) / (8 * sizeof(unsigned long))] = {};
+  if (node < 0 || node >= 1024) {
+    return false;
+  }
+  mask[node / (8 * sizeof(unsigned long))] |= 1UL << (node % (8 * sizeof(unsigned long)));
+  return syscall(SYS_mbind, address, bytes, MPOL_PREFERRED_POLICY, mask, 1024 + 1, 0) == 0;
+}
+
+} // namespace cpuAffinity
+
+#endif // cpu_affinity_h
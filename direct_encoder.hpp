@@ -0,0 +1,357 @@
+#ifndef direct_encoder_h
+#define direct_encoder_h
+
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * @file direct_encoder.hpp
+ * @brief Built-in encoders for the uncompressed formats: .ppm, .bmp/.dib, .ras/.sr and .tiff/.tif.
+ *
+ * These formats are a small header followed by the pixels, so instead of going through
+ * cv::imwrite the header is built once per run and every frame is written with a single
+ * writev() of the header and the frame rows, straight from the frame buffer.
+ * The files are standard ones: PPM P5/P6 (8 or 16-bit), top-down 8/24/32-bit BMP, standard 24-bit
+ * Sun raster and baseline uncompressed gray, RGB or RGBA TIFF (8 or 16-bit) with a single strip.
+ * Pixel types a format can't store have no layout (FORMAT_NONE) and are left to OpenCV.
+ */
+
+namespace directEncoder {
+
+enum directFormat {
+  /**
+ * @brief Formats with a built-in encoder.
+ */
+  FORMAT_NONE, // Encoded by OpenCV
+  FORMAT_PPM,
+  FORMAT_BMP,
+  FORMAT_RAS,
+  FORMAT_TIFF
+};
+
+struct frameLayout {
+  /**
+ * @brief How a frame of a given size is stored in a file of a direct format.
+ */
+  directFormat format;
+  std::vector<unsigned char> header; // Bytes before the pixels
+  size_t rowBytes;   // Pixel bytes of a row
+  size_t rowPadding; // Zero bytes after each row (BMP rows are 4 byte aligned, Sun raster rows 2 byte aligned)
+  int rows;
+  int swapCode;      // cv::cvtColor code putting the BGR(A) frame in the channel order of the format, -1 if none;
+                     // prepareFrame() does the same red and blue swap in place
+  bool isBigEndian;  // 16-bit samples are stored big-endian (PPM), the frame is byte swapped before writing
+
+  size_t fileBytes() const { return header.size() + rows * (rowBytes + rowPadding); }
+};
+
+inline directFormat formatOf(const char* extension) {
+  /**
+ * @brief Direct format of an extension, FORMAT_NONE if OpenCV has to encode it.
+ */
+  if (strcmp(extension, ".ppm") == 0) {
+    return FORMAT_PPM;
+  }
+  if (strcmp(extension, ".bmp") == 0 || strcmp(extension, ".dib") == 0) {
+    return FORMAT_BMP;
+  }
+  if (strcmp(extension, ".ras") == 0 || strcmp(extension, ".sr") == 0) {
+    return FORMAT_RAS;
+  }
+  if (strcmp(extension, ".tiff") == 0 || strcmp(extension, ".tif") == 0) {
+    return FORMAT_TIFF;
+  }
+  return FORMAT_NONE;
+}
+
+inline void putLE(std::vector<unsigned char>& out, uint32_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) {
+    out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+  }
+}
+
+inline void putBE(std::vector<unsigned char>& out, uint32_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; i--) {
+    out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+  }
+}
+
+inline void putTiffEntry(std::vector<unsigned char>& out, uint16_t tag, uint16_t type, uint32_t count, uint32_t value) {
+  // SHORT values are stored in the first two bytes of the value field
+  putLE(out, tag, 2);
+  putLE(out, type, 2);
+  putLE(out, count, 4);
+  putLE(out, value, type == 3 && count == 1 ? 2 : 4);
+  if (type == 3 && count == 1) {
+    putLE(out, 0, 2);
+  }
+}
+
+inline frameLayout layoutOf(directFormat format, int width, int height, int type = CV_8UC3, int bits = 8) {
+  /**
+ * @brief Builds the header of the frames of a run, frames of width x height of an OpenCV type
+ * (8 or 16-bit, 1, 3 or 4 channels) using bits significant bits per sample.
+ *
+ * @return frameLayout With format FORMAT_NONE if the format can't store that pixel type.
+ */
+  int channels = CV_MAT_CN(type);
+  bool is16 = CV_MAT_DEPTH(type) == CV_16U;
+  frameLayout layout = {format, {}, static_cast<size_t>(width) * CV_ELEM_SIZE(type), 0, height, -1, false};
+  std::vector<unsigned char>& h = layout.header;
+  if ((!is16 && CV_MAT_DEPTH(type) != CV_8U) || (channels != 1 && channels != 3 && channels != 4)) {
+    layout.format = FORMAT_NONE;
+    return layout;
+  }
+  switch (format) {
+  case FORMAT_PPM: {
+    if (channels == 4) { // PPM has no alpha
+      layout.format = FORMAT_NONE;
+      break;
+    }
+    std::string text = std::string(channels == 1 ? "P5" : "P6") + "\n" + std::to_string(width) + " " + std::to_string(height)
+                       + "\n" + std::to_string((1 << bits) - 1) + "\n";
+    h.assign(text.begin(), text.end());
+    layout.swapCode = channels == 3 ? cv::COLOR_BGR2RGB : -1;
+    layout.isBigEndian = is16;
+    break;
+  }
+  case FORMAT_BMP: {
+    if (is16) {
+      layout.format = FORMAT_NONE;
+      break;
+    }
+    // 8-bit frames get a gray palette, 32-bit ones are stored BGRA like the frame
+    uint32_t paletteBytes = channels == 1 ? 256 * 4 : 0;
+    uint32_t pixelsOffset = 54 + paletteBytes;
+    layout.rowPadding = (4 - layout.rowBytes % 4) % 4;
+    uint32_t imageBytes = static_cast<uint32_t>(height * (layout.rowBytes + layout.rowPadding));
+    h.push_back('B');
+    h.push_back('M');
+    putLE(h, pixelsOffset + imageBytes, 4); // File size
+    putLE(h, 0, 4);
+    putLE(h, pixelsOffset, 4);    // Offset of the pixels
+    putLE(h, 40, 4);              // BITMAPINFOHEADER
+    putLE(h, width, 4);
+    putLE(h, static_cast<uint32_t>(-height), 4); // Negative height: rows are stored top-down, like the frame
+    putLE(h, 1, 2);               // Planes
+    putLE(h, 8 * channels, 2);    // Bits per pixel, stored as BGR(A)
+    putLE(h, 0, 4);               // BI_RGB, no compression
+    putLE(h, imageBytes, 4);
+    putLE(h, 2835, 4);            // 72 DPI
+    putLE(h, 2835, 4);
+    putLE(h, channels == 1 ? 256 : 0, 4); // Colors in the palette
+    putLE(h, 0, 4);
+    for (uint32_t gray = 0; gray < paletteBytes / 4; gray++) {
+      putLE(h, gray * 0x010101, 4);
+    }
+    break;
+  }
+  case FORMAT_RAS: {
+    if (is16 || channels != 3) {
+      layout.format = FORMAT_NONE;
+      break;
+    }
+    layout.rowPadding = layout.rowBytes % 2;
+    putBE(h, 0x59a66a95, 4);      // Magic
+    putBE(h, width, 4);
+    putBE(h, height, 4);
+    putBE(h, 24, 4);              // Depth
+    putBE(h, static_cast<uint32_t>(height * (layout.rowBytes + layout.rowPadding)), 4);
+    putBE(h, 1, 4);               // RT_STANDARD, 24-bit pixels are stored as BGR
+    putBE(h, 0, 4);               // No color map
+    putBE(h, 0, 4);
+    break;
+  }
+  case FORMAT_TIFF: {
+    // Little-endian header, then one IFD and its out of line values. A single BitsPerSample fits in its entry,
+    // RGBA frames have an ExtraSamples entry for the alpha.
+    const uint32_t sampleBits = is16 ? 16 : 8;
+    const uint32_t entries = channels == 4 ? 14 : 13;
+    const uint32_t valuesOffset = 8 + 2 + entries * 12 + 4;
+    const uint32_t bitsBytes = channels == 1 ? 0 : 2 * channels;
+    const uint32_t pixelsOffset = valuesOffset + bitsBytes + 8 + 8; // BitsPerSample, XResolution, YResolution
+    h.push_back('I');
+    h.push_back('I');
+    putLE(h, 42, 2);
+    putLE(h, 8, 4);
+    putLE(h, entries, 2);
+    putTiffEntry(h, 254, 4, 1, 0);                          // NewSubfileType
+    putTiffEntry(h, 256, 4, 1, width);                      // ImageWidth
+    putTiffEntry(h, 257, 4, 1, height);                     // ImageLength
+    putTiffEntry(h, 258, 3, channels, channels == 1 ? sampleBits : valuesOffset); // BitsPerSample
+    putTiffEntry(h, 259, 3, 1, 1);                          // Compression: none
+    putTiffEntry(h, 262, 3, 1, channels == 1 ? 1 : 2);      // PhotometricInterpretation: BlackIsZero or RGB
+    putTiffEntry(h, 273, 4, 1, pixelsOffset);               // StripOffsets
+    putTiffEntry(h, 277, 3, 1, channels);                   // SamplesPerPixel
+    putTiffEntry(h, 278, 4, 1, height);                     // RowsPerStrip: a single strip
+    putTiffEntry(h, 279, 4, 1, static_cast<uint32_t>(height * layout.rowBytes)); // StripByteCounts
+    putTiffEntry(h, 282, 5, 1, valuesOffset + bitsBytes);   // XResolution
+    putTiffEntry(h, 283, 5, 1, valuesOffset + bitsBytes + 8); // YResolution
+    putTiffEntry(h, 296, 3, 1, 2);                          // ResolutionUnit: inch
+    if (channels == 4) {
+      putTiffEntry(h, 338, 3, 1, 2);                        // ExtraSamples: unassociated alpha
+    }
+    putLE(h, 0, 4);                                         // No next IFD
+    for (uint32_t i = 0; i < bitsBytes / 2; i++) {
+      putLE(h, sampleBits, 2);
+    }
+    putLE(h, 72, 4);
+    putLE(h, 1, 4);
+    putLE(h, 72, 4);
+    putLE(h, 1, 4);
+    layout.swapCode = channels == 3 ? cv::COLOR_BGR2RGB : (channels == 4 ? cv::COLOR_BGRA2RGBA : -1);
+    break;
+  }
+  case FORMAT_NONE:
+    break;
+  }
+  return layout;
+}
+
+template <typename T, int Channels, bool SwapChannels, bool SwapBytes>
+inline void reorderRow(void* row, size_t pixels) {
+  /**
+ * @brief Swaps the first and third channel of every pixel and/or reverses the bytes of every sample, in place.
+ *
+ * One pass over the row for both, without the copy cv::cvtColor makes when source and destination are the same.
+ */
+  T* samples = static_cast<T*>(row);
+  for (size_t i = 0; i < pixels; i++, samples += Channels) {
+    if (SwapChannels && Channels >= 3) {
+      T first = samples[0];
+      samples[0] = samples[2];
+      samples[2] = first;
+    }
+    if (SwapBytes && sizeof(T) == 2) {
+      for (int c = 0; c < Channels; c++) {
+        samples[c] = static_cast<T>((samples[c] << 8) | (samples[c] >> 8));
+      }
+    }
+  }
+}
+
+typedef void (*rowReorder)(void* row, size_t pixels);
+
+template <typename T, int Channels>
+inline rowReorder reorderOf(bool swapChannels, bool swapBytes) {
+  if (swapChannels) {
+    return swapBytes ? reorderRow<T, Channels, true, true> : reorderRow<T, Channels, true, false>;
+  }
+  return swapBytes ? reorderRow<T, Channels, false, true> : nullptr;
+}
+
+inline void reorderFrame(cv::Mat& image, bool swapChannels, bool swapBytes) {
+  /**
+ * @brief Swaps red and blue (BGR to RGB, BGRA to RGBA) and/or the bytes of 16-bit samples, in place.
+ *
+ * Frames with fewer than 3 channels have nothing to swap, 8-bit frames no bytes.
+ */
+  bool is16 = image.depth() == CV_16U;
+  swapChannels = swapChannels && image.channels() >= 3;
+  swapBytes = swapBytes && is16;
+  rowReorder reorder = nullptr;
+  switch (image.channels()) {
+  case 1:
+    reorder = is16 ? reorderOf<uint16_t, 1>(false, swapBytes) : nullptr;
+    break;
+  case 3:
+    reorder = is16 ? reorderOf<uint16_t, 3>(swapChannels, swapBytes) : reorderOf<uint8_t, 3>(swapChannels, false);
+    break;
+  case 4:
+    reorder = is16 ? reorderOf<uint16_t, 4>(swapChannels, swapBytes) : reorderOf<uint8_t, 4>(swapChannels, false);
+    break;
+  }
+  if (reorder == nullptr) {
+    return;
+  }
+  if (image.isContinuous()) {
+    reorder(image.data, image.total());
+    return;
+  }
+  for (int row = 0; row < image.rows; row++) {
+    reorder(image.ptr(row), image.cols);
+  }
+}
+
+inline void prepareFrame(const frameLayout& layout, cv::Mat& image) {
+  /**
+ * @brief Puts the channels and the bytes of the samples in the order of the format, in place.
+ *
+ * The frame buffer is owned by the saver until it is released, so it can be modified.
+ */
+  reorderFrame(image, layout.swapCode >= 0, layout.isBigEndian);
+}
+
+inline bool writevAll(int fd, iovec* parts, size_t count) {
+  /**
+ * @brief writev() of every part, resuming after short writes.
+ */
+  while (count > 0) {
+    ssize_t n = ::writev(fd, parts, count < IOV_MAX ? count : IOV_MAX);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      return false;
+    }
+    while (count > 0 && static_cast<size_t>(n) >= parts -> iov_len) {
+      n -= parts -> iov_len;
+      parts++;
+      count--;
+    }
+    if (count > 0) {
+      parts -> iov_base = static_cast<char*>(parts -> iov_base) + n;
+      parts -> iov_len -= n;
+    }
+  }
+  return true;
+}
+
+inline bool writeFrame(int fd, const frameLayout& layout, cv::Mat& image) {
+  /**
+ * @brief Writes a prepared frame to fd with the header in front, in a single gather write.
+ *
+ * Continuous frames without row padding are one part, otherwise every row and its padding are parts.
+ */
+  static const unsigned char zeros[4] = {0, 0, 0, 0};
+  std::vector<iovec> parts;
+  parts.push_back({const_cast<unsigned char*>(layout.header.data()), layout.header.size()});
+  if (layout.rowPadding == 0 && image.isContinuous()) {
+    parts.push_back({image.data, layout.rowBytes * layout.rows});
+  } else {
+    for (int row = 0; row < layout.rows; row++) {
+      parts.push_back({image.ptr(row), layout.rowBytes});
+      if (layout.rowPadding > 0) {
+        parts.push_back({const_cast<unsigned char*>(zeros), layout.rowPadding});
+      }
+    }
+  }
+  return writevAll(fd, parts.data(), parts.size());
+}
+
+inline void encode(const frameLayout& layout, cv::Mat& image, std::vector<unsigned char>& encoded) {
+  /**
+ * @brief Builds the whole file of a frame in memory, for the outputs that need it in one buffer.
+ */
+  prepareFrame(layout, image);
+  encoded.resize(layout.fileBytes());
+  unsigned char* out = encoded.data();
+  std::memcpy(out, layout.header.data(), layout.header.size());
+  out += layout.header.size();
+  for (int row = 0; row < layout.rows; row++) {
+    std::memcpy(out, image.ptr(row), layout.rowBytes);
+    std::memset(out + layout.rowBytes, 0, layout.rowPadding);
+    out += layout.rowBytes + layout.rowPadding;
+  }
+}
+
+} // namespace directEncoder
+
+#endif // direct_encoder_h
@@ -0,0 +1,65 @@
+#ifndef frame_file_h
+#define frame_file_h
+
+#include <fcntl.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include <string>
+#include <unistd.h>
+#include "direct_encoder.hpp"
+
+/**
+ * @file frame_file.hpp
+ * @brief One file per frame: the files output of the generator and the FileSink of the pipeline library.
+ *
+ * .raw files hold the frame bytes as they are and the formats of direct_encoder.hpp a header and the
+ * rows, both written with a single writev() straight from the frame. The other formats go through cv::imwrite.
+ */
+
+struct savedFormat {
+  /**
+ * @brief A format frames can be saved in, with the layout of its built-in encoder.
+ */
+  std::string extension;
+  directEncoder::frameLayout layout; // Headerless for .raw, FORMAT_NONE when OpenCV encodes it
+
+  bool isRaw() const { return extension == ".raw"; }
+
+  bool isDirect() const { return isRaw() || layout.format != directEncoder::FORMAT_NONE; }
+
+  // The built-in encoder reorders the channels or the bytes of the frame before writing it
+  bool reordersFrame() const { return layout.swapCode >= 0 || layout.isBigEndian; }
+};
+
+inline savedFormat savedFormatOf(const std::string& extension, int width, int height, int type, int bits) {
+  /**
+ * @brief Format of an extension for frames of width x height of an OpenCV type with bits significant bits per sample.
+ */
+  if (extension == ".raw") {
+    return {extension, {directEncoder::FORMAT_NONE, {}, static_cast<size_t>(width) * CV_ELEM_SIZE(type), 0, height, -1, false}};
+  }
+  return {extension, directEncoder::layoutOf(directEncoder::formatOf(extension.c_str()), width, height, type, bits)};
+}
+
+inline bool saveFrameFile(const savedFormat& format, const std::string& filename, cv::Mat& frame) {
+  /**
+ * @brief Writes a frame to its own file in format.
+ *
+ * The built-in encoders reorder frame in place when reordersFrame() says so, callers that share the
+ * frame pass a copy. cv::imwrite may throw a cv::Exception.
+ *
+ * @return bool false if the file could not be created or written, or OpenCV could not encode the frame.
+ */
+  if (!format.isDirect()) {
+    return cv::imwrite(filename, frame);
+  }
+  int fd = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd < 0) {
+    return false;
+  }
+  directEncoder::prepareFrame(format.layout, frame);
+  bool isWritten = directEncoder::writeFrame(fd, format.layout, frame);
+  return ::close(fd) == 0 && isWritten;
+}
+
+#endif // frame_file_h
@@ -0,0 +1,90 @@
+#ifndef frame_pacer_h
+#define frame_pacer_h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <thread>
+
+/**
+ * @file frame_pacer.hpp
+ * @brief Fixed rate scheduling of the generator threads against steady_clock deadlines.
+ *
+ * Tick k of the schedule is due at start + k / fps. Every producer takes the next tick from a
+ * shared counter and waits for its deadline, so any number of producers generate at the target
+ * rate together. Deadlines are absolute, so sleeping late never accumulates into drift.
+ */
+
+enum pacingPolicy {
+  /**
+ * @brief What to do with the ticks whose deadline has already passed.
+ */
+  PACING_CATCH_UP, // Generate them back to back until the schedule is met again, up to maxLag behind
+  PACING_SKIP      // Drop every tick late by more than one period, keep only the next deadline
+};
+
+class FramePacer {
+  /**
+ * @brief Hands out the ticks of the schedule and sleeps until their deadline.
+ */
+public:
+  typedef std::chrono::steady_clock clock;
+
+  FramePacer(double fps, pacingPolicy policy, std::chrono::nanoseconds maxLag)
+      : period(std::max<int64_t>(1, static_cast<int64_t>(1e9 / fps))), start(clock::now()) {
+    // With catch-up a longer stall is not made up, the schedule jumps forward
+    lateLimit = policy == PACING_SKIP ? period : std::max(maxLag.count(), period);
+  }
+
+  uint64_t wait(int64_t& jitter) {
+    /**
+ * @brief Waits for the next tick of the schedule.
+ *
+ * The last SPIN_NS before the deadline are spent spinning instead of sleeping, which keeps
+ * the wake up jitter to a few microseconds.
+ *
+ * @param jitter Receives how late the tick started, in nanoseconds.
+ * @return uint64_t Number of ticks dropped before this one (late ticks with PACING_SKIP, or more
+ * than maxLag behind with PACING_CATCH_UP).
+ */
+    uint64_t skipped = 0;
+    while (true) {
+      uint64_t tick = nextTick.fetch_add(1, std::memory_order_relaxed);
+      clock::time_point deadline = start + std::chrono::nanoseconds(tick * period);
+      clock::time_point now = clock::now();
+      int64_t late = std::chrono::duration_cast<std::chrono::nanoseconds>(now - deadline).count();
+      if (late > lateLimit) {
+        // The tick is lost, jump the schedule to the present so the others are not claimed one by one
+        skipped++;
+        uint64_t current = std::chrono::duration_cast<std::chrono::nanoseconds>(now - start).count() / period + 1;
+        uint64_t observed = nextTick.load(std::memory_order_relaxed);
+        while (observed < current && !nextTick.compare_exchange_weak(observed, current, std::memory_order_relaxed)) {
+        }
+        if (observed < current) {
+          skipped += current - observed;
+        }
+        continue;
+      }
+      if (late < -SPIN_NS) {
+        std::this_thread::sleep_until(deadline - std::chrono::nanoseconds(SPIN_NS));
+      }
+      while ((now = clock::now()) < deadline) {
+      }
+      jitter = std::chrono::duration_cast<std::chrono::nanoseconds>(now - deadline).count();
+      return skipped;
+    }
+  }
+
+  double targetFps() const { return 1e9 / period; }
+
+private:
+  static const int64_t SPIN_NS = 200000;
+
+  int64_t period; // Nanoseconds between two ticks
+  int64_t lateLimit; // Lateness beyond which a tick is dropped
+  clock::time_point start;
+  std::atomic<uint64_t> nextTick{0};
+};
+
+#endif // frame_pacer_h
@@ -0,0 +1,185 @@
+#ifndef frame_pool_h
+#define frame_pool_h
+
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <opencv2/core.hpp>
+#include <vector>
+#include "cpu_affinity.hpp"
+#include "frame_queue.hpp"
+
+/**
+ * @file frame_pool.hpp
+ * @brief Recycled frame buffers shared by the generator and saver threads.
+ *
+ * Generators take a free buffer, fill it and queue its slot number; savers write the buffer
+ * and give the slot back. Buffers are allocated the first time they are needed and then
+ * reused for the rest of the run, so steady state generation does no heap allocation or copy.
+ * Buffers are page aligned and padded to a whole number of pages, as O_DIRECT writes require.
+ *
+ * The pool can be split between NUMA nodes: every node owns a range of slots whose buffers are bound
+ * to its memory, and a buffer always goes back to the node it came from.
+ */
+
+class FramePool {
+  /**
+ * @brief Fixed capacity set of cv::Mat buffers identified by slot number.
+ *
+ * Free slots live in a FrameQueue, so taking and returning a buffer is lock-free and a
+ * thread waiting for a buffer sleeps until one is released.
+ */
+public:
+  static const size_t ALIGNMENT = 4096;
+
+  FramePool(size_t capacity, int width, int height, int type, const std::vector<int>& numaNodes = {})
+      : frames(capacity ? capacity : 1), buffers(frames.size(), nullptr), nodes(numaNodes),
+        width(width), height(height), type(type) {
+    size_t parts = nodes.empty() ? 1 : nodes.size();
+    parts = parts < frames.size() ? parts : frames.size();
+    nodes.resize(nodes.empty() ? 0 : parts);
+    for (size_t part = 0; part <= parts; part++) {
+      firstSlots.push_back(frames.size() * part / parts);
+    }
+    for (size_t part = 0; part < parts; part++) {
+      freeSlots.emplace_back(new FrameQueue<int>(firstSlots[part + 1] - firstSlots[part]));
+      allocatedFrames.emplace_back(new std::atomic<size_t>(0));
+    }
+  }
+
+  ~FramePool() {
+    for (void* buffer : buffers) {
+      std::free(buffer);
+    }
+  }
+
+  FramePool(const FramePool&) = delete;
+  FramePool& operator=(const FramePool&) = delete;
+
+  int acquire(int part = 0) {
+    /**
+ * @brief Takes a free buffer of a part of the pool, allocating a new one while the part is below capacity.
+ *
+ * @param part Index of the NUMA node in the nodes given to the constructor, 0 if the pool is not split.
+ * @return int The slot of the buffer, or -1 if the pool was closed while waiting or the allocation failed.
+ */
+    int slot;
+    if (freeSlots[part] -> tryPop(slot)) {
+      return claim(slot);
+    }
+    std::atomic<size_t>& allocatedInPart = *allocatedFrames[part];
+    size_t n = allocatedInPart.load(std::memory_order_relaxed);
+    while (firstSlots[part] + n < firstSlots[part + 1]) {
+      if (allocatedInPart.compare_exchange_weak(n, n + 1, std::memory_order_relaxed)) {
+        size_t s = firstSlots[part] + n;
+        buffers[s] = std::aligned_alloc(ALIGNMENT, paddedBytes());
+        if (buffers[s] == nullptr) {
+          isOutOfMemory = true; // The slot stays empty, the pool runs with the buffers it already has
+          return -1;
+        }
+        if (!nodes.empty()) {
+          cpuAffinity::bindMemory(buffers[s], paddedBytes(), nodes[part]); // Before the generator first touches it
+        }
+        frames[s] = cv::Mat(height, width, type, buffers[s]);
+        return claim(static_cast<int>(s));
+      }
+    }
+    if (!freeSlots[part] -> pop(slot)) {
+      return -1;
+    }
+    return claim(slot);
+  }
+
+  void release(int slot) {
+    /**
+ * @brief Gives a buffer back to the part of the pool it belongs to.
+ */
+    usedFrames.fetch_sub(1, std::memory_order_relaxed);
+    freeSlots[partOf(slot)] -> push(slot);
+  }
+
+  void close() {
+    /**
+ * @brief Wakes up the threads waiting for a free buffer.
+ */
+    for (auto& part : freeSlots) {
+      part -> close();
+    }
+  }
+
+  size_t partOf(int slot) const {
+    /**
+ * @brief Part of the pool, i.e. NUMA node index, a slot belongs to.
+ */
+    size_t part = 0;
+    while (static_cast<size_t>(slot) >= firstSlots[part + 1]) {
+      part++;
+    }
+    return part;
+  }
+
+  size_t partCount() const { return freeSlots.size(); }
+
+  cv::Mat& at(int slot) { return frames[slot]; }
+
+  size_t capacity() const { return frames.size(); }
+
+  size_t frameBytes() const {
+    /**
+ * @brief Size of the pixels of a frame.
+ */
+    return static_cast<size_t>(width) * height * CV_ELEM_SIZE(type);
+  }
+
+  size_t paddedBytes() const {
+    /**
+ * @brief Size of a frame buffer, frameBytes() rounded up to ALIGNMENT.
+ */
+    return (frameBytes() + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+  }
+
+  size_t allocated() const {
+    /**
+ * @brief Number of buffers allocated so far.
+ */
+    size_t total = 0;
+    for (const auto& part : allocatedFrames) {
+      total += part -> load(std::memory_order_relaxed);
+    }
+    return total;
+  }
+
+  bool isFailed() const {
+    /**
+ * @brief Tells if a buffer could not be allocated, acquire() returned -1 without the pool being closed.
+ */
+    return isOutOfMemory.load(std::memory_order_relaxed);
+  }
+
+  size_t used() const {
+    /**
+ * @brief Number of buffers currently taken by generators, the queue or savers.
+ */
+    return usedFrames.load(std::memory_order_relaxed);
+  }
+
+private:
+  int claim(int slot) {
+    usedFrames.fetch_add(1, std::memory_order_relaxed);
+    return slot;
+  }
+
+  std::vector<cv::Mat> frames;
+  std::vector<void*> buffers; // Owned memory behind the frames
+  std::vector<int> nodes;     // NUMA node of each part, empty if the pool is not split
+  std::vector<size_t> firstSlots; // First slot of each part, then the capacity
+  std::vector<std::unique_ptr<FrameQueue<int>>> freeSlots; // Free slots of each part
+  std::vector<std::unique_ptr<std::atomic<size_t>>> allocatedFrames; // Buffers allocated in each part
+  std::atomic<size_t> usedFrames{0};
+  std::atomic<bool> isOutOfMemory{false};
+  int width;
+  int height;
+  int type;
+};
+
+#endif // frame_pool_h
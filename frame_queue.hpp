@@ -0,0 +1,283 @@
+#ifndef frame_queue_h
+#define frame_queue_h
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <semaphore.h>
+#include <sched.h>
+#include <vector>
+
+/**
+ * @file frame_queue.hpp
+ * @brief Lock-free bounded MPMC queue used to pass frames from the generator threads to the saver threads.
+ *
+ * Producers and consumers claim ring positions with a single atomic increment and never take a lock.
+ * Two counting semaphores (free slots and queued items) gate the ring, so a full queue or an
+ * empty queue puts the caller to sleep in the kernel instead of polling, and a post only costs
+ * a syscall when somebody is actually waiting.
+ */
+
+enum fullQueuePolicy {
+  /**
+ * @brief What a producer does when the queue is full.
+ */
+  QUEUE_BLOCK,       // Wait until a consumer frees a slot
+  QUEUE_DROP_NEWEST, // Discard the frame being pushed
+  QUEUE_DROP_OLDEST  // Discard the oldest queued frame to make room
+};
+
+enum pushResult {
+  /**
+ * @brief Outcome of FrameQueue::pushWith().
+ */
+  PUSH_QUEUED,  // The item was added, nothing was discarded
+  PUSH_CLOSED,  // The queue was closed while waiting, the item was not added
+  PUSH_DROPPED  // The policy discarded the item or the oldest queued one
+};
+
+template <typename T>
+class FrameQueue {
+  /**
+ * @brief Bounded multi-producer multi-consumer ring buffer.
+ *
+ * Each cell carries a sequence number telling whether it is ready to be written (seq == pos)
+ * or to be read (seq == pos + 1). Holding a semaphore token guarantees that the claimed cell
+ * becomes ready, the only wait left is for a neighbour that is still copying its element.
+ */
+public:
+  explicit FrameQueue(size_t capacity) : cells(capacity ? capacity : 1) {
+    for (size_t i = 0; i < cells.size(); i++) {
+      cells[i].seq.store(i, std::memory_order_relaxed);
+    }
+    sem_init(&freeSlots, 0, cells.size());
+    sem_init(&queuedItems, 0, 0);
+  }
+
+  ~FrameQueue() {
+    sem_destroy(&freeSlots);
+    sem_destroy(&queuedItems);
+  }
+
+  FrameQueue(const FrameQueue&) = delete;
+  FrameQueue& operator=(const FrameQueue&) = delete;
+
+  bool push(const T& item) {
+    /**
+ * @brief Adds an item, waiting for a free slot if the queue is full.
+ *
+ * @return false if the queue was closed before a slot became free.
+ */
+    if (!waitToken(&freeSlots)) {
+      return false;
+    }
+    enqueue(item);
+    return true;
+  }
+
+  bool tryPush(const T& item) {
+    /**
+ * @brief Adds an item only if there is a free slot right now.
+ *
+ * @return false if the queue is full or closed.
+ */
+    if (closed.load(std::memory_order_acquire) || sem_trywait(&freeSlots) != 0) {
+      return false;
+    }
+    enqueue(item);
+    return true;
+  }
+
+  bool pushEvict(const T& item, T& evicted) {
+    /**
+ * @brief Adds an item, replacing the oldest queued item if the queue is full.
+ *
+ * The slot of the evicted item is handed straight to the new item, so a concurrent
+ * producer cannot steal it in between.
+ *
+ * @param evicted Receives the discarded item when one had to be removed.
+ * @return true if an item was evicted.
+ */
+    while (true) {
+      if (sem_trywait(&freeSlots) == 0) {
+        enqueue(item);
+        return false;
+      }
+      if (sem_trywait(&queuedItems) == 0) {
+        if (available.fetch_sub(1, std::memory_order_acq_rel) > 0) {
+          dequeue(evicted);
+          enqueue(item);
+          return true;
+        }
+        available.fetch_add(1, std::memory_order_relaxed);
+        sem_post(&queuedItems);
+      }
+      // Every slot is held by a push or pop that is still in progress
+      sched_yield();
+    }
+  }
+
+  pushResult pushWith(fullQueuePolicy policy, const T& item, T& rejected) {
+    /**
+ * @brief Adds an item, doing what policy says if the queue is full.
+ *
+ * @param rejected Receives the item that is not in the queue, the new one or the evicted one,
+ * when the result is not PUSH_QUEUED. The caller releases it.
+ */
+    switch (policy) {
+    case QUEUE_BLOCK:
+      if (push(item)) {
+        return PUSH_QUEUED;
+      }
+      rejected = item;
+      return PUSH_CLOSED;
+    case QUEUE_DROP_NEWEST:
+      if (tryPush(item)) {
+        return PUSH_QUEUED;
+      }
+      rejected = item;
+      return PUSH_DROPPED;
+    case QUEUE_DROP_OLDEST:
+      return pushEvict(item, rejected) ? PUSH_DROPPED : PUSH_QUEUED;
+    }
+    return PUSH_QUEUED;
+  }
+
+  bool pop(T& item) {
+    /**
+ * @brief Removes the oldest item, sleeping until one is available.
+ *
+ * Items still queued when the queue gets closed are handed out before pop() starts failing.
+ *
+ * @return false if the queue is closed and empty.
+ */
+    while (sem_wait(&queuedItems) != 0) {
+      if (errno != EINTR) {
+        return false;
+      }
+    }
+    if (available.fetch_sub(1, std::memory_order_acq_rel) <= 0) {
+      // Wake-up token posted by close(), pass it on to the next sleeping consumer
+      available.fetch_add(1, std::memory_order_relaxed);
+      sem_post(&queuedItems);
+      return false;
+    }
+    dequeue(item);
+    sem_post(&freeSlots);
+    return true;
+  }
+
+  bool tryPop(T& item) {
+    /**
+ * @brief Removes the oldest item if there is one right now.
+ *
+ * @return false if the queue is empty.
+ */
+    if (sem_trywait(&queuedItems) != 0) {
+      return false;
+    }
+    if (available.fetch_sub(1, std::memory_order_acq_rel) <= 0) {
+      available.fetch_add(1, std::memory_order_relaxed);
+      sem_post(&queuedItems);
+      return false;
+    }
+    dequeue(item);
+    sem_post(&freeSlots);
+    return true;
+  }
+
+  void close() {
+    /**
+ * @brief Wakes up every thread blocked in push() or pop() and makes them return false.
+ */
+    closed.store(true, std::memory_order_release);
+    sem_post(&freeSlots);
+    sem_post(&queuedItems);
+  }
+
+  size_t size() const {
+    /**
+ * @brief Number of items currently in the queue.
+ */
+    long n = available.load(std::memory_order_relaxed);
+    return n > 0 ? static_cast<size_t>(n) : 0;
+  }
+
+  size_t capacity() const { return cells.size(); }
+
+  size_t withhold(size_t count) {
+    /**
+ * @brief Takes up to count free slots out of use, lowering the number of items the queue accepts.
+ *
+ * Only slots that are free right now are taken, a full queue is never waited on.
+ *
+ * @return size_t Number of slots actually withheld.
+ */
+    size_t taken = 0;
+    while (taken < count && sem_trywait(&freeSlots) == 0) {
+      taken++;
+    }
+    return taken;
+  }
+
+  void restore(size_t count) {
+    /**
+ * @brief Gives back slots taken by withhold().
+ */
+    for (size_t i = 0; i < count; i++) {
+      sem_post(&freeSlots);
+    }
+  }
+
+private:
+  struct alignas(64) cell {
+    std::atomic<size_t> seq;
+    T data;
+  };
+
+  bool waitToken(sem_t* sem) {
+    while (sem_wait(sem) != 0) {
+      if (errno != EINTR) {
+        return false;
+      }
+    }
+    if (closed.load(std::memory_order_acquire)) {
+      sem_post(sem); // Pass the wake-up on to the next blocked producer
+      return false;
+    }
+    return true;
+  }
+
+  void enqueue(const T& item) {
+    size_t pos = enqueuePos.fetch_add(1, std::memory_order_relaxed);
+    cell& c = cells[pos % cells.size()];
+    while (c.seq.load(std::memory_order_acquire) != pos) {
+      sched_yield(); // The previous reader of this cell is still copying it out
+    }
+    c.data = item;
+    c.seq.store(pos + 1, std::memory_order_release);
+    available.fetch_add(1, std::memory_order_release);
+    sem_post(&queuedItems);
+  }
+
+  void dequeue(T& item) {
+    size_t pos = dequeuePos.fetch_add(1, std::memory_order_relaxed);
+    cell& c = cells[pos % cells.size()];
+    while (c.seq.load(std::memory_order_acquire) != pos + 1) {
+      sched_yield(); // The writer of this cell is still copying it in
+    }
+    item = c.data;
+    c.data = T();
+    c.seq.store(pos + cells.size(), std::memory_order_release);
+  }
+
+  std::vector<cell> cells;
+  alignas(64) std::atomic<size_t> enqueuePos{0};
+  alignas(64) std::atomic<size_t> dequeuePos{0};
+  alignas(64) std::atomic<long> available{0};
+  std::atomic<bool> closed{false};
+  sem_t freeSlots;
+  sem_t queuedItems;
+};
+
+#endif // frame_queue_h
@@ -1,13 +1,40 @@
 #include <iostream>
 #include <opencv2/core.hpp>
 #include <opencv2/highgui.hpp>
+#include <opencv2/imgproc.hpp>
 #include <chrono>
 #include <pthread.h>
-#include <queue>
 #include <unistd.h> 
 #include <filesystem>
 #include <fstream>
 #include <cstring>
+#include <fcntl.h>
+#include <cstdint>
+#include <climits>
+#include <random>
+#include <atomic>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <thread>
+#include <csignal>
+#include "frame_queue.hpp"
+#include "frame_pool.hpp"
+#include "random_image.hpp"
+#include "pack_file.hpp"
+#include "async_writer.hpp"
+#include "mapped_output.hpp"
+#include "direct_encoder.hpp"
+#include "frame_file.hpp"
+#include "metrics.hpp"
+#include "frame_pacer.hpp"
+#include "autotuner.hpp"
+#include "stream_output.hpp"
+#include "shm_ring.hpp"
+#include "video_output.hpp"
+#include "stripe_writer.hpp"
+#include "cpu_affinity.hpp"
+#include "spill_file.hpp"
 /**
  * @file generator.cpp
  * @brief Generates random images and saves them to disk using multiple threads.
@@ -15,44 +42,205 @@
  * This program generates random images of specified dimensions, counts the frames per second (FPS),
  * and saves the images to a directory. It uses multithreading to handle image generation and saving concurrently.
  *
- * Usage: ./generator [time_unit] [duration] [threads_number]
+ * Frame N is a pure function of (seed, N), so any saved frame can be regenerated and checked later.
+ * The uncompressed formats (.ppm, .bmp, .dib, .ras, .sr, .tiff, .tif) are written by the built-in
+ * encoders of direct_encoder.hpp, a header and the frame rows in a single writev().
+ *
+ * Usage: ./generator [time_unit] [duration] [threads_number] [image_format] [options]
  * - time_unit: 's' for seconds, 'm' for minutes, 'h' for hours
  * - duration: number of time units to run the program
- * - threads_number: number of threads to use for image generation and saving (default is 3)
+ * - threads_number: number of threads to use for image generation and saving (default is 3), or auto (from --config)
+ * - image_format: extension of the saved images (.png, .raw, ...), or auto (from --config)
+ *
+ * Options:
+ * - --config FILE: load the options of FILE (written by system_check) before the command line ones
+ * - --size S: frame size, WIDTHxHEIGHT or 720p, 1080p, 4k, 8k (default is 1920x1080)
+ * - --channels N: 1 (gray), 3 (BGR, default) or 4 (BGRA, opaque alpha)
+ * - --depth N: bits per sample, 8 (default), 10, 12 or 16 (10 and 12-bit samples are stored in 16 bits)
+ * - --pattern P: content of the frames, noise (uniform, incompressible, default), gradient, gaussian, value-noise,
+ *   checker or mixed (64 pixel tiles of noise or flat color)
+ * - --entropy PERCENT: share of noise tiles of --pattern mixed, 0 compresses like a flat image (default is 50)
+ * - --producers N: number of generator threads (default is 1)
+ * - --queue-size N: maximum number of frames waiting to be saved (default is 500, within half of the available memory)
+ * - --queue-memory MB: memory the frames waiting to be saved may use instead, or auto (half of the available memory)
+ * - --spill PATH: scratch file (or directory) where frames that find the queue full are written, then read back
+ *   into the queue when the savers catch up (files and pack outputs, not with --numa)
+ * - --spill-size MB: size of the spill file, preallocated at the start (default is 4096 MB)
+ * - --queue-policy P: what to do when the queue is full, block, drop-newest or drop-oldest (default is block)
+ * - --seed S: seed of the run (default is random), it is stored in ./images/seed.txt
+ * - --output O: files (one file per frame, default), pack (frames appended to ./images/pack_*.bin segments),
+ *   mmap (.raw only, frames generated in place in the mapped file ./images/frames.raw)
+ *   stream (frames written in order to --stream-target) or shm (frames generated in place in the shared memory
+ *   ring --shm-name, read by other processes with shm_ring.hpp) or video (frames encoded in order into rolling
+ *   ./images/video_*.mkv/.avi segments), the image format is not used by stream, shm and video
+ * - --segment-size MB: size of the pack and video segments (default is 1024 MB)
+ * - --segment-frames N: also start a new video segment every N frames (default is 0, size only)
+ * - --video-codec C: codec of --output video, auto (FFV1 when available, else MJPG, default), ffv1 or mjpg
+ * - --async-io: write .raw files with the asynchronous writer (io_uring when available)
+ * - --io-depth N: writes kept in flight by each saver thread with --async-io (default is 8)
+ * - --direct-io: open the .raw files with O_DIRECT to bypass the page cache (needs --async-io)
+ * - --mmap-sync P: what saving a frame does with --output mmap, none, async or sync msync (default is async)
+ * - --mmap-chunk N: frames mapped and preallocated at once with --output mmap (default is 64)
+ * - --stream-target T: where --output stream writes, - (stdout, default), a FIFO or file path, or unix:PATH (socket)
+ * - --stream-format F: y4m (YUV4MPEG2 4:2:0 of 8-bit BGR frames of even size, default), bgr or rgb (raw pixels)
+ * - --stream-batch N: maximum number of frames written to the stream at once (default is 16)
+ * - --shm-name NAME: POSIX shared memory object of --output shm (default is /rig_frames)
+ * - --shm-slots N: frame slots of the shared memory ring (default is 32)
+ * - --shm-policy P: what happens when the readers are a whole ring behind, overwrite (default) or block
+ * - --encoders N: encode with N encoder threads and write with separate writer threads (encoded formats only)
+ * - --writers N: writer threads of the staged pipeline (default is 1)
+ * - --write-queue N: maximum number of encoded frames waiting to be written (default is 64)
+ * - --write-batch N: maximum number of encoded frames a writer takes at once (default is 16)
+ * - --metrics FILE: export the counters and the per stage latency percentiles to FILE
+ * - --metrics-format F: jsonl (one JSON object per line, default) or prometheus (text exposition format)
+ * - --metrics-interval S: seconds between two exports (default is 1)
+ * - --fps F: generate at a fixed rate of F frames per second (all producers together)
+ * - --fps-policy P: late frames with --fps, catch-up (generated back to back, default) or skip
+ * - --fps-max-lag MS: how far behind catch-up may fall before the late frames are dropped (default is 1000)
+ * - --autotune: grow and shrink the saver threads and the queue depth at runtime (not with --encoders)
+ * - --autotune-max-savers N: most saver threads --autotune may run (default is the number of CPUs)
+ * - --autotune-memory MB: memory the queued frames of --autotune may use (default is the whole queue)
+ * - --autotune-format: let --autotune switch to .bmp when every CPU is saving and the queue still fills up
+ * - --producer-cpus LIST: pin the generator threads, one CPU of LIST each in turn (e.g. 0-7,16-23)
+ * - --saver-cpus LIST: pin the saver threads (encoders and writers with --encoders) the same way
+ * - --controller-cpus LIST: CPUs the controller thread may run on
+ * - --numa: split the frame pool and the queue between the NUMA nodes of the generators, so a frame is
+ *   allocated, generated, queued and saved on one node (files and pack outputs, not with --encoders or --autotune)
+ *
+ * Verify mode: ./generator verify [threads_number] [--seed S]
+ * Regenerates the frames saved in ./images (files or pack) and checks them against the saved data, in parallel.
+ *
+ * Large image mode: ./generator large [WIDTHxHEIGHT] [file.raw|.ppm|.tiff] [threads_number] [options]
+ * Writes a single image too large for memory (e.g. 65536x65536) in stripes of rows, see largeImageMode().
  */
 
+enum outputMode {
+  /**
+ * @brief Where the frames are saved.
+ */
+  OUTPUT_FILES, // One file per frame
+  OUTPUT_PACK,  // Appended to the pack segments
+  OUTPUT_MMAP,  // Generated in place in a mapped raw file
+  OUTPUT_STREAM, // Written in order to a single stream (stdout, FIFO, socket)
+  OUTPUT_SHM,    // Generated in place in the slots of a shared memory ring
+  OUTPUT_VIDEO   // Encoded in order into rolling video segments
+};
+
 /*Global variables
 */
-  const int MAX_QUEUE_SIZE = 500; // Maximum size of the imagesList queue
+  int maxQueueSize = 500; // Maximum size of the imagesList queue
+  size_t queueMemory = 0; // Bytes of --queue-memory, 0 keeps maxQueueSize within half of the available memory
+  fullQueuePolicy queuePolicy = QUEUE_BLOCK; // What generators do when imagesList is full
 
-  int totalFrames = 0; // Total frames generated
-  int counter = 0; // Counter for saved images
-  int frames = 0; // Frames generated in the last second
-  int lostFrames = 0; // Frames that were not saved due to timing issues
-  bool isTimerRunning = false; // Timer status
+  MetricsRegistry metrics; // Per-thread counters and latency histograms of every stage
+  metricsSnapshot lastStats; // Metrics at the previous per second stats line
+  std::vector<metricsSnapshot> lastNodeStats; // Metrics of every node of numaNodes at the previous stats line
+  const char* metricsPath = nullptr; // Export file of --metrics
+  metricsFormat metricsOutput = METRICS_JSON_LINES;
+  int metricsInterval = 1; // Seconds between two exports
+  double targetFps = 0; // Frames per second of --fps, 0 generates as fast as possible
+  pacingPolicy fpsPolicy = PACING_CATCH_UP; // What to do with the late ticks of --fps
+  int fpsMaxLag = 1000; // Milliseconds catch-up may fall behind the --fps schedule
   bool isTimelimitReached = false; // Timer limit status
   const char* imageFormat;// Image format for saving
+  uint64_t seed; // Seed of the run, frame N only depends on (seed, N)
+  frameFiller fillFrame; // Fill kernel specialized for the pixel type and pattern of the run
+  std::atomic<uint64_t> nextFrame{0}; // Number of the next frame to generate
+  outputMode output = OUTPUT_FILES; // Where the saved frames go
+  uint64_t segmentSize = 1024ULL * 1024 * 1024; // Maximum size of a pack or video segment in bytes
+  uint64_t segmentFrames = 0; // Maximum number of frames of a video segment, 0 is no limit
+  videoCodec videoEncoding = VIDEO_AUTO; // Codec of the OUTPUT_VIDEO segments
+  bool isAsyncIO = false; // Write .raw files with AsyncRawWriter
+  bool isDirectIO = false; // Open .raw files with O_DIRECT
+  unsigned ioDepth = 8; // Writes in flight per saver thread with isAsyncIO
+  mappedSyncPolicy mappedSync = MAPPED_SYNC_ASYNC; // What saving a frame does with OUTPUT_MMAP
+  size_t mappedChunkFrames = 64; // Frames mapped at once with OUTPUT_MMAP
+  const char* streamTarget = "-"; // Where OUTPUT_STREAM writes, - is stdout
+  streamFormat streamEncoding = STREAM_Y4M; // Encoding of the frames with OUTPUT_STREAM
+  size_t streamBatchSize = 16; // Maximum number of frames written at once with OUTPUT_STREAM
+  std::atomic<bool> isStreamClosed{false}; // The reader of the stream went away, the video output failed or the pool ran out of memory, the run stops
+  int streamStdout = -1; // The real stdout when streaming to it, std::cout then goes to stderr
+  const char* shmName = "/rig_frames"; // Shared memory object of OUTPUT_SHM
+  uint32_t shmSlots = 32; // Frame slots of the OUTPUT_SHM ring
+  shmRingPolicy shmPolicy = SHM_OVERWRITE; // What the OUTPUT_SHM ring does when its readers are behind
+  savedFormat selectedFormat; // imageFormat and its built-in encoder, if it has one
+  savedFormat cheaperFormat; // Format --autotune-format switches to
+  std::atomic<const savedFormat*> saveFormat{&selectedFormat}; // Format the savers write now
+  int encodersNumber = 0; // Encoder threads of the staged pipeline, 0 encodes and writes in the same saver thread
+  int writersNumber = 1; // Writer threads of the staged pipeline
+  int writeQueueSize = 64; // Maximum number of encoded frames waiting to be written
+  size_t writeBatchSize = 16; // Maximum number of encoded frames written at once by a writer
+  bool isAutotune = false; // Tune the saver threads and the queue depth at runtime
+  bool isAutotuneFormat = false; // Let the tuner switch to cheaperFormat
+  int autotuneMaxSavers = 0; // Saver threads limit of the tuner, 0 is the number of CPUs
+  size_t autotuneMemory = 0; // Bytes the queued frames may use with isAutotune, 0 is maxQueueSize frames
+  std::vector<int> producerCpus; // CPUs of --producer-cpus, empty leaves the generators to the scheduler
+  std::vector<int> saverCpus; // CPUs of --saver-cpus
+  std::vector<int> controllerCpus; // CPUs of --controller-cpus
+  bool isNuma = false; // Split the frame pool and the queue between the NUMA nodes of the threads
+  const char* spillPath = nullptr; // Scratch file of --spill, frames that find the queue full overflow to it
+  uint64_t spillSize = 4096ULL * 1024 * 1024; // Bytes of the spill file
+  std::vector<int> numaNodes; // Nodes the pool and the queue are split between with isNuma
 
   // Input parameters
   int inputDuration; // Duration for which the program will run, (default 5 seconds)
   int threadsNumber; // Number of threads to be used for image generation and saving
+  int producersNumber = 1; // Number of threads generating images
 
   // Time variables
-  std::chrono::system_clock::time_point start; // Start time of the timer
-  std::chrono::system_clock::time_point end; // End time of the timer
-  std::chrono::seconds duration; // Duration of the last second of image generation
   std::chrono::seconds nowTime; // Current time
+  std::chrono::steady_clock::time_point startTime; // Start of the run
+
+struct queuedFrame{
+  /**
+ * @brief A generated image waiting to be saved.
+ *
+ * The pixels live in framePool, the queue only carries the slot and the frame number.
+ * With OUTPUT_MMAP the pixels are already in the mapped file and slot is -1.
+ * A slot of RETIRE_SLOT is no frame, it wakes up a saver waiting on the queue so it sees it was retired.
+ */
+  int slot;
+  uint64_t index;
+  uint64_t queuedAt; // metricsNow() when the frame was queued
+};
+  const int RETIRE_SLOT = -2; // Slot of the entries autotune() queues when it retires savers
+
+  // Recycled image buffers and list of generated images waiting to be saved
+  FramePool* framePool;
+  FrameQueue<queuedFrame>* imagesList;
+  std::vector<FrameQueue<queuedFrame>*> nodeLists; // Queue of every node of numaNodes, a single one (imagesList) without --numa
+  PackWriter* packWriter; // Only used with --output pack
+  MappedOutput* mappedOutput; // Only used with --output mmap
+  StreamOutput* streamOutput; // Only used with --output stream
+  VideoOutput* videoOutput; // Only used with --output video
+  ShmRingWriter* shmWriter; // Only used with --output shm
+  SpillFile* spillFile; // Only used with --spill
+  MetricsExporter* metricsExporter; // Only used with --metrics
+  FramePacer* framePacer; // Only used with --fps
+  Autotuner* autotuner; // Only used with --autotune
+  void* (*saverLoop)(void*); // Loop of the saver threads, the tuner starts new savers with it
+  std::vector<pthread_t> tunedSavers; // Savers started by the tuner, joined at the end
+  std::atomic<int> retiringSavers{0}; // Savers the tuner asked to stop
+  size_t withheldSlots = 0; // Slots of imagesList the tuner took out of use to lower the queue depth
+
+struct encodedFrame{
+  /**
+ * @brief An encoded image waiting to be written by the staged pipeline.
+ *
+ * The bytes live in encodedBuffers, the queue only carries the buffer number and the frame number.
+ */
+  int buffer;
+  uint64_t index;
+};
 
-  // Image list to hold generated images
-  std::queue<cv::Mat> imagesList;
+  // Reusable encode buffers and list of encoded images waiting to be written, only used with --encoders
+  std::vector<std::vector<uchar>> encodedBuffers;
+  FrameQueue<int>* freeEncodedBuffers;
+  FrameQueue<encodedFrame>* writeList;
 
 /*Mutexes
 */
   pthread_mutex_t globalTimeMutex = PTHREAD_MUTEX_INITIALIZER;
-  pthread_mutex_t timeMutex = PTHREAD_MUTEX_INITIALIZER;
-  pthread_mutex_t framesMutex = PTHREAD_MUTEX_INITIALIZER;
-  pthread_mutex_t listMutex = PTHREAD_MUTEX_INITIALIZER;
-  pthread_mutex_t counterMutex = PTHREAD_MUTEX_INITIALIZER;
 
 
 struct imageProperties{
@@ -60,54 +248,171 @@ struct imageProperties{
  * @brief Holds the properties of an image.
  * 
  * This structure defines the basic dimensions of an image, 
- * including its width and height in pixels.
+ * including its width and height in pixels, and its pixel type.
  */
   int width;
   int height;
+  int type; // OpenCV type of the frames: 8 or 16-bit, 1 (gray), 3 (BGR) or 4 (BGRA) channels
+  int bits; // Significant bits per sample, 10 and 12-bit samples are stored in 16 bits
+  contentPattern pattern; // Content of the frames
+  int entropy; // Percent of noise tiles of PATTERN_MIXED
+};
+
+struct generatorArgs{
+  /**
+ * @brief Holds the arguments of a generator thread.
+ *
+ * Generator threads take frame numbers from the shared nextFrame counter, and every
+ * frame number is its own RNG stream, so concurrent producers never repeat each other's images.
+ */
+  imageProperties properties;
+  int id;
 };
 
-cv::Mat generateRandomImage(int width, int height) {
+int threadNode() {
+  /**
+ * @brief Index in numaNodes of the node the calling thread runs on, 0 without --numa.
+ *
+ * Computed once per thread, the threads of a --numa run are pinned to their node. The thread's metrics
+ * are reported in the group of its node.
+ */
+  static thread_local int part = -1;
+  if (part < 0) {
+    part = 0;
+    if (isNuma) {
+      auto node = std::find(numaNodes.begin(), numaNodes.end(), cpuAffinity::currentNode());
+      part = node == numaNodes.end() ? 0 : static_cast<int>(node - numaNodes.begin());
+    }
+    metrics.local().group = part;
+  }
+  return part;
+}
+
+FrameQueue<queuedFrame>* nodeList() {
+  /**
+ * @brief Queue of the node of the calling thread, imagesList without --numa.
+ */
+  return nodeLists[threadNode()];
+}
+
+size_t queuedFrames() {
+  /**
+ * @brief Frames waiting in the queues of every node.
+ */
+  size_t queued = 0;
+  for (FrameQueue<queuedFrame>* list : nodeLists) {
+    queued += list -> size();
+  }
+  return queued;
+}
+
+std::vector<int> threadCpus(const std::vector<int>& roleCpus, int i) {
   /**
- * @brief Generates a random color image of the specified dimensions.
+ * @brief CPUs the i-th thread of a role is pinned to.
  *
- * Creates an 8-bit, 3-channel (BGR format by default in OpenCV) image
- * and fills each pixel's channels with random values between 0 and 255.
+ * One CPU of the role's list, in turn, so the scheduler can't migrate it. With --numa and no list, every
+ * allowed CPU of the nodes taken in turn. Empty when the thread is left to the scheduler.
+ */
+  if (!roleCpus.empty()) {
+    return {roleCpus[i % roleCpus.size()]};
+  }
+  if (isNuma) {
+    return cpuAffinity::cpusOfNode(numaNodes[i % numaNodes.size()], cpuAffinity::allowedCpus());
+  }
+  return {};
+}
+
+size_t availableMemory() {
+  /**
+ * @brief Memory the kernel can give without swapping (MemAvailable of /proc/meminfo), 0 if unknown.
+ */
+  std::ifstream meminfo("/proc/meminfo");
+  std::string key;
+  size_t kilobytes;
+  while (meminfo >> key >> kilobytes) {
+    if (key == "MemAvailable:") {
+      return kilobytes * 1024;
+    }
+    meminfo.ignore(256, '\n');
+  }
+  return 0;
+}
+
+bool spillFrame(const queuedFrame& frame) {
+  /**
+ * @brief Writes a frame that found the queue full to the spill file and gives its buffer back.
  *
- * @param width The desired width of the image in pixels. Must be positive.
- * @param height The desired height of the image in pixels. Must be positive.
- * @return cv::Mat An OpenCV matrix representing the generated random image.
- * Returns an empty cv::Mat if width or height are not positive.
+ * @return bool false if the spill file is full or failed, the frame then goes through the queue policy.
  */
-  if (width <= 0 || height <= 0) {
-    std::cerr << "Error: Image dimensions must be positive." << std::endl;
-    return cv::Mat(); // Return an empty Mat to indicate failure
+  if (!spillFile -> push(framePool -> at(frame.slot).data, frame.index, frame.queuedAt)) {
+    return false;
   }
-  
-  // Create an 8-bit 3-channel BGR image (Height x Width)
-  cv::Mat randomImage(height, width, CV_8UC3);
+  framePool -> release(frame.slot);
+  return true;
+}
 
-  // Fill the image with random values (0-255 for each channel)
-  cv::randu(randomImage, cv::Scalar(0, 0, 0), cv::Scalar(255, 255, 255));
+void* drainSpill(void* args) {
+  /**
+ * @brief Reads the spilled frames back, oldest first, and queues them as soon as the queue has room.
+ *
+ * The frame keeps the time it was generated, so the queue wait latency includes the time spent on disk.
+ * The generators spill every new frame while the file holds some, so the free queue slots go to the
+ * oldest frames first.
+ *
+ * @return void*
+ */
+  ThreadMetrics& stats = metrics.local();
+  while (true) {
+    int slot = framePool -> acquire();
+    if (slot < 0) {
+      if (framePool -> isFailed()) {
+        std::cerr << "Failed to allocate a frame buffer, stopping." << std::endl;
+        isStreamClosed = true;
+      }
+      break;
+    }
+    queuedFrame frame = {slot, 0, 0};
+    if (!spillFile -> pop(framePool -> at(slot).data, frame.index, frame.queuedAt)) {
+      framePool -> release(slot); // The run is over, the frames left in the file are counted as lost by main
+      break;
+    }
+    if (!imagesList -> push(frame)) {
+      framePool -> release(slot);
+      stats.add(COUNTER_LOST);
+      break;
+    }
+    stats.add(COUNTER_UNSPILLED);
+  }
+  return NULL;
+}
 
-  return randomImage;
+void releaseFrame(const queuedFrame& frame) {
+  /**
+ * @brief Gives the buffer of a frame back to framePool, mapped frames have nothing to release.
+ */
+  if (frame.slot >= 0) {
+    framePool -> release(frame.slot);
+  }
 }
 
 void* generateLoop(void* args) {
   /**
- * @brief Generates randoms images and counts FPS.
+ * @brief Generates random images.
  * 
- * Creates a primary while loop that sets the timer then a secondary while loop creates the images,
- * adds it to imagesList, increments frames counter and checks if timer is 1 second, if it is true, secondary loop breaks and prints FPS.
+ * While loop that takes a free buffer and a frame number, fills the buffer with that frame,
+ * adds it to imagesList and counts it in the metrics of the thread. With OUTPUT_MMAP the buffer is
+ * a cv::Mat header over the frame's place in the mapped file. Several generator threads can run this loop at the same time,
+ * the FPS is counted and printed by the controller thread. With --fps every frame first waits for its
+ * tick of framePacer, and how late it started is recorded as pace jitter. With OUTPUT_SHM there is no
+ * queue and no saver: the frame is generated in a slot of the shared memory ring and published to its readers.
  * 
- * @param width The desired width of the image in pixels. Must be positive.
- * @param height The desired height of the image in pixels. Must be positive.
+ * @param args Pointer to the generatorArgs of this thread.
  * @return void*
  */
 
-  imageProperties* prop = static_cast<imageProperties*>(args);
-  int width = prop -> width;
-  int height = prop -> height;
-  
+  generatorArgs* gen = static_cast<generatorArgs*>(args);
+  ThreadMetrics& stats = metrics.local();
+
   while (1){
     // Check if the global duration has reached the input duration
     pthread_mutex_lock(&globalTimeMutex);
@@ -117,104 +422,167 @@ void* generateLoop(void* args) {
       break;
     }
 
-    // Start the timer if it is not running
-    pthread_mutex_lock(&timeMutex);
-    if (isTimerRunning == false){
-      start = std::chrono::system_clock::now();
-      isTimerRunning = true;
+    if (framePacer) {
+      int64_t jitter;
+      uint64_t skipped = framePacer -> wait(jitter);
+      stats.record(STAGE_PACE_JITTER, jitter);
+      if (skipped > 0) {
+        stats.add(COUNTER_SKIPPED, skipped);
+      }
     }
-    pthread_mutex_unlock(&timeMutex);
-    
-    while (1){
-      cv::Mat myRandomImage = generateRandomImage(width, height); //create Image
 
-      pthread_mutex_lock(&listMutex);
-      if (imagesList.size() < MAX_QUEUE_SIZE) { // Check if the queue is not full
-        imagesList.push(myRandomImage); //add image to list
-      } else {
-        pthread_mutex_lock(&framesMutex);
-        lostFrames += 1; //+1 lost frame
-        pthread_mutex_unlock(&framesMutex);
-      }
-      pthread_mutex_unlock(&listMutex);
-
-      pthread_mutex_lock(&framesMutex);
-      frames += 1; //+1 frame
-      pthread_mutex_unlock(&framesMutex);
-      
-      pthread_mutex_lock(&timeMutex);
-      end = std::chrono::system_clock::now();
-      duration = std::chrono::duration_cast<std::chrono::seconds> (end - start);
-      float frameGen_duration = duration.count();
-      pthread_mutex_unlock(&timeMutex);
-
-      if (frameGen_duration >= 1) {
-        pthread_mutex_lock(&timeMutex);
-        nowTime += duration; //update time
-        pthread_mutex_unlock(&timeMutex);
-        usleep(100000); // Sleep for 100 ms to avoid busy waiting
+    if (output == OUTPUT_SHM) {
+      uint64_t overwritten;
+      int64_t sequence = shmWriter -> claim(overwritten); // waits for the readers with the block policy
+      if (sequence < 0) { // The ring was stopped while waiting
         break;
       }
+      uint64_t generateStart = metricsNow();
+      uint64_t index = nextFrame.fetch_add(1);
+      cv::Mat slotImage(gen -> properties.height, gen -> properties.width, gen -> properties.type, shmWriter -> slotData(sequence));
+      fillFrame(slotImage, seed, index, 0, gen -> properties.entropy); //create Image in the shared slot
+      shmWriter -> publish(sequence, index);
+      stats.record(STAGE_GENERATE, metricsNow() - generateStart);
+      if (overwritten) {
+        stats.add(COUNTER_LOST); // A reader will not get the frame this slot held
+      }
+      stats.add(COUNTER_SAVED);
+      stats.add(COUNTER_GENERATED);
+      continue;
     }
-    pthread_mutex_lock(&framesMutex);
-    pthread_mutex_lock(&timeMutex);
-    if (isTimerRunning == true){
-      totalFrames += frames;
-      std::cout << "→ Time: " << nowTime.count() << "s | "
-            << "FPS: " << frames << " | "
-            << "Acumulated frames: " << totalFrames << " | "
-            << "Saved frames: " << counter << " | "
-            << "Frames in queue: " << imagesList.size() << " | "
-            << "Losted frames: " << lostFrames << std::endl;
-      frames = 0;
-      isTimerRunning = false;
-    }
-    pthread_mutex_unlock(&timeMutex);
-    pthread_mutex_unlock(&framesMutex);
-    
+
+    queuedFrame frame;
+    uint64_t generateStart = metricsNow();
+    if (output == OUTPUT_MMAP) {
+      frame = {-1, nextFrame.fetch_add(1), 0};
+      unsigned char* address = mappedOutput -> frameAddress(frame.index);
+      if (address == nullptr) {
+        std::cerr << "Failed to map frame " << frame.index << " of the output file" << std::endl;
+        break;
+      }
+      cv::Mat mappedImage(gen -> properties.height, gen -> properties.width, gen -> properties.type, address);
+      fillFrame(mappedImage, seed, frame.index, 0, gen -> properties.entropy); //create Image in place
+    } else {
+      int slot = framePool -> acquire(threadNode());
+      if (slot < 0) { // The pool was closed while waiting for a buffer, or a new buffer could not be allocated
+        if (framePool -> isFailed()) {
+          std::cerr << "Failed to allocate a frame buffer, stopping." << std::endl;
+          isStreamClosed = true;
+        }
+        break;
+      }
+      frame = {slot, nextFrame.fetch_add(1), 0};
+      fillFrame(framePool -> at(slot), seed, frame.index, 0, gen -> properties.entropy); //create Image
+    }
+    frame.queuedAt = metricsNow();
+    stats.record(STAGE_GENERATE, frame.queuedAt - generateStart);
+
+    bool lost = false;
+    bool isQueued = false;
+    if (spillFile) {
+      // Overflow to disk before the queue policy applies, frames only block or drop once the file is full too.
+      // While the file holds frames new ones go behind them, the file is a FIFO in front of the queue.
+      isQueued = spillFile -> size() == 0 && nodeList() -> tryPush(frame);
+      if (!isQueued && spillFrame(frame)) {
+        isQueued = true;
+        stats.add(COUNTER_SPILLED);
+      }
+    }
+    if (!isQueued) {
+      // With the block policy this waits for a free slot, and fails only when the program is closing
+      queuedFrame rejected;
+      pushResult result = nodeList() -> pushWith(queuePolicy, frame, rejected);
+      if (result != PUSH_QUEUED) {
+        releaseFrame(rejected);
+      }
+      lost = result == PUSH_DROPPED && rejected.slot != RETIRE_SLOT; // Evicting a retirement entry loses no frame
+    }
+    if (lost) {
+      stats.add(COUNTER_LOST); //+1 lost frame
+    }
+    stats.add(COUNTER_GENERATED); //+1 frame
   }
   return NULL;
 }
 
+bool retireSaver() {
+  /**
+ * @brief Tells a saver thread to stop because the tuner retired it.
+ *
+ * Checked by the savers after every frame and when they pop a RETIRE_SLOT entry, so each retirement request
+ * stops exactly one saver. The entries wake up the savers sleeping on an empty queue, the ones left after
+ * busy savers took the retirements are skipped.
+ */
+  int retiring = retiringSavers.load();
+  while (retiring > 0) {
+    if (retiringSavers.compare_exchange_weak(retiring, retiring - 1)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool encodeFrame(const savedFormat& format, cv::Mat& image, std::vector<uchar>& encoded) {
+  /**
+ * @brief Encodes a frame in format, with the built-in encoder when there is one.
+ *
+ * The built-in encoders may reorder the channels of image in place.
+ *
+ * @return bool false if OpenCV could not encode it.
+ */
+  if (format.layout.format != directEncoder::FORMAT_NONE) {
+    directEncoder::encode(format.layout, image, encoded);
+    return true;
+  }
+  return cv::imencode(format.extension, image, encoded);
+}
+
 void* saveImage(void* args) {
   /**
  * @brief Saves images from imagesList.
  * 
- * While loop that writes a file named {$counter}.png wich includes the first image from imagesLists,
- * increments counter, and pop the image from the list.
+ * While loop that pops the first image from imagesList and writes a file named {$frame_number}.png with it,
+ * then increments counter and gives the buffer back to framePool. The thread sleeps inside the queue
+ * while there is nothing to save. The file is written by saveFrameFile(), like the FileSink of the pipeline
+ * library: .raw and the formats with a built-in encoder skip cv::imwrite and are written straight from
+ * the buffer. The format is read again for every frame, the tuner may switch it to a cheaper one during the run.
  * 
  * @return void*
  */
-  while (true) {
-    cv::Mat image;
-
-    pthread_mutex_lock(&listMutex);
-    if (imagesList.size() > 0) {
-    image = imagesList.front().clone();
-    imagesList.pop();  //delete image from list
+  ThreadMetrics& stats = metrics.local();
+  queuedFrame frame;
+  while (nodeList() -> pop(frame)) {
+    if (frame.slot == RETIRE_SLOT) {
+      if (retireSaver()) {
+        break;
+      }
+      continue;
     }
-    pthread_mutex_unlock(&listMutex);
-
+    uint64_t writeStart = metricsNow();
+    stats.record(STAGE_QUEUE_WAIT, writeStart - frame.queuedAt);
+    cv::Mat& image = framePool -> at(frame.slot);
+    const savedFormat& format = *saveFormat.load();
     if (!image.empty()){
+      bool saved = false;
       try {
-        pthread_mutex_lock(&counterMutex);
-        int this_counter = counter; // Get the current counter value
-        counter++;
-        pthread_mutex_unlock(&counterMutex);
-        std::string filename = "./images/" + std::to_string(this_counter) + imageFormat; // Use the specified image format
-        if (!cv::imwrite(filename, image)) { // This line won't throw but we use try-catch for safety
+        std::string filename = "./images/" + std::to_string(frame.index) + format.extension; // Use the specified image format
+        saved = saveFrameFile(format, filename, image); // The buffer is this saver's until released, it may be reordered
+        if (saved) {
+          stats.record(STAGE_WRITE, metricsNow() - writeStart);
+        } else {
           std::cerr << "Failed to save image: " << filename << std::endl;
         }
       } catch (const cv::Exception& ex) {
         std::cerr << "Failed to save image: " << ex.what() << std::endl;
       }
-    } else {usleep(1000); // If no image is available, wait a bit before checking again
+      stats.add(saved ? COUNTER_SAVED : COUNTER_SAVE_FAILED);
     }
+    framePool -> release(frame.slot);
     
     pthread_mutex_lock(&globalTimeMutex);
     bool limit_reached = isTimelimitReached;
     pthread_mutex_unlock(&globalTimeMutex);
-    if (limit_reached) {
+    if (limit_reached || retireSaver()) {
       break;
     }
     
@@ -222,167 +590,1823 @@ void* saveImage(void* args) {
   return NULL;
 }
 
-void* saveImageRaw(void* args) {
+const uint64_t PADDED_WRITE_TAG = 1ULL << 63; // Set in the tag of the writes that include the O_DIRECT padding
+
+void finishRawWrite(const asyncResult& result, size_t frameBytes, ThreadMetrics& stats, const std::vector<uint64_t>& submittedAt) {
+  /**
+ * @brief Completes an asynchronous .raw write: trims the O_DIRECT padding, closes the file,
+ * gives the buffer back to framePool and counts the frame as saved.
+ *
+ * The tag of the write is the slot of the frame, plus PADDED_WRITE_TAG if the padding was written.
+ * submittedAt holds the submission time of every slot, the write latency goes from there to the completion.
+ */
+  int slot = static_cast<int>(result.tag & ~PADDED_WRITE_TAG);
+  if (result.ok && (result.tag & PADDED_WRITE_TAG) && ftruncate(result.fd, frameBytes) != 0) {
+    std::cerr << "Failed to trim raw image padding" << std::endl;
+  }
+  close(result.fd);
+  framePool -> release(slot);
+  if (result.ok) {
+    stats.add(COUNTER_SAVED);
+    stats.record(STAGE_WRITE, metricsNow() - submittedAt[slot]);
+  } else {
+    stats.add(COUNTER_SAVE_FAILED);
+    std::cerr << "Failed to write raw image" << std::endl;
+  }
+}
+
+void* saveImageRawAsync(void* args) {
   /**
- * @brief Saves images from imagesList in raw format.
+ * @brief Saves images from imagesList in raw format with an AsyncRawWriter.
  * 
- * While loop that writes a file named {$counter}.raw wich includes the first image from imagesLists,
- * increments counter, and pop the image from the list.
+ * While loop that pops the first image from imagesList, opens {$frame_number}.raw and submits the write,
+ * keeping up to ioDepth writes in flight. Buffers go back to framePool when their write completes.
+ * With isDirectIO the whole page aligned buffer is written and the file is trimmed afterwards.
+ * The thread only sleeps in the queue when it has no write in flight, otherwise it waits for completions.
  * 
  * @return void*
  */
-  while (true) {
-    cv::Mat image;
+  AsyncRawWriter writer(ioDepth);
+  std::vector<asyncResult> done;
+  size_t frameBytes = framePool -> frameBytes();
+  bool isDirectSupported = isDirectIO;
+  ThreadMetrics& stats = metrics.local();
+  std::vector<uint64_t> submittedAt(framePool -> capacity());
 
-    pthread_mutex_lock(&listMutex);
-    if (imagesList.size() > 0) {
-      image = imagesList.front().clone();
-      imagesList.pop();  //delete image from list
+  queuedFrame frame;
+  while (true) {
+    if (writer.inFlight() > 0 && !nodeList() -> tryPop(frame)) {
+      writer.reap(done, true);
+    } else if (writer.inFlight() == 0 && !nodeList() -> pop(frame)) {
+      break; // The queue was closed
+    } else if (frame.slot != RETIRE_SLOT) { // A RETIRE_SLOT entry has nothing to write, the retirement is checked below
+      submittedAt[frame.slot] = metricsNow();
+      stats.record(STAGE_QUEUE_WAIT, submittedAt[frame.slot] - frame.queuedAt);
+      std::string filename = "./images/" + std::to_string(frame.index) + ".raw";
+      int flags = O_WRONLY | O_CREAT | O_TRUNC;
+      int fd = isDirectSupported ? open(filename.c_str(), flags | O_DIRECT, 0644) : -1;
+      if (fd < 0 && isDirectSupported) {
+        // The filesystem (tmpfs, ...) may not support O_DIRECT
+        std::cerr << "O_DIRECT not supported for " << filename << ", using buffered writes" << std::endl;
+        isDirectSupported = false;
+      }
+      if (fd < 0) {
+        fd = open(filename.c_str(), flags, 0644);
+      }
+      if (fd < 0) {
+        std::cerr << "Failed to open file for writing: " << filename << std::endl;
+        framePool -> release(frame.slot);
+        stats.add(COUNTER_SAVE_FAILED);
+      } else {
+        uint64_t tag = static_cast<uint64_t>(frame.slot) | (isDirectSupported ? PADDED_WRITE_TAG : 0);
+        size_t writeBytes = isDirectSupported ? framePool -> paddedBytes() : frameBytes;
+        writer.submit({fd, reinterpret_cast<const char*>(framePool -> at(frame.slot).data), writeBytes, 0, tag}, done);
+      }
+      writer.reap(done, false);
     }
-    pthread_mutex_unlock(&listMutex);
 
-    if (!image.empty()){
-      try {
-        pthread_mutex_lock(&counterMutex);
-        int this_counter = counter; // Get the current counter value
-        counter++;
-        pthread_mutex_unlock(&counterMutex);
-        std::string filename = "./images/" + std::to_string(this_counter) + ".raw";
-        std::ofstream file(filename, std::ios::binary);
-        if (!file.is_open()) {
-          std::cerr << "Failed to open file for writing: " << filename << std::endl;
-          continue;
-        }
-        file.write(reinterpret_cast<const char*>(image.data), image.total() * image.elemSize());
-        file.close();
-      } catch (const std::exception& ex) {
-        std::cerr << "Failed to save image: " << ex.what() << std::endl;
-      }
-    } else {usleep(1000); // If no image is available, wait a bit before checking again
+    for (const asyncResult& result : done) {
+      finishRawWrite(result, frameBytes, stats, submittedAt);
     }
+    done.clear();
+
     pthread_mutex_lock(&globalTimeMutex);
     bool limit_reached = isTimelimitReached;
     pthread_mutex_unlock(&globalTimeMutex);
-    if (limit_reached) {
+    if (limit_reached || retireSaver()) {
       break;
     }
-    
+  }
+
+  // Wait for the writes still in flight
+  while (writer.inFlight() > 0) {
+    writer.reap(done, true);
+  }
+  for (const asyncResult& result : done) {
+    finishRawWrite(result, frameBytes, stats, submittedAt);
   }
   return NULL;
 }
 
-void* controller(void* args) {
+void* saveImageMapped(void* args) {
   /**
- * @brief Controls the time limit for the image generation.
- *
- * This function runs in a separate thread and checks the elapsed time against the input duration.
- * If the elapsed time exceeds the input duration, it sets a flag to stop the image generation loop.
+ * @brief Saves images generated in place in the mapped output file.
+ * 
+ * While loop that pops the first frame from imagesList, applies the mappedSync policy to its pages
+ * and counts the frame as saved. The pixels are never copied, the mapping is the file.
+ * 
+ * @return void*
  */
+  ThreadMetrics& stats = metrics.local();
+  queuedFrame frame;
+  while (imagesList -> pop(frame)) {
+    if (frame.slot == RETIRE_SLOT) {
+      if (retireSaver()) {
+        break;
+      }
+      continue;
+    }
+    uint64_t writeStart = metricsNow();
+    stats.record(STAGE_QUEUE_WAIT, writeStart - frame.queuedAt);
+    mappedOutput -> complete(frame.index, mappedSync);
+    stats.record(STAGE_WRITE, metricsNow() - writeStart);
+    stats.add(COUNTER_SAVED);
 
-  // Start the timer
-  auto globalStart = std::chrono::system_clock::now();
-  while (true) {
-    int globalDuration = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now() - globalStart).count();
-    if (globalDuration >= inputDuration) {
-      pthread_mutex_lock(&globalTimeMutex);
-      isTimelimitReached = true; // Set the flag to stop the generation loop
-      pthread_mutex_unlock(&globalTimeMutex);
+    pthread_mutex_lock(&globalTimeMutex);
+    bool limit_reached = isTimelimitReached;
+    pthread_mutex_unlock(&globalTimeMutex);
+    if (limit_reached || retireSaver()) {
       break;
     }
-    usleep(100000); // Sleep for 100 milliseconds to avoid busy waiting
-  } 
+  }
   return NULL;
 }
 
-int main(int argc, char **argv) {
-  imageProperties properties = {1920,1080};
-  std::filesystem::create_directory("./images");
+void* saveImageStream(void* args) {
+  /**
+ * @brief Writes the frames from imagesList to streamOutput in frame number order.
+ * 
+ * Producers finish their frames in any order, so frames that arrive early wait in a reorder buffer
+ * (holding their pool buffer) until every frame before them has been written. Each write takes the
+ * run of consecutive frames that is ready, up to streamBatchSize, and sends it with one writev().
+ * A blocked write is the reader's backpressure: the queue fills up and the producers wait.
+ * There is a single stream thread, the order of the stream depends on it.
+ * 
+ * @return void*
+ */
+  std::map<uint64_t, queuedFrame> pending;
+  std::vector<queuedFrame> batch;
+  std::vector<cv::Mat*> images;
+  uint64_t nextIndex = 0;
+  ThreadMetrics& stats = metrics.local();
+  queuedFrame frame;
+  while (imagesList -> pop(frame)) {
+    // Take frames until a full batch can be written, the others stay in the queue for the backpressure
+    do {
+      stats.record(STAGE_QUEUE_WAIT, metricsNow() - frame.queuedAt);
+      pending.emplace(frame.index, frame);
+    } while ((pending.size() < streamBatchSize || pending.begin() -> first != nextIndex) && imagesList -> tryPop(frame));
 
-  //Console inputs
-  if (argc >= 5){
-    try{
-      threadsNumber = std::stoi(argv[3]);
-        if (threadsNumber < 3){
-          std::cout << "Threads number must be at least 3, setting to 3.\n";
-          threadsNumber = 3;
-        } else {
-          std::cout <<  "Selected " << threadsNumber << " threads" << std::endl;
-        }
-      imageFormat = argv[4];
-        if (
-            (strcmp(imageFormat, ".bmp") != 0 &&
-            strcmp(imageFormat, ".dib") != 0 &&
-            strcmp(imageFormat, ".jpeg") != 0 &&
-            strcmp(imageFormat, ".jpg") != 0 &&
-            strcmp(imageFormat, ".jpe") != 0 &&
-            strcmp(imageFormat, ".png") != 0 &&
-            strcmp(imageFormat, ".ppm") != 0 &&
-            strcmp(imageFormat, ".sr") != 0 &&
-            strcmp(imageFormat, ".ras") != 0 &&
-            strcmp(imageFormat, ".tiff") != 0 &&
-            strcmp(imageFormat, ".tif") != 0 &&
-            strcmp(imageFormat, ".hdr") != 0 &&
-            strcmp(imageFormat, ".raw") != 0) || 
-            (imageFormat[0] != '.')
-        ){
-        std::cout << "Invalid image format, closing program.\n"
-                  << "Valid formats: .bmp, .dib, .jpeg, .jpg, .jpe, .png, .ppm, .sr, .ras, .tiff, .tif, .hdr, .raw\n";
-        close(0); // Exit the program if an invalid image format is provided
-        return 1;
-      } else {
-        std::cout << "Selected image format: " << imageFormat << std::endl;
+    while (!pending.empty() && pending.begin() -> first == nextIndex) {
+      batch.clear();
+      images.clear();
+      for (auto it = pending.begin(); it != pending.end() && it -> first == nextIndex && batch.size() < streamBatchSize; it = pending.erase(it)) {
+        batch.push_back(it -> second);
+        images.push_back(&framePool -> at(it -> second.slot));
+        nextIndex++;
       }
-    }catch(const std::exception& e){
-      std::cerr << e.what() << '\n';
+      uint64_t writeStart = metricsNow();
+      bool written = streamOutput -> write(images.data(), images.size());
+      if (!written && errno == EPIPE) {
+        std::cerr << "The reader of the stream went away, stopping." << std::endl;
+      } else if (!written) {
+        std::cerr << "Failed to write to the stream: " << strerror(errno) << std::endl;
+      }
+      for (const queuedFrame& done : batch) {
+        framePool -> release(done.slot);
+      }
+      if (!written) {
+        stats.add(COUNTER_SAVE_FAILED, batch.size());
+        isStreamClosed = true;
+        break;
+      }
+      // A batch is one write, every frame of it gets the latency of the batch
+      uint64_t latency = metricsNow() - writeStart;
+      for (size_t i = 0; i < batch.size(); i++) {
+        stats.record(STAGE_WRITE, latency);
+      }
+      stats.add(COUNTER_SAVED, batch.size());
     }
-    // m minutes, s seconds, h hours
-    inputDuration = std::stoi(argv[2]);
-    switch (*argv[1])
-    {
-    case 's':
-      std::cout << "Set " << inputDuration << " seconds." << std::endl;
-      break;
-    case 'm':
-      std::cout << "Set " << inputDuration << " minutes." << std::endl;
-      inputDuration *= 60;
-      break;
-    case 'h':
-      std::cout << "Set " << inputDuration << " hours." << std::endl;
-      inputDuration *= 3600;
-      break;
-    default:
-      std::cout << "Set 5 seconds.\n";
-      inputDuration = 5;
+
+    pthread_mutex_lock(&globalTimeMutex);
+    bool limit_reached = isTimelimitReached;
+    pthread_mutex_unlock(&globalTimeMutex);
+    if (limit_reached || isStreamClosed) {
       break;
     }
-  } else {
-    std::cout << "Insufficient arguments provided.\n"
-              << "Usage: ./generator [time_unit] [duration] [threads_number] [image_format]\n"
-              << "Example: ./generator s 5 3 .png\n";
-    close(0); // Exit the program if not enough arguments are provided
-    return 1;
   }
+  // Frames behind a gap left by the end of the run are not written
+  for (const auto& waiting : pending) {
+    framePool -> release(waiting.second.slot);
+  }
+  return NULL;
+}
 
-  pthread_t threads[threadsNumber];
+void* saveImageVideo(void* args) {
+  /**
+ * @brief Encodes the frames from imagesList into videoOutput in frame number order.
+ * 
+ * This is the dedicated encoder thread of --output video: like saveImageStream it keeps the frames
+ * that arrive early in a reorder buffer, then hands every frame that is next in line to the
+ * VideoWriter, which rotates the segments. The encoder is the bottleneck of this output, a slow
+ * encode fills the queue and the producers wait.
+ * 
+ * @return void*
+ */
+  std::map<uint64_t, queuedFrame> pending;
+  uint64_t nextIndex = 0;
+  bool isFailed = false;
+  ThreadMetrics& stats = metrics.local();
+  queuedFrame frame;
+  while (!isFailed && imagesList -> pop(frame)) {
+    do {
+      stats.record(STAGE_QUEUE_WAIT, metricsNow() - frame.queuedAt);
+      pending.emplace(frame.index, frame);
+    } while (pending.begin() -> first != nextIndex && imagesList -> tryPop(frame));
 
-  //Start the program
-  std::cout << "Generating a " << properties.width << "x" << properties.height << " random image..." << std::endl;
+    while (!pending.empty() && pending.begin() -> first == nextIndex) {
+      int slot = pending.begin() -> second.slot;
+      pending.erase(pending.begin());
+      uint64_t writeStart = metricsNow();
+      isFailed = !videoOutput -> write(framePool -> at(slot));
+      framePool -> release(slot);
+      if (isFailed) {
+        stats.add(COUNTER_SAVE_FAILED);
+        std::cerr << "Could not open video segment " << videoOutput -> segmentCount() << ", stopping the video output." << std::endl;
+        isStreamClosed = true;
+        break;
+      }
+      stats.record(STAGE_ENCODE, metricsNow() - writeStart);
+      stats.add(COUNTER_SAVED);
+      nextIndex++;
+    }
 
-  pthread_create(&threads[0],nullptr,generateLoop,&properties);  
-  pthread_create(&threads[1],nullptr,controller,nullptr);  
-  for (int i = 2; i < threadsNumber; i++){
-    pthread_create(&threads[i],nullptr, strcmp(imageFormat, ".raw") ? saveImage : saveImageRaw ,nullptr); 
+    pthread_mutex_lock(&globalTimeMutex);
+    bool limit_reached = isTimelimitReached;
+    pthread_mutex_unlock(&globalTimeMutex);
+    if (limit_reached) {
+      break;
+    }
   }
-  for (int i = 0; i < threadsNumber; i++){
-    pthread_join(threads[i],nullptr);
+  // Frames behind a gap left by the end of the run are not encoded
+  for (const auto& waiting : pending) {
+    framePool -> release(waiting.second.slot);
   }
+  return NULL;
+}
 
-  // End of the program
+void* saveImagePack(void* args) {
+  /**
+ * @brief Saves images from imagesList into the pack segments.
+ * 
+ * While loop that pops the first image from imagesList, encodes it in the selected format
+ * (raw frames are appended as they are) and appends it to packWriter, then increments counter
+ * and gives the buffer back to framePool. The encode buffer is reused between frames.
+ * 
+ * @return void*
+ */
+  bool isRaw = strcmp(imageFormat, ".raw") == 0;
+  std::vector<uchar> encoded;
+  ThreadMetrics& stats = metrics.local();
+  queuedFrame frame;
+  while (nodeList() -> pop(frame)) {
+    if (frame.slot == RETIRE_SLOT) {
+      if (retireSaver()) {
+        break;
+      }
+      continue;
+    }
+    uint64_t encodeStart = metricsNow();
+    stats.record(STAGE_QUEUE_WAIT, encodeStart - frame.queuedAt);
+    cv::Mat& image = framePool -> at(frame.slot);
+    const savedFormat& format = *saveFormat.load();
+    if (!image.empty()){
+      bool saved = false;
+      try {
+        uint64_t writeStart = encodeStart;
+        if (isRaw) {
+          saved = packWriter -> append(frame.index, imageFormat, image.data, image.total() * image.elemSize());
+        } else {
+          saved = encodeFrame(format, image, encoded);
+          writeStart = metricsNow();
+          stats.record(STAGE_ENCODE, writeStart - encodeStart);
+          saved = saved && packWriter -> append(frame.index, format.extension.c_str(), encoded.data(), encoded.size());
+        }
+        if (saved) {
+          stats.record(STAGE_WRITE, metricsNow() - writeStart);
+        } else {
+          std::cerr << "Failed to save image " << frame.index << " to the pack" << std::endl;
+        }
+      } catch (const cv::Exception& ex) {
+        std::cerr << "Failed to save image: " << ex.what() << std::endl;
+      }
+      stats.add(saved ? COUNTER_SAVED : COUNTER_SAVE_FAILED);
+    }
+    framePool -> release(frame.slot);
+    pthread_mutex_lock(&globalTimeMutex);
+    bool limit_reached = isTimelimitReached;
+    pthread_mutex_unlock(&globalTimeMutex);
+    if (limit_reached || retireSaver()) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+void* encodeImage(void* args) {
+  /**
+ * @brief Encoder stage of the staged pipeline.
+ * 
+ * While loop that pops the first image from imagesList, encodes it in the selected format into a free
+ * encode buffer, gives the frame buffer back to framePool and adds the encoded bytes to writeList.
+ * Encoders only use the CPU, the disk is left to the writer threads.
+ * 
+ * @return void*
+ */
+  ThreadMetrics& stats = metrics.local();
+  queuedFrame frame;
+  while (imagesList -> pop(frame)) {
+    uint64_t encodeStart = metricsNow();
+    stats.record(STAGE_QUEUE_WAIT, encodeStart - frame.queuedAt);
+    int buffer;
+    if (!freeEncodedBuffers -> pop(buffer)) { // The pipeline was closed while waiting for a buffer
+      framePool -> release(frame.slot);
+      break;
+    }
+    bool encoded = false;
+    try {
+      encoded = encodeFrame(selectedFormat, framePool -> at(frame.slot), encodedBuffers[buffer]);
+    } catch (const cv::Exception& ex) {
+      std::cerr << "Failed to encode image: " << ex.what() << std::endl;
+    }
+    framePool -> release(frame.slot);
+
+    if (!encoded) {
+      std::cerr << "Failed to encode image " << frame.index << std::endl;
+      stats.add(COUNTER_SAVE_FAILED);
+      freeEncodedBuffers -> push(buffer);
+    } else {
+      stats.record(STAGE_ENCODE, metricsNow() - encodeStart);
+      stats.add(COUNTER_ENCODED);
+      stats.add(COUNTER_ENCODED_BYTES, encodedBuffers[buffer].size());
+      if (!writeList -> push({buffer, frame.index})) { // fails only when the program is closing
+        freeEncodedBuffers -> push(buffer);
+      }
+    }
+
+    pthread_mutex_lock(&globalTimeMutex);
+    bool limit_reached = isTimelimitReached;
+    pthread_mutex_unlock(&globalTimeMutex);
+    if (limit_reached) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+void* writeEncoded(void* args) {
+  /**
+ * @brief Writer stage of the staged pipeline.
+ * 
+ * While loop that pops the first encoded image from writeList plus the ones already waiting behind it
+ * (up to writeBatchSize), writes them to {$frame_number}{$format} files or appends the whole batch
+ * to the pack with a single call, then increments counter and gives the buffers back.
+ * 
+ * @return void*
+ */
+  std::vector<encodedFrame> batch;
+  std::vector<packBatchItem> items;
+  ThreadMetrics& stats = metrics.local();
+  encodedFrame item;
+  while (writeList -> pop(item)) {
+    batch.assign(1, item);
+    while (batch.size() < writeBatchSize && writeList -> tryPop(item)) {
+      batch.push_back(item);
+    }
+    uint64_t writeStart = metricsNow();
+
+    int saved = 0;
+    uint64_t bytes = 0;
+    if (output == OUTPUT_PACK) {
+      items.clear();
+      for (const encodedFrame& encoded : batch) {
+        const std::vector<uchar>& data = encodedBuffers[encoded.buffer];
+        items.push_back({encoded.index, data.data(), data.size()});
+        bytes += data.size();
+      }
+      if (packWriter -> appendBatch(imageFormat, items.data(), items.size())) {
+        saved = static_cast<int>(batch.size());
+      } else {
+        std::cerr << "Failed to save " << batch.size() << " images to the pack" << std::endl;
+        bytes = 0;
+      }
+    } else {
+      for (const encodedFrame& encoded : batch) {
+        const std::vector<uchar>& data = encodedBuffers[encoded.buffer];
+        std::string filename = "./images/" + std::to_string(encoded.index) + imageFormat;
+        std::ofstream file(filename, std::ios::binary);
+        file.write(reinterpret_cast<const char*>(data.data()), data.size());
+        file.close();
+        if (file.fail()) {
+          std::cerr << "Failed to save image: " << filename << std::endl;
+        } else {
+          saved++;
+          bytes += data.size();
+        }
+      }
+    }
+    for (const encodedFrame& encoded : batch) {
+      freeEncodedBuffers -> push(encoded.buffer);
+    }
+
+    // A batch is one write, every frame of it gets the latency of the batch
+    uint64_t latency = metricsNow() - writeStart;
+    for (int i = 0; i < saved; i++) {
+      stats.record(STAGE_WRITE, latency);
+    }
+    stats.add(COUNTER_SAVED, saved);
+    stats.add(COUNTER_SAVE_FAILED, batch.size() - saved);
+    stats.add(COUNTER_WRITTEN, saved);
+    stats.add(COUNTER_WRITTEN_BYTES, bytes);
+
+    pthread_mutex_lock(&globalTimeMutex);
+    bool limit_reached = isTimelimitReached;
+    pthread_mutex_unlock(&globalTimeMutex);
+    if (limit_reached) {
+      break;
+    }
+  }
+  return NULL;
+}
+
+void printStageStats(const metricsSnapshot& now) {
+  /**
+ * @brief Prints the throughput of the encode and write stages in the last second.
+ *
+ * A full writeList means the writers can't keep up (I/O-bound), a full imagesList with writers
+ * waiting means the encoders can't keep up (encode-bound).
+ */
+  const char* bound = "generation";
+  if (writeList -> size() * 4 >= writeList -> capacity() * 3) {
+    bound = "I/O";
+  } else if (imagesList -> size() * 4 >= imagesList -> capacity() * 3) {
+    bound = "encode";
+  }
+  std::cout << "  Encode: " << now.counters[COUNTER_ENCODED] - lastStats.counters[COUNTER_ENCODED] << " fps, "
+            << (now.counters[COUNTER_ENCODED_BYTES] - lastStats.counters[COUNTER_ENCODED_BYTES]) / (1024.0 * 1024.0) << " MB/s | "
+            << "Write: " << now.counters[COUNTER_WRITTEN] - lastStats.counters[COUNTER_WRITTEN] << " fps, "
+            << (now.counters[COUNTER_WRITTEN_BYTES] - lastStats.counters[COUNTER_WRITTEN_BYTES]) / (1024.0 * 1024.0) << " MB/s | "
+            << "Frames waiting to be written: " << writeList -> size() << "/" << writeList -> capacity() << " | "
+            << "Bound: " << bound << std::endl;
+}
+
+void printStats() {
+  /**
+ * @brief Prints the FPS line from the metrics of every thread.
+ *
+ * The FPS is the difference between the frames generated by all the producers now and at the
+ * previous line, so it is the combined rate of every producer. MB/s is the same rate in frame bytes,
+ * so runs with different sizes and pixel types can be compared. The p99 latencies cover the whole run.
+ */
+  metricsSnapshot now = metrics.snapshot();
+  double frameMB = framePool -> frameBytes() / (1024.0 * 1024.0);
+  uint64_t generated = now.counters[COUNTER_GENERATED] - lastStats.counters[COUNTER_GENERATED];
+  uint64_t saved = now.counters[COUNTER_SAVED] - lastStats.counters[COUNTER_SAVED];
+  std::cout << "→ Time: " << nowTime.count() << "s | "
+            << "FPS: " << generated << " (" << generated * frameMB << " MB/s) | "
+            << "Acumulated frames: " << now.counters[COUNTER_GENERATED] << " | "
+            << "Saved: " << saved << " fps (" << saved * frameMB << " MB/s) | "
+            << "Saved frames: " << now.counters[COUNTER_SAVED] << " | "
+            << "Frames in queue: " << queuedFrames() << " | "
+            << "Pool: " << framePool -> used() << "/" << framePool -> allocated() << " buffers in use | "
+            << "Losted frames: " << now.counters[COUNTER_LOST] << " | "
+            << (spillFile ? "Spilled: " + std::to_string(now.counters[COUNTER_SPILLED]) + " (" + std::to_string(spillFile -> size()) + " on disk) | " : "")
+            << "p99 generate/queue/write: " << now.stages[STAGE_GENERATE].percentile(99) / 1e6 << "/"
+            << now.stages[STAGE_QUEUE_WAIT].percentile(99) / 1e6 << "/" << now.stages[STAGE_WRITE].percentile(99) / 1e6 << " ms" << std::endl;
+  if (encodersNumber > 0) {
+    printStageStats(now);
+  }
+  if (framePacer) {
+    const histogramSnapshot& jitter = now.stages[STAGE_PACE_JITTER];
+    std::cout << "  Target: " << framePacer -> targetFps() << " fps | Actual: " << generated << " fps ("
+              << generated * 100.0 / framePacer -> targetFps() << "%) | Jitter p50/p99/max: "
+              << jitter.percentile(50) / 1e3 << "/" << jitter.percentile(99) / 1e3 << "/" << jitter.max / 1e3 << " us | "
+              << "Skipped: " << now.counters[COUNTER_SKIPPED] << std::endl;
+  }
+  for (size_t part = 0; isNuma && part < numaNodes.size(); part++) {
+    metricsSnapshot node = metrics.snapshot(static_cast<int>(part));
+    uint64_t nodeGenerated = node.counters[COUNTER_GENERATED] - lastNodeStats[part].counters[COUNTER_GENERATED];
+    uint64_t nodeSaved = node.counters[COUNTER_SAVED] - lastNodeStats[part].counters[COUNTER_SAVED];
+    std::cout << "  Node " << numaNodes[part] << ": FPS: " << nodeGenerated << " (" << nodeGenerated * frameMB << " MB/s) | "
+              << "Saved: " << nodeSaved << " fps (" << nodeSaved * frameMB << " MB/s) | "
+              << "Frames in queue: " << nodeLists[part] -> size() << std::endl;
+    lastNodeStats[part] = node;
+  }
+  lastStats = now;
+}
+
+void exportMetrics() {
+  /**
+ * @brief Writes the current metrics and the queue gauges to the --metrics file.
+ */
+  metricsGauges gauges = {
+    {"queue_frames", static_cast<double>(queuedFrames())},
+    {"queue_capacity", static_cast<double>(imagesList -> capacity() * nodeLists.size())},
+    {"pool_buffers_used", static_cast<double>(framePool -> used())},
+    {"pool_buffers_allocated", static_cast<double>(framePool -> allocated())}
+  };
+  if (writeList) {
+    gauges.push_back({"write_queue_frames", static_cast<double>(writeList -> size())});
+  }
+  if (spillFile) {
+    gauges.push_back({"spill_frames", static_cast<double>(spillFile -> size())});
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  metricsExporter -> write(metrics.snapshot(), seconds, gauges);
+}
+
+void autotune(const metricsSnapshot& previous) {
+  /**
+ * @brief Gives the last second to the tuner and applies its decision.
+ *
+ * New savers run saverLoop like the ones started by main, retired savers stop after their current frame.
+ * Every retirement queues a RETIRE_SLOT entry, so savers sleeping on an empty queue wake up and stop too.
+ * Growing the pool first cancels the retirements no saver has taken yet, then starts the missing savers.
+ * The queue depth is lowered by withholding free slots of imagesList and raised by giving them back.
+ */
+  tunerSample sample = {
+    lastStats.counters[COUNTER_GENERATED] - previous.counters[COUNTER_GENERATED],
+    lastStats.counters[COUNTER_SAVED] - previous.counters[COUNTER_SAVED],
+    lastStats.counters[COUNTER_LOST] - previous.counters[COUNTER_LOST],
+    imagesList -> size(),
+    lastStats.stages[STAGE_ENCODE].sum + lastStats.stages[STAGE_WRITE].sum
+      - previous.stages[STAGE_ENCODE].sum - previous.stages[STAGE_WRITE].sum
+  };
+  int savers = autotuner -> saverCount();
+  tunerDecision decision = autotuner -> step(sample);
+  size_t wanted = imagesList -> capacity() - decision.depth;
+  if (withheldSlots > wanted) {
+    imagesList -> restore(withheldSlots - wanted);
+    withheldSlots = wanted;
+  } else if (withheldSlots < wanted) {
+    withheldSlots += imagesList -> withhold(wanted - withheldSlots); // Queued frames keep their slots until the next second
+  }
+  if (decision.reason == nullptr) {
+    return;
+  }
+  if (savers < decision.savers) {
+    // Savers retired earlier may not have seen it yet, taking the retirement back keeps them
+    int retiring = retiringSavers.load();
+    int cancel = std::min(retiring, decision.savers - savers);
+    while (cancel > 0 && !retiringSavers.compare_exchange_weak(retiring, retiring - cancel)) {
+      cancel = std::min(retiring, decision.savers - savers);
+    }
+    savers += cancel;
+  }
+  for (; savers < decision.savers; savers++) {
+    pthread_t saver;
+    if (cpuAffinity::createThread(&saver, threadCpus(saverCpus, savers), saverLoop, nullptr) == 0) {
+      tunedSavers.push_back(saver);
+    }
+  }
+  if (savers > decision.savers) {
+    retiringSavers += savers - decision.savers;
+    for (int i = decision.savers; i < savers; i++) {
+      imagesList -> tryPush({RETIRE_SLOT, 0, metricsNow()}); // A full queue keeps every saver busy, they see it after their frame
+    }
+  }
+  if (decision.stepDownFormat) {
+    saveFormat.store(&cheaperFormat);
+  }
+  std::cout << "  Autotune: " << decision.savers << " savers | Queue depth: " << imagesList -> capacity() - withheldSlots
+            << "/" << imagesList -> capacity() << " | Format: " << saveFormat.load() -> extension << " | " << decision.reason << std::endl;
+}
+
+void* controller(void* args) {
+  /**
+ * @brief Controls the time limit for the image generation and prints the FPS every second.
+ *
+ * This function runs in a separate thread and checks the elapsed time against the input duration.
+ * If the elapsed time exceeds the input duration, it sets a flag to stop the image generation loop.
+ * The per second stats are printed from here, so they don't depend on how many generator threads are running.
+ * With --autotune the tuner runs here too, right after the stats of the second it looks at.
+ */
+
+  // Start the timer
+  auto globalStart = std::chrono::steady_clock::now();
+  auto nextReport = globalStart + std::chrono::seconds(1);
+  while (true) {
+    auto now = std::chrono::steady_clock::now();
+    if (now >= nextReport) {
+      nowTime += std::chrono::seconds(1); //update time
+      nextReport += std::chrono::seconds(1);
+      metricsSnapshot previous = lastStats;
+      printStats();
+      if (autotuner) {
+        autotune(previous);
+      }
+      if (metricsExporter && nowTime.count() % metricsInterval == 0) {
+        exportMetrics();
+      }
+    }
+    int globalDuration = std::chrono::duration_cast<std::chrono::seconds>(now - globalStart).count();
+    if (globalDuration >= inputDuration || isStreamClosed) {
+      pthread_mutex_lock(&globalTimeMutex);
+      isTimelimitReached = true; // Set the flag to stop the generation loop
+      pthread_mutex_unlock(&globalTimeMutex);
+      for (FrameQueue<queuedFrame>* list : nodeLists) {
+        list -> close(); // Wake up the threads waiting on the queue
+      }
+      framePool -> close();
+      if (shmWriter) {
+        shmWriter -> stop();
+      }
+      if (spillFile) {
+        spillFile -> close();
+      }
+      if (encodersNumber > 0) {
+        writeList -> close();
+        freeEncodedBuffers -> close();
+      }
+      break;
+    }
+    auto untilReport = std::chrono::duration_cast<std::chrono::microseconds>(nextReport - now).count();
+    usleep(std::min<long long>(untilReport, 100000)); // Sleep at most 100 milliseconds to avoid busy waiting
+  } 
+  return NULL;
+}
+
+struct verifyArgs{
+  /**
+ * @brief Holds the state shared by the verify threads.
+ *
+ * Threads take the next frame to check from the shared nextFile counter, the first
+ * frames are the files of ./images, then the entries of the pack and the frames of
+ * the mapped output file, if any.
+ */
+  imageProperties properties;
+  std::vector<std::filesystem::path> files;
+  PackReader* pack;
+  int mappedFd; // ./images/frames.raw written by --output mmap, -1 if there is none
+  uint64_t mappedFrames;
+  std::atomic<size_t> nextFile{0};
+  std::atomic<int> verified{0};
+  std::atomic<int> mismatched{0};
+  std::atomic<int> unreadable{0};
+};
+
+bool isLossyFormat(const std::string& extension) {
+  /**
+ * @brief Tells if a format does not store the exact pixels, those frames are compared by PSNR.
+ */
+  return extension == ".jpeg" || extension == ".jpg" || extension == ".jpe" || extension == ".hdr";
+}
+
+void* verifyLoop(void* args) {
+  /**
+ * @brief Checks saved frames against their regenerated content.
+ *
+ * While loop that takes the next file or pack entry, regenerates the frame with its number
+ * and compares both. Raw files are compared byte by byte, lossless formats pixel by pixel
+ * and lossy formats must have a PSNR of at least 20 dB (a different frame is about 8 dB).
+ * Lossy files are compared with what their format keeps of the frame: JPEG drops the alpha channel
+ * and Radiance stores 3 channels, read back as 8-bit BGR.
+ *
+ * @param args Pointer to the shared verifyArgs.
+ * @return void*
+ */
+  verifyArgs* job = static_cast<verifyArgs*>(args);
+  cv::Mat expected(job -> properties.height, job -> properties.width, job -> properties.type);
+  std::vector<char> data;
+  size_t packFrames = job -> pack ? job -> pack -> index().size() : 0;
+  size_t frameBytes = expected.total() * expected.elemSize();
+
+  while (true) {
+    size_t i = job -> nextFile.fetch_add(1);
+    if (i >= job -> files.size() + packFrames + job -> mappedFrames) {
+      break;
+    }
+
+    // Load the saved bytes of the frame
+    std::string name;
+    std::string extension;
+    uint64_t index;
+    bool readable;
+    if (i < job -> files.size()) {
+      const std::filesystem::path& path = job -> files[i];
+      name = path.string();
+      extension = path.extension().string();
+      index = std::stoull(path.stem().string());
+      std::ifstream file(path, std::ios::binary | std::ios::ate);
+      readable = file.is_open();
+      if (readable) {
+        data.resize(file.tellg());
+        file.seekg(0);
+        readable = static_cast<bool>(file.read(data.data(), data.size()));
+      }
+    } else if (i < job -> files.size() + packFrames) {
+      const packIndexEntry& entry = job -> pack -> index()[i - job -> files.size()];
+      name = "pack frame " + std::to_string(entry.frame);
+      extension = entry.format;
+      index = entry.frame;
+      readable = job -> pack -> read(entry, data);
+    } else {
+      index = i - job -> files.size() - packFrames;
+      name = "mapped frame " + std::to_string(index);
+      extension = ".raw";
+      data.resize(frameBytes);
+      readable = pread(job -> mappedFd, data.data(), frameBytes, index * frameBytes) == static_cast<ssize_t>(frameBytes);
+    }
+    generateRandomImage(expected, seed, index, job -> properties.bits, job -> properties.pattern, job -> properties.entropy);
+
+    bool matches = false;
+    try {
+      if (readable && extension == ".raw") {
+        size_t size = expected.total() * expected.elemSize();
+        matches = data.size() == size && std::memcmp(data.data(), expected.data, size) == 0;
+      } else if (readable) {
+        cv::Mat encoded(1, static_cast<int>(data.size()), CV_8UC1, data.data());
+        cv::Mat saved = cv::imdecode(encoded, extension == ".hdr" ? cv::IMREAD_COLOR : cv::IMREAD_UNCHANGED);
+        readable = !saved.empty();
+        cv::Mat stored = expected; // What the format keeps of the frame
+        if (readable && isLossyFormat(extension) && saved.channels() == 3 && expected.channels() == 4) {
+          cv::cvtColor(expected, stored, cv::COLOR_BGRA2BGR);
+        } else if (readable && isLossyFormat(extension) && saved.channels() == 3 && expected.channels() == 1) {
+          cv::cvtColor(expected, stored, cv::COLOR_GRAY2BGR);
+        }
+        if (readable && saved.size() == stored.size() && saved.type() == stored.type()) {
+          matches = isLossyFormat(extension) ? cv::PSNR(saved, stored) >= 20 : cv::norm(saved, stored, cv::NORM_INF) == 0;
+        }
+      }
+    } catch (const std::exception& ex) {
+      readable = false;
+    }
+
+    if (!readable) {
+      job -> unreadable++;
+      std::cerr << "Could not read: " << name << std::endl;
+    } else if (!matches) {
+      job -> mismatched++;
+      std::cerr << "Mismatch: " << name << std::endl;
+    } else {
+      job -> verified++;
+    }
+  }
+  return NULL;
+}
+
+int verifyMode(int argc, char **argv, imageProperties properties) {
+  /**
+ * @brief Regenerates the frames saved in ./images and checks the files in parallel.
+ *
+ * Usage: ./generator verify [threads_number] [--seed S]
+ * The seed defaults to the one stored in ./images/seed.txt by the run that saved the frames, the frame
+ * size, pixel type and pattern always come from there.
+ *
+ * @return int 0 if every frame matches, 1 otherwise.
+ */
+  int verifyThreads = 1;
+  bool isSeedSet = false;
+  for (int i = 2; i < argc; i++){
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+      seed = std::stoull(argv[++i]);
+      isSeedSet = true;
+    } else {
+      verifyThreads = std::max(1, std::stoi(argv[i]));
+    }
+  }
+  std::ifstream seedFile("./images/seed.txt");
+  uint64_t savedSeed;
+  if (seedFile >> savedSeed){
+    // The geometry of the run follows the seed, older runs only stored the seed and were 1920x1080 BGR noise
+    imageProperties saved = properties;
+    if (seedFile >> saved.width >> saved.height >> saved.type >> saved.bits){
+      properties = saved;
+    }
+    std::string patternName;
+    int entropy;
+    if (seedFile >> patternName >> entropy && patternOf(patternName.c_str()) != PATTERN_COUNT){
+      properties.pattern = patternOf(patternName.c_str());
+      properties.entropy = entropy;
+    }
+    if (!isSeedSet){
+      seed = savedSeed;
+      isSeedSet = true;
+    }
+  }
+  if (!isSeedSet){
+    std::cout << "No seed given and ./images/seed.txt not found, closing program.\n";
+    return 1;
+  }
+
+  verifyArgs job;
+  job.properties = properties;
+  for (const auto& entry : std::filesystem::directory_iterator("./images")){
+    std::string stem = entry.path().stem().string();
+    if (entry.is_regular_file() && !stem.empty() && std::all_of(stem.begin(), stem.end(), ::isdigit)){
+      job.files.push_back(entry.path());
+    }
+  }
+  PackReader pack("./images");
+  job.pack = pack.isValid() ? &pack : nullptr;
+  if (job.pack) {
+    pack.openSegments();
+  }
+  job.mappedFd = open("./images/frames.raw", O_RDONLY);
+  job.mappedFrames = 0;
+  if (job.mappedFd >= 0) {
+    job.mappedFrames = std::filesystem::file_size("./images/frames.raw") / (static_cast<uint64_t>(properties.width) * properties.height * CV_ELEM_SIZE(properties.type));
+  }
+  std::cout << "Verifying " << job.files.size() + (job.pack ? pack.index().size() : 0) + job.mappedFrames << " frames with seed " << seed
+            << " using " << verifyThreads << " threads..." << std::endl;
+
+  std::vector<pthread_t> threads(verifyThreads);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < verifyThreads; i++){
+    pthread_create(&threads[i],nullptr,verifyLoop,&job);
+  }
+  for (int i = 0; i < verifyThreads; i++){
+    pthread_join(threads[i],nullptr);
+  }
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  if (job.mappedFd >= 0) {
+    close(job.mappedFd);
+  }
+
+  std::cout << "\n--- VERIFY SUMMARY ---\n"
+            << "→ Frames verified: " << job.verified << "\n"
+            << "→ Frames mismatched: " << job.mismatched << "\n"
+            << "→ Frames unreadable: " << job.unreadable << "\n"
+            << "→ Time: " << seconds << " seconds\n";
+  return job.mismatched == 0 && job.unreadable == 0 ? 0 : 1;
+}
+
+struct largeArgs{
+  /**
+ * @brief Holds the state shared by the threads of the large image mode.
+ *
+ * Threads take the next stripe from the shared nextStripe counter, fill it and write it.
+ */
+  imageProperties properties;
+  StripeWriter* writer;
+  frameFiller fill;
+  uint64_t index; // Frame number of the image in the (seed, N) sequence
+  int stripeRows;
+  std::atomic<int> nextStripe{0};
+  std::atomic<uint64_t> writtenRows{0};
+  std::atomic<bool> isFailed{false};
+};
+
+void* largeLoop(void* args) {
+  /**
+ * @brief Fills and writes stripes of the large image until every stripe is taken.
+ *
+ * Each thread reuses one stripe buffer, so the memory used is stripeRows rows per thread whatever
+ * the size of the image. A stripe only depends on its first row, not on the thread that fills it.
+ *
+ * @param args Pointer to the shared largeArgs.
+ * @return void*
+ */
+  largeArgs* job = static_cast<largeArgs*>(args);
+  cv::Mat stripe(job -> stripeRows, job -> properties.width, job -> properties.type);
+  std::vector<unsigned char> scratch;
+  while (!job -> isFailed) {
+    int firstRow = job -> nextStripe++ * job -> stripeRows;
+    if (firstRow >= job -> properties.height) {
+      break;
+    }
+    cv::Mat part = stripe.rowRange(0, std::min(job -> stripeRows, job -> properties.height - firstRow));
+    job -> fill(part, seed, job -> index, firstRow, job -> properties.entropy);
+    if (!job -> writer -> write(part, firstRow, scratch)) {
+      std::cerr << "Failed to write rows " << firstRow << " to " << firstRow + part.rows << ": " << strerror(errno) << std::endl;
+      job -> isFailed = true;
+      break;
+    }
+    job -> writtenRows += part.rows;
+  }
+  return NULL;
+}
+
+bool parseSize(const char* size, imageProperties& properties) {
+  /**
+ * @brief Reads a WIDTHxHEIGHT size or one of the 720p, 1080p, 4k and 8k presets.
+ *
+ * @return bool false if the size is not valid, properties is then left unchanged.
+ */
+  const char* presets[][2] = {{"720p", "1280x720"}, {"1080p", "1920x1080"}, {"4k", "3840x2160"}, {"8k", "7680x4320"}};
+  for (const auto& preset : presets) {
+    if (strcmp(size, preset[0]) == 0) {
+      size = preset[1];
+    }
+  }
+  int width, height;
+  if (sscanf(size, "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+    return false;
+  }
+  properties.width = width;
+  properties.height = height;
+  return true;
+}
+
+int largeImageMode(int argc, char **argv, imageProperties properties) {
+  /**
+ * @brief Generates one very large image with every core and streams it to a file, a stripe at a time.
+ *
+ * Usage: ./generator large [WIDTHxHEIGHT] [file.raw|.ppm|.tiff] [threads_number] [--seed S] [--index N]
+ *        [--channels 1|3|4] [--depth 8|10|12|16] [--pattern P] [--entropy PERCENT] [--stripe-rows N]
+ * The image is frame --index (default 0) of the seed: the RNG position of every byte is derived from its
+ * row, so the file is the same for any thread count or stripe height, and is the frame a normal run of
+ * that size and seed would generate. The memory used is about threads_number stripes.
+ *
+ * @return int 0 if the whole image was written, 1 otherwise.
+ */
+  if (argc < 4 || !parseSize(argv[2], properties)){
+    std::cout << "Usage: ./generator large [WIDTHxHEIGHT] [file.raw|.ppm|.tiff] [threads_number] [--seed S] [--index N]\n"
+              << "       [--channels 1|3|4] [--depth 8|10|12|16] [--pattern P] [--entropy PERCENT] [--stripe-rows N]\n"
+              << "Example: ./generator large 65536x65536 ./images/large.tiff\n";
+    return 1;
+  }
+  std::string path = argv[3];
+  std::string extension = std::filesystem::path(path).extension().string();
+  stripeFormat format;
+  if (extension == ".raw") {
+    format = STRIPE_RAW;
+  } else if (extension == ".ppm") {
+    format = STRIPE_PPM;
+  } else if (extension == ".tiff" || extension == ".tif") {
+    format = STRIPE_TIFF;
+  } else {
+    std::cout << "Invalid large image format, valid formats: .raw, .ppm, .tiff, .tif.\n";
+    return 1;
+  }
+
+  int largeThreads = std::max(1u, std::thread::hardware_concurrency());
+  int channels = 3;
+  int stripeRows = 0;
+  uint64_t index = 0;
+  bool isSeedSet = false;
+  for (int i = 4; i < argc; i++){
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+      seed = std::stoull(argv[++i]);
+      isSeedSet = true;
+    } else if (strcmp(argv[i], "--index") == 0 && i + 1 < argc){
+      index = std::stoull(argv[++i]);
+    } else if (strcmp(argv[i], "--channels") == 0 && i + 1 < argc){
+      channels = std::stoi(argv[++i]);
+    } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc){
+      properties.bits = std::stoi(argv[++i]);
+    } else if (strcmp(argv[i], "--pattern") == 0 && i + 1 < argc){
+      properties.pattern = patternOf(argv[++i]);
+    } else if (strcmp(argv[i], "--entropy") == 0 && i + 1 < argc){
+      properties.entropy = std::min(100, std::max(0, std::stoi(argv[++i])));
+    } else if (strcmp(argv[i], "--stripe-rows") == 0 && i + 1 < argc){
+      stripeRows = std::max(1, std::stoi(argv[++i]));
+    } else {
+      largeThreads = std::max(1, std::stoi(argv[i]));
+    }
+  }
+  properties.type = CV_MAKETYPE(properties.bits > 8 ? CV_16U : CV_8U, channels);
+  if (properties.pattern == PATTERN_COUNT){
+    std::cout << "Invalid pattern, valid patterns: noise, gradient, gaussian, value-noise, checker, mixed.\n";
+    return 1;
+  }
+  frameFiller fill = fillerOf(properties.type, properties.bits, properties.pattern);
+  if (fill == nullptr){
+    std::cout << "Invalid pixel type, valid channels: 1, 3, 4, valid depths: 8, 10, 12, 16.\n";
+    return 1;
+  }
+  if (!isSeedSet){
+    seed = (static_cast<uint64_t>(std::random_device{}()) << 32) ^ std::random_device{}();
+  }
+
+  StripeWriter writer(path, format, properties.width, properties.height, properties.type, properties.bits);
+  if (!writer.isOpen()){
+    std::cout << "Could not create " << path << (format == STRIPE_PPM && channels == 4 ? " (PPM has no alpha channel)" : "")
+              << ": " << strerror(errno) << ", closing program.\n";
+    return 1;
+  }
+  // About 16 MB per stripe by default, TIFF stripes are whole rows of tiles
+  size_t rowBytes = static_cast<size_t>(properties.width) * CV_ELEM_SIZE(properties.type);
+  if (stripeRows == 0){
+    stripeRows = static_cast<int>(std::max<size_t>(1, (16 << 20) / rowBytes));
+  }
+  int alignment = writer.rowAlignment();
+  stripeRows = std::min((stripeRows + alignment - 1) / alignment * alignment, (properties.height + alignment - 1) / alignment * alignment);
+
+  largeArgs job;
+  job.properties = properties;
+  job.writer = &writer;
+  job.fill = fill;
+  job.index = index;
+  job.stripeRows = stripeRows;
+  std::cout << "Generating a " << properties.width << "x" << properties.height << " " << PATTERN_NAMES[properties.pattern]
+            << " image (" << channels << " channels, " << properties.bits << "-bit, " << writer.size() / (1024.0 * 1024.0) << " MB) into " << path << " with seed "
+            << seed << ", frame " << index << ", using " << largeThreads << " threads and stripes of " << stripeRows << " rows ("
+            << stripeRows * rowBytes / (1024.0 * 1024.0) << " MB)..." << std::endl;
+
+  std::vector<pthread_t> threads(largeThreads);
+  auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < largeThreads; i++){
+    pthread_create(&threads[i],nullptr,largeLoop,&job);
+  }
+  uint64_t lastRows = 0;
+  auto nextReport = start + std::chrono::seconds(1);
+  while (job.writtenRows < static_cast<uint64_t>(properties.height) && !job.isFailed){
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    if (std::chrono::steady_clock::now() >= nextReport){
+      uint64_t rows = job.writtenRows;
+      std::cout << "→ Rows: " << rows << "/" << properties.height << " (" << rows * 100.0 / properties.height << "%) | "
+                << (rows - lastRows) * rowBytes / (1024.0 * 1024.0) << " MB/s" << std::endl;
+      lastRows = rows;
+      nextReport += std::chrono::seconds(1);
+    }
+  }
+  for (int i = 0; i < largeThreads; i++){
+    pthread_join(threads[i],nullptr);
+  }
+  bool isClosed = writer.close();
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << "\n--- SUMMARY ---\n"
+            << "→ Rows written: " << job.writtenRows << "/" << properties.height << "\n"
+            << "→ Time: " << seconds << " seconds\n"
+            << "→ Average: " << job.writtenRows * rowBytes / (1024.0 * 1024.0) / seconds << " MB/s\n"
+            << "→ Seed: " << seed << "\n";
+  return !job.isFailed && isClosed ? 0 : 1;
+}
+
+bool loadConfig(const char* path, std::vector<std::string>& options, std::string& threads, std::string& format) {
+  /**
+ * @brief Reads a config file written by system_check.
+ *
+ * Every "option=value" line becomes the command line option --option value ("true" values become a
+ * plain --option flag), except threads and format, which replace the positional arguments given as auto.
+ * Empty lines and lines starting with # are ignored.
+ *
+ * @return bool false if the file could not be opened.
+ */
+  std::ifstream config(path);
+  if (!config.is_open()) {
+    return false;
+  }
+  std::string line;
+  while (std::getline(config, line)) {
+    size_t separator = line.find('=');
+    if (line.empty() || line[0] == '#' || separator == std::string::npos) {
+      continue;
+    }
+    std::string key = line.substr(0, separator);
+    std::string value = line.substr(separator + 1);
+    if (key == "threads") {
+      threads = value;
+    } else if (key == "format") {
+      format = value;
+    } else {
+      options.push_back("--" + key);
+      if (value != "true") {
+        options.push_back(value);
+      }
+    }
+  }
+  return true;
+}
+
+int main(int argc, char **argv) {
+  imageProperties properties = {1920,1080,CV_8UC3,8,PATTERN_NOISE,DEFAULT_ENTROPY};
+  std::filesystem::create_directory("./images");
+
+  if (argc >= 2 && strcmp(argv[1], "verify") == 0){
+    return verifyMode(argc, argv, properties);
+  }
+  if (argc >= 2 && strcmp(argv[1], "large") == 0){
+    return largeImageMode(argc, argv, properties);
+  }
+
+  //Console inputs
+  bool isSeedSet = false;
+  int channels = 3;
+  std::vector<std::string> configOptions;
+  std::string configThreads;
+  std::string configFormat;
+  std::vector<char*> arguments;
+  if (argc >= 5){
+    // The options of a config file go before the command line ones, so the command line overrides them
+    for (int i = 5; i + 1 < argc; i++){
+      if (strcmp(argv[i], "--config") == 0 && !loadConfig(argv[i + 1], configOptions, configThreads, configFormat)){
+        std::cout << "Could not read the config file " << argv[i + 1] << ", closing program.\n";
+        return 1;
+      }
+    }
+    arguments.assign(argv, argv + 5);
+    for (std::string& option : configOptions){
+      arguments.push_back(&option[0]);
+    }
+    arguments.insert(arguments.end(), argv + 5, argv + argc);
+    argc = static_cast<int>(arguments.size());
+    argv = arguments.data();
+    // Frames streamed to stdout own it, everything the program prints goes to stderr instead
+    bool isStreamOutput = false;
+    for (int i = 5; i + 1 < argc; i++){
+      if (strcmp(argv[i], "--output") == 0){
+        isStreamOutput = strcmp(argv[i + 1], "stream") == 0;
+      } else if (strcmp(argv[i], "--stream-target") == 0){
+        streamTarget = argv[i + 1];
+      }
+    }
+    if (isStreamOutput && strcmp(streamTarget, "-") == 0){
+      streamStdout = dup(STDOUT_FILENO);
+      dup2(STDERR_FILENO, STDOUT_FILENO);
+    }
+    if ((strcmp(argv[3], "auto") == 0 && configThreads.empty()) || (strcmp(argv[4], "auto") == 0 && configFormat.empty())){
+      std::cout << "auto needs a --config file with threads and format, run ./system_check to create one.\n";
+      return 1;
+    }
+    try{
+      threadsNumber = std::stoi(strcmp(argv[3], "auto") == 0 ? configThreads : argv[3]);
+        if (threadsNumber < 3){
+          std::cout << "Threads number must be at least 3, setting to 3.\n";
+          threadsNumber = 3;
+        } else {
+          std::cout <<  "Selected " << threadsNumber << " threads" << std::endl;
+        }
+      imageFormat = strcmp(argv[4], "auto") == 0 ? configFormat.c_str() : argv[4];
+        if (
+            (strcmp(imageFormat, ".bmp") != 0 &&
+            strcmp(imageFormat, ".dib") != 0 &&
+            strcmp(imageFormat, ".jpeg") != 0 &&
+            strcmp(imageFormat, ".jpg") != 0 &&
+            strcmp(imageFormat, ".jpe") != 0 &&
+            strcmp(imageFormat, ".png") != 0 &&
+            strcmp(imageFormat, ".ppm") != 0 &&
+            strcmp(imageFormat, ".sr") != 0 &&
+            strcmp(imageFormat, ".ras") != 0 &&
+            strcmp(imageFormat, ".tiff") != 0 &&
+            strcmp(imageFormat, ".tif") != 0 &&
+            strcmp(imageFormat, ".hdr") != 0 &&
+            strcmp(imageFormat, ".raw") != 0) || 
+            (imageFormat[0] != '.')
+        ){
+        std::cout << "Invalid image format, closing program.\n"
+                  << "Valid formats: .bmp, .dib, .jpeg, .jpg, .jpe, .png, .ppm, .sr, .ras, .tiff, .tif, .hdr, .raw\n";
+        close(0); // Exit the program if an invalid image format is provided
+        return 1;
+      } else {
+        std::cout << "Selected image format: " << imageFormat << std::endl;
+      }
+    }catch(const std::exception& e){
+      std::cerr << e.what() << '\n';
+    }
+    // Optional arguments
+    for (int i = 5; i < argc; i++){
+      if (strcmp(argv[i], "--config") == 0 && i + 1 < argc){
+        i++; // Already loaded
+      } else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc){
+        if (!parseSize(argv[++i], properties)) {
+          std::cout << "Invalid size, use WIDTHxHEIGHT or one of 720p, 1080p, 4k, 8k.\n";
+          return 1;
+        }
+      } else if (strcmp(argv[i], "--channels") == 0 && i + 1 < argc){
+        channels = std::stoi(argv[++i]);
+        if (channels != 1 && channels != 3 && channels != 4) {
+          std::cout << "Invalid channels, valid channels: 1 (gray), 3 (BGR), 4 (BGRA).\n";
+          return 1;
+        }
+      } else if (strcmp(argv[i], "--depth") == 0 && i + 1 < argc){
+        properties.bits = std::stoi(argv[++i]);
+        if (properties.bits != 8 && properties.bits != 10 && properties.bits != 12 && properties.bits != 16) {
+          std::cout << "Invalid depth, valid depths: 8, 10, 12, 16 (10 and 12-bit samples are stored in 16 bits).\n";
+          return 1;
+        }
+      } else if (strcmp(argv[i], "--pattern") == 0 && i + 1 < argc){
+        properties.pattern = patternOf(argv[++i]);
+        if (properties.pattern == PATTERN_COUNT) {
+          std::cout << "Invalid pattern, valid patterns: noise, gradient, gaussian, value-noise, checker, mixed.\n";
+          return 1;
+        }
+      } else if (strcmp(argv[i], "--entropy") == 0 && i + 1 < argc){
+        int percent = std::stoi(argv[++i]);
+        if (percent < 0 || percent > 100) {
+          std::cout << "Invalid entropy, valid entropies: 0 to 100 (percent of noise tiles).\n";
+          return 1;
+        }
+        properties.entropy = percent;
+      } else if ((strcmp(argv[i], "--producer-cpus") == 0 || strcmp(argv[i], "--saver-cpus") == 0
+                  || strcmp(argv[i], "--controller-cpus") == 0) && i + 1 < argc){
+        std::vector<int>& roleCpus = strcmp(argv[i], "--producer-cpus") == 0 ? producerCpus
+                                     : (strcmp(argv[i], "--saver-cpus") == 0 ? saverCpus : controllerCpus);
+        roleCpus = cpuAffinity::parseList(argv[++i]);
+        if (roleCpus.empty()) {
+          std::cout << "Invalid CPU list " << argv[i] << ", use CPU numbers and ranges like 0-7,16-23.\n";
+          return 1;
+        }
+      } else if (strcmp(argv[i], "--numa") == 0){
+        isNuma = true;
+      } else if (strcmp(argv[i], "--producers") == 0 && i + 1 < argc){
+        producersNumber = std::max(1, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc){
+        seed = std::stoull(argv[++i]);
+        isSeedSet = true;
+      } else if (strcmp(argv[i], "--output") == 0 && i + 1 < argc){
+        i++;
+        if (strcmp(argv[i], "files") == 0) {
+          output = OUTPUT_FILES;
+        } else if (strcmp(argv[i], "pack") == 0) {
+          output = OUTPUT_PACK;
+        } else if (strcmp(argv[i], "mmap") == 0) {
+          output = OUTPUT_MMAP;
+        } else if (strcmp(argv[i], "stream") == 0) {
+          output = OUTPUT_STREAM;
+        } else if (strcmp(argv[i], "shm") == 0) {
+          output = OUTPUT_SHM;
+        } else if (strcmp(argv[i], "video") == 0) {
+          output = OUTPUT_VIDEO;
+        } else {
+          std::cout << "Invalid output, valid outputs: files, pack, mmap, stream, shm, video.\n";
+          return 1;
+        }
+      } else if (strcmp(argv[i], "--segment-frames") == 0 && i + 1 < argc){
+        segmentFrames = std::stoull(argv[++i]);
+      } else if (strcmp(argv[i], "--video-codec") == 0 && i + 1 < argc){
+        i++;
+        if (strcmp(argv[i], "auto") == 0) {
+          videoEncoding = VIDEO_AUTO;
+        } else if (strcmp(argv[i], "ffv1") == 0) {
+          videoEncoding = VIDEO_FFV1;
+        } else if (strcmp(argv[i], "mjpg") == 0) {
+          videoEncoding = VIDEO_MJPG;
+        } else {
+          std::cout << "Invalid video codec, valid codecs: auto, ffv1, mjpg.\n";
+          return 1;
+        }
+      } else if (strcmp(argv[i], "--shm-name") == 0 && i + 1 < argc){
+        shmName = argv[++i];
+      } else if (strcmp(argv[i], "--shm-slots") == 0 && i + 1 < argc){
+        shmSlots = std::max(1, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "--shm-policy") == 0 && i + 1 < argc){
+        i++;
+        if (strcmp(argv[i], "overwrite") == 0) {
+          shmPolicy = SHM_OVERWRITE;
+        } else if (strcmp(argv[i], "block") == 0) {
+          shmPolicy = SHM_BLOCK;
+        } else {
+          std::cout << "Invalid shm policy, valid policies: overwrite, block.\n";
+          return 1;
+        }
+      } else if (strcmp(argv[i], "--stream-target") == 0 && i + 1 < argc){
+        streamTarget = argv[++i];
+      } else if (strcmp(argv[i], "--stream-format") == 0 && i + 1 < argc){
+        i++;
+        if (strcmp(argv[i], "y4m") == 0) {
+          streamEncoding = STREAM_Y4M;
+        } else if (strcmp(argv[i], "bgr") == 0) {
+          streamEncoding = STREAM_BGR;
+        } else if (strcmp(argv[i], "rgb") == 0) {
+          streamEncoding = STREAM_RGB;
+        } else {
+          std::cout << "Invalid stream format, valid formats: y4m, bgr, rgb.\n";
+          return 1;
+        }
+      } else if (strcmp(argv[i], "--stream-batch") == 0 && i + 1 < argc){
+        streamBatchSize = std::max(1, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "--mmap-sync") == 0 && i + 1 < argc){
+        i++;
+        if (strcmp(argv[i], "none") == 0) {
+          mappedSync = MAPPED_SYNC_NONE;
+        } else if (strcmp(argv[i], "async") == 0) {
+          mappedSync = MAPPED_SYNC_ASYNC;
+        } else if (strcmp(argv[i], "sync") == 0) {
+          mappedSync = MAPPED_SYNC_SYNC;
+        } else {
+          std::cout << "Invalid mmap sync policy, valid policies: none, async, sync.\n";
+          return 1;
+        }
+      } else if (strcmp(argv[i], "--mmap-chunk") == 0 && i + 1 < argc){
+        mappedChunkFrames = std::max(1, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "--segment-size") == 0 && i + 1 < argc){
+        segmentSize = std::max(1ULL, std::stoull(argv[++i])) * 1024 * 1024;
+      } else if (strcmp(argv[i], "--async-io") == 0){
+        isAsyncIO = true;
+      } else if (strcmp(argv[i], "--direct-io") == 0){
+        isDirectIO = true;
+      } else if (strcmp(argv[i], "--io-depth") == 0 && i + 1 < argc){
+        ioDepth = std::max(1, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "--encoders") == 0 && i + 1 < argc){
+        encodersNumber = std::max(0, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "--writers") == 0 && i + 1 < argc){
+        writersNumber = std::max(1, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "--write-queue") == 0 && i + 1 < argc){
+        writeQueueSize = std::max(1, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "--write-batch") == 0 && i + 1 < argc){
+        writeBatchSize = std::max(1, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc){
+        metricsPath = argv[++i];
+      } else if (strcmp(argv[i], "--metrics-format") == 0 && i + 1 < argc){
+        i++;
+        if (strcmp(argv[i], "jsonl") == 0) {
+          metricsOutput = METRICS_JSON_LINES;
+        } else if (strcmp(argv[i], "prometheus") == 0) {
+          metricsOutput = METRICS_PROMETHEUS;
+        } else {
+          std::cout << "Invalid metrics format, valid formats: jsonl, prometheus.\n";
+          return 1;
+        }
+      } else if (strcmp(argv[i], "--metrics-interval") == 0 && i + 1 < argc){
+        metricsInterval = std::max(1, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc){
+        targetFps = std::max(0.0, std::stod(argv[++i]));
+      } else if (strcmp(argv[i], "--fps-policy") == 0 && i + 1 < argc){
+        i++;
+        if (strcmp(argv[i], "catch-up") == 0) {
+          fpsPolicy = PACING_CATCH_UP;
+        } else if (strcmp(argv[i], "skip") == 0) {
+          fpsPolicy = PACING_SKIP;
+        } else {
+          std::cout << "Invalid fps policy, valid policies: catch-up, skip.\n";
+          return 1;
+        }
+      } else if (strcmp(argv[i], "--fps-max-lag") == 0 && i + 1 < argc){
+        fpsMaxLag = std::max(0, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "--autotune") == 0){
+        isAutotune = true;
+      } else if (strcmp(argv[i], "--autotune-format") == 0){
+        isAutotuneFormat = true;
+      } else if (strcmp(argv[i], "--autotune-max-savers") == 0 && i + 1 < argc){
+        autotuneMaxSavers = std::max(1, std::stoi(argv[++i]));
+      } else if (strcmp(argv[i], "--autotune-memory") == 0 && i + 1 < argc){
+        autotuneMemory = std::max(1ULL, std::stoull(argv[++i])) * 1024 * 1024;
+      } else if (strcmp(argv[i], "--queue-size") == 0 && i + 1 < argc){
+        maxQueueSize = std::max(1, std::stoi(argv[++i]));
+        queueMemory = 0; // The last of --queue-size and --queue-memory wins, the command line comes after --config
+      } else if (strcmp(argv[i], "--queue-memory") == 0 && i + 1 < argc){
+        i++;
+        queueMemory = strcmp(argv[i], "auto") == 0 ? availableMemory() / 2 : std::max(1ULL, std::stoull(argv[i])) * 1024 * 1024;
+        if (queueMemory == 0) {
+          std::cout << "The available memory is unknown, use --queue-memory MB.\n";
+          return 1;
+        }
+      } else if (strcmp(argv[i], "--spill") == 0 && i + 1 < argc){
+        spillPath = argv[++i];
+      } else if (strcmp(argv[i], "--spill-size") == 0 && i + 1 < argc){
+        spillSize = std::max(1ULL, std::stoull(argv[++i])) * 1024 * 1024;
+      } else if (strcmp(argv[i], "--queue-policy") == 0 && i + 1 < argc){
+        i++;
+        if (strcmp(argv[i], "block") == 0) {
+          queuePolicy = QUEUE_BLOCK;
+        } else if (strcmp(argv[i], "drop-newest") == 0) {
+          queuePolicy = QUEUE_DROP_NEWEST;
+        } else if (strcmp(argv[i], "drop-oldest") == 0) {
+          queuePolicy = QUEUE_DROP_OLDEST;
+        } else {
+          std::cout << "Invalid queue policy, valid policies: block, drop-newest, drop-oldest.\n";
+          return 1;
+        }
+      } else {
+        std::cout << "Unknown option: " << argv[i] << ", ignoring it.\n";
+      }
+    }
+    properties.type = CV_MAKETYPE(properties.bits > 8 ? CV_16U : CV_8U, channels);
+    directEncoder::directFormat directFormat = directEncoder::formatOf(imageFormat);
+    bool isEightBitFormat = strcmp(imageFormat, ".jpg") == 0 || strcmp(imageFormat, ".jpeg") == 0 || strcmp(imageFormat, ".jpe") == 0
+                            || directFormat == directEncoder::FORMAT_BMP || directFormat == directEncoder::FORMAT_RAS;
+    if (properties.bits > 8 && isEightBitFormat){
+      std::cout << imageFormat << " only stores 8-bit samples, use .png, .ppm, .tiff or .raw with --depth " << properties.bits << ".\n";
+      return 1;
+    }
+    if (output == OUTPUT_STREAM && streamEncoding == STREAM_Y4M && properties.type != CV_8UC3){
+      std::cout << "YUV4MPEG2 streams need 8-bit BGR frames, use --stream-format bgr for other pixel types.\n";
+      return 1;
+    }
+    if (output == OUTPUT_STREAM && streamEncoding == STREAM_Y4M && (properties.width % 2 != 0 || properties.height % 2 != 0)){
+      std::cout << "YUV4MPEG2 4:2:0 streams need an even width and height, use --stream-format bgr for " << properties.width << "x" << properties.height << " frames.\n";
+      return 1;
+    }
+    if (output == OUTPUT_VIDEO && properties.type != CV_8UC3 && properties.type != CV_8UC1){
+      std::cout << "--output video needs 8-bit gray or BGR frames.\n";
+      return 1;
+    }
+    if (encodersNumber > 0 && (strcmp(imageFormat, ".raw") == 0 || output == OUTPUT_MMAP || output == OUTPUT_STREAM || output == OUTPUT_SHM || output == OUTPUT_VIDEO)){
+      std::cout << "Raw frames have nothing to encode, ignoring --encoders.\n";
+      encodersNumber = 0;
+    }
+    if (isAutotune && (output == OUTPUT_STREAM || output == OUTPUT_VIDEO)){
+      std::cout << "The stream is written in order by a single thread, ignoring --autotune.\n";
+      isAutotune = false;
+    }
+    if (isAutotune && output == OUTPUT_SHM){
+      std::cout << "The shared memory ring has no saver threads, ignoring --autotune.\n";
+      isAutotune = false;
+    }
+    if (isAutotune && encodersNumber > 0){
+      std::cout << "The staged pipeline sizes its stages with --encoders and --writers, ignoring --autotune.\n";
+      isAutotune = false;
+    }
+    if (isNuma && (encodersNumber > 0 || isAutotune || (output != OUTPUT_FILES && output != OUTPUT_PACK))){
+      std::cout << "--numa only splits the queue of the files and pack outputs without --encoders and --autotune, ignoring it.\n";
+      isNuma = false;
+    }
+    if (encodersNumber > 0){
+      // The staged pipeline sizes every stage on its own
+      threadsNumber = producersNumber + 1 + encodersNumber + writersNumber;
+      std::cout << "Selected " << producersNumber << " generator threads, " << encodersNumber << " encoder threads and "
+                << writersNumber << " writer threads (" << threadsNumber << " threads in total)" << std::endl;
+    } else if (output == OUTPUT_SHM){
+      // The generators publish straight into the ring, nothing is left to save
+      threadsNumber = producersNumber + 1;
+      std::cout << "Selected " << producersNumber << " generator threads writing to the shared memory ring" << std::endl;
+    } else {
+      if ((output == OUTPUT_STREAM || output == OUTPUT_VIDEO) && threadsNumber != producersNumber + 2){
+        std::cout << "The stream is written in order by a single thread, using " << producersNumber + 2 << " threads.\n";
+        threadsNumber = producersNumber + 2;
+      }
+      if (threadsNumber < producersNumber + 2){
+        std::cout << "Threads number must be at least producers + 2, setting to " << producersNumber + 2 << ".\n";
+        threadsNumber = producersNumber + 2;
+      }
+      std::cout << "Selected " << producersNumber << " generator threads and "
+                << threadsNumber - producersNumber - 1 << " saver threads" << std::endl;
+    }
+    // m minutes, s seconds, h hours
+    inputDuration = std::stoi(argv[2]);
+    switch (*argv[1])
+    {
+    case 's':
+      std::cout << "Set " << inputDuration << " seconds." << std::endl;
+      break;
+    case 'm':
+      std::cout << "Set " << inputDuration << " minutes." << std::endl;
+      inputDuration *= 60;
+      break;
+    case 'h':
+      std::cout << "Set " << inputDuration << " hours." << std::endl;
+      inputDuration *= 3600;
+      break;
+    default:
+      std::cout << "Set 5 seconds.\n";
+      inputDuration = 5;
+      break;
+    }
+  } else {
+    std::cout << "Insufficient arguments provided.\n"
+              << "Usage: ./generator [time_unit] [duration] [threads_number|auto] [image_format|auto] [--config FILE]\n"
+              << "       [--size WxH|720p|1080p|4k|8k] [--channels 1|3|4] [--depth 8|10|12|16]\n"
+              << "       [--pattern noise|gradient|gaussian|value-noise|checker|mixed] [--entropy PERCENT] [--producers N] [--queue-size N] [--queue-policy P] [--seed S] [--output files|pack|mmap|stream|shm|video]\n"
+              << "       [--segment-size MB] [--segment-frames N] [--video-codec auto|ffv1|mjpg]\n"
+              << "       [--async-io] [--io-depth N] [--direct-io] [--mmap-sync P] [--mmap-chunk N]\n"
+              << "       [--stream-target -|PATH|unix:PATH] [--stream-format y4m|bgr|rgb] [--stream-batch N]\n"
+              << "       [--shm-name NAME] [--shm-slots N] [--shm-policy overwrite|block]\n"
+              << "       [--encoders N] [--writers N] [--write-queue N] [--write-batch N]\n"
+              << "       [--metrics FILE] [--metrics-format jsonl|prometheus] [--metrics-interval S]\n"
+              << "       [--fps F] [--fps-policy catch-up|skip] [--fps-max-lag MS]\n"
+              << "       [--autotune] [--autotune-max-savers N] [--autotune-memory MB] [--autotune-format]\n"
+              << "       [--producer-cpus LIST] [--saver-cpus LIST] [--controller-cpus LIST] [--numa]\n"
+              << "       [--queue-memory MB|auto] [--spill PATH] [--spill-size MB]\n"
+              << "       ./generator verify [threads_number] [--seed S]\n"
+              << "       ./generator large [WIDTHxHEIGHT] [file.raw|.ppm|.tiff] [threads_number] [--seed S] [--index N] [--pattern P] [--stripe-rows N]\n"
+              << "Example: ./generator s 5 3 .png\n";
+    close(0); // Exit the program if not enough arguments are provided
+    return 1;
+  }
+
+  if (!isSeedSet){
+    seed = (static_cast<uint64_t>(std::random_device{}()) << 32) ^ std::random_device{}();
+  }
+  std::cout << "Seed: " << seed << std::endl;
+  std::ofstream seedFile("./images/seed.txt");
+  seedFile << seed << std::endl;
+  seedFile << properties.width << " " << properties.height << " " << properties.type << " " << properties.bits << " "
+           << PATTERN_NAMES[properties.pattern] << " " << properties.entropy << std::endl;
+  seedFile.close();
+
+  bool isRaw = strcmp(imageFormat, ".raw") == 0;
+  selectedFormat = savedFormatOf(imageFormat, properties.width, properties.height, properties.type, properties.bits);
+  if (output == OUTPUT_MMAP && !isRaw){
+    std::cout << "--output mmap only supports the .raw format, closing program.\n";
+    return 1;
+  }
+  if (output == OUTPUT_MMAP && queuePolicy != QUEUE_BLOCK){
+    std::cout << "Frames are already in the file with --output mmap, using the block queue policy.\n";
+    queuePolicy = QUEUE_BLOCK;
+  }
+  if ((output == OUTPUT_STREAM || output == OUTPUT_VIDEO) && queuePolicy != QUEUE_BLOCK){
+    std::cout << "A dropped frame would leave a gap in the ordered stream, using the block queue policy.\n";
+    queuePolicy = QUEUE_BLOCK;
+  }
+  if (!isRaw || output != OUTPUT_FILES){
+    isAsyncIO = false;
+  }
+  if (!isAsyncIO && isDirectIO){
+    std::cout << "--direct-io only applies to .raw files with --async-io, ignoring it.\n";
+    isDirectIO = false;
+  }
+
+  // The most savers that can run at once, the tuner starts and retires them between 1 and this limit
+  int saversNumber = threadsNumber - producersNumber - 1;
+  int maxSavers = saversNumber;
+  if (isAutotune){
+    maxSavers = autotuneMaxSavers > 0 ? autotuneMaxSavers : std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    if (saversNumber > maxSavers){
+      std::cout << "Starting with the " << maxSavers << " savers allowed to --autotune.\n";
+      saversNumber = maxSavers;
+      threadsNumber = producersNumber + 1 + saversNumber;
+    }
+  }
+
+  if (isNuma){
+    // The nodes of the generators, taken in turn from every allowed node when they are not pinned
+    if (producerCpus.empty()){
+      for (int cpu : cpuAffinity::allowedCpus()){
+        int node = cpuAffinity::nodeOf(cpu);
+        if (std::find(numaNodes.begin(), numaNodes.end(), node) == numaNodes.end()){
+          numaNodes.push_back(node);
+        }
+      }
+      std::sort(numaNodes.begin(), numaNodes.end());
+      numaNodes.resize(std::min<size_t>(numaNodes.size(), producersNumber));
+    } else {
+      for (int i = 0; i < producersNumber; i++){
+        int node = cpuAffinity::nodeOf(threadCpus(producerCpus, i)[0]);
+        if (std::find(numaNodes.begin(), numaNodes.end(), node) == numaNodes.end()){
+          numaNodes.push_back(node);
+        }
+      }
+    }
+    // Frames never leave their node, so every node with generators needs savers
+    std::vector<int> saversOnNode(numaNodes.size(), 0);
+    for (int i = 0; i < saversNumber; i++){
+      std::vector<int> cpus = threadCpus(saverCpus, i);
+      auto node = std::find(numaNodes.begin(), numaNodes.end(), cpus.empty() ? -1 : cpuAffinity::nodeOf(cpus[0]));
+      if (node != numaNodes.end()){
+        saversOnNode[node - numaNodes.begin()]++;
+      }
+    }
+    std::cout << "NUMA nodes:";
+    for (size_t part = 0; part < numaNodes.size(); part++){
+      std::cout << " " << numaNodes[part] << " (" << saversOnNode[part] << " savers)";
+    }
+    std::cout << std::endl;
+    if (std::find(saversOnNode.begin(), saversOnNode.end(), 0) != saversOnNode.end()){
+      std::cout << "--numa needs a saver thread on every node that has generator threads, add savers or change --saver-cpus.\n";
+      return 1;
+    }
+  }
+
+  if (spillPath && ((output != OUTPUT_FILES && output != OUTPUT_PACK) || isNuma)){
+    std::cout << "--spill only applies to the files and pack outputs without --numa, ignoring it.\n";
+    spillPath = nullptr;
+  }
+
+  // The queue depth comes from its memory budget, and never takes more than half of the available memory
+  size_t paddedFrameBytes = (static_cast<size_t>(properties.width) * properties.height * CV_ELEM_SIZE(properties.type)
+                             + FramePool::ALIGNMENT - 1) / FramePool::ALIGNMENT * FramePool::ALIGNMENT;
+  if (queueMemory > 0){
+    maxQueueSize = static_cast<int>(std::max<size_t>(1, std::min<size_t>(queueMemory / paddedFrameBytes, INT_MAX)));
+  } else if (availableMemory() / 2 / paddedFrameBytes < static_cast<size_t>(maxQueueSize)){
+    maxQueueSize = static_cast<int>(std::max<size_t>(1, availableMemory() / 2 / paddedFrameBytes));
+    std::cout << "Lowering the queue to " << maxQueueSize << " frames, half of the available memory (see --queue-memory).\n";
+  }
+  std::cout << "Queue: up to " << maxQueueSize << " frames (" << maxQueueSize * paddedFrameBytes / (1024.0 * 1024.0) << " MB)" << std::endl;
+
+  pthread_t threads[threadsNumber];
+  // Every buffer is either being generated, queued, being saved or in flight, so the pool never runs dry
+  size_t nodeCount = isNuma ? numaNodes.size() : 1;
+  size_t threadBuffers = producersNumber + 1 + maxSavers + (isAsyncIO ? maxSavers * ioDepth : 0);
+  size_t poolSize = maxQueueSize + nodeCount * threadBuffers + (spillPath ? 1 : 0); // + the buffer the spill drainer fills
+  framePool = new FramePool(poolSize, properties.width, properties.height, properties.type, isNuma ? numaNodes : std::vector<int>());
+  for (size_t part = 0; part < nodeCount; part++){
+    nodeLists.push_back(new FrameQueue<queuedFrame>(std::max<size_t>(1, maxQueueSize / nodeCount)));
+  }
+  imagesList = nodeLists[0];
+  lastNodeStats.resize(nodeCount);
+  packWriter = nullptr;
+  mappedOutput = nullptr;
+  writeList = nullptr;
+  freeEncodedBuffers = nullptr;
+  metricsExporter = nullptr;
+  if (metricsPath){
+    metricsExporter = new MetricsExporter(metricsPath, metricsOutput);
+    if (!metricsExporter -> isOpen()){
+      std::cout << "Could not create the metrics file " << metricsPath << ", closing program.\n";
+      return 1;
+    }
+  }
+  if (encodersNumber > 0){
+    // Every encode buffer is either being encoded, waiting to be written or in a writer's batch
+    size_t buffers = writeQueueSize + encodersNumber + writersNumber * writeBatchSize;
+    encodedBuffers.resize(buffers);
+    freeEncodedBuffers = new FrameQueue<int>(buffers);
+    for (size_t i = 0; i < buffers; i++){
+      freeEncodedBuffers -> push(static_cast<int>(i));
+    }
+    writeList = new FrameQueue<encodedFrame>(writeQueueSize);
+  }
+  if (output == OUTPUT_MMAP){
+    mappedOutput = new MappedOutput("./images/frames.raw", framePool -> frameBytes(), mappedChunkFrames);
+    if (!mappedOutput -> isOpen()){
+      std::cout << "Could not create ./images/frames.raw, closing program.\n";
+      return 1;
+    }
+  }
+  spillFile = nullptr;
+  if (spillPath){
+    std::string path = std::filesystem::is_directory(spillPath) ? std::string(spillPath) + "/rig_spill.tmp" : spillPath;
+    spillFile = new SpillFile(path, framePool -> frameBytes(), spillSize);
+    if (!spillFile -> isOpen()){
+      std::cout << "Could not create the spill file " << path << " of " << spillSize / (1024 * 1024) << " MB: " << strerror(errno)
+                << ", closing program.\n";
+      return 1;
+    }
+    std::cout << "Spill file " << path << ": " << spillFile -> capacity() << " frames ("
+              << spillSize / (1024 * 1024) << " MB) of overflow behind the queue" << std::endl;
+  }
+  shmWriter = nullptr;
+  if (output == OUTPUT_SHM){
+    shmWriter = new ShmRingWriter(shmName, properties.width, properties.height, properties.type, properties.bits, framePool -> frameBytes(), shmSlots, shmPolicy, seed,
+                                  properties.pattern, properties.entropy);
+    if (!shmWriter -> isOpen()){
+      std::cout << "Could not create the shared memory ring " << shmName << ": " << strerror(errno) << ", closing program.\n";
+      return 1;
+    }
+    std::cout << "Shared memory ring " << shmName << ": " << shmWriter -> slotCount() << " slots of " << framePool -> frameBytes()
+              << " bytes, " << (shmPolicy == SHM_BLOCK ? "block" : "overwrite") << " policy" << std::endl;
+  }
+  streamOutput = nullptr;
+  if (output == OUTPUT_STREAM){
+    signal(SIGPIPE, SIG_IGN); // A reader that goes away makes the write fail with EPIPE instead of killing the run
+    if (streamStdout < 0){
+      std::cout << "Opening the stream " << streamTarget << " (a FIFO waits for its reader)..." << std::endl;
+    }
+    int fd = streamStdout >= 0 ? streamStdout : StreamOutput::openTarget(streamTarget);
+    if (fd < 0){
+      std::cout << "Could not open the stream " << streamTarget << ": " << strerror(errno) << ", closing program.\n";
+      return 1;
+    }
+    streamOutput = new StreamOutput(fd, streamEncoding, properties.width, properties.height, targetFps > 0 ? targetFps : 30);
+    const char* encodings[] = {"YUV4MPEG2 4:2:0", "raw bgr24", "raw rgb24"};
+    std::cout << "Streaming " << encodings[streamEncoding] << " frames to " << (streamStdout >= 0 ? "stdout" : streamTarget)
+              << ", up to " << streamBatchSize << " frames per write" << std::endl;
+  }
+  videoOutput = nullptr;
+  if (output == OUTPUT_VIDEO){
+    videoOutput = new VideoOutput("./images", videoEncoding, properties.width, properties.height, properties.type == CV_8UC3,
+                                  targetFps > 0 ? targetFps : 30, segmentFrames, segmentSize);
+    if (!videoOutput -> isOpen()){
+      std::cout << "Could not open a video writer in ./images (is OpenCV built with a video backend?), closing program.\n";
+      return 1;
+    }
+    std::cout << "Encoding " << videoOutput -> codecName() << " video segments of up to " << segmentSize / (1024 * 1024) << " MB";
+    if (segmentFrames > 0){
+      std::cout << " or " << segmentFrames << " frames";
+    }
+    std::cout << std::endl;
+  }
+  if (output == OUTPUT_PACK){
+    packWriter = new PackWriter("./images", segmentSize, properties.width, properties.height, properties.type);
+    if (!packWriter -> isOpen()){
+      std::cout << "Could not create the pack files in ./images, closing program.\n";
+      return 1;
+    }
+  }
+
+  //Start the program
+  if (isAsyncIO){
+    AsyncRawWriter probe(1);
+    std::cout << "Asynchronous raw writer: " << probe.backend() << ", " << ioDepth << " writes in flight per saver"
+              << (isDirectIO ? ", O_DIRECT" : "") << std::endl;
+  }
+  if (selectedFormat.layout.format != directEncoder::FORMAT_NONE){
+    std::cout << "Built-in " << imageFormat << " encoder: " << selectedFormat.layout.header.size() << " byte header, "
+              << selectedFormat.layout.fileBytes() << " bytes per file" << std::endl;
+  }
+  fillFrame = fillerOf(properties.type, properties.bits, properties.pattern);
+  std::cout << "Generating a " << properties.width << "x" << properties.height << " " << PATTERN_NAMES[properties.pattern] << " image ("
+            << channels << " channels, " << properties.bits << "-bit, " << framePool -> frameBytes() / (1024.0 * 1024.0) << " MB) with the "
+            << randomFill::kernelName(randomFill::activeKernel()) << " fill kernel..." << std::endl;
+
+  autotuner = nullptr;
+  if (isAutotune){
+    // Queued frames beyond the memory limit are never allowed, whatever the tuner decides
+    size_t maxDepth = maxQueueSize;
+    if (autotuneMemory > 0){
+      maxDepth = std::max<size_t>(1, std::min<size_t>(maxDepth, autotuneMemory / framePool -> paddedBytes()));
+    }
+    cheaperFormat = savedFormatOf(".bmp", properties.width, properties.height, properties.type, properties.bits);
+    bool canStepDown = isAutotuneFormat && !isRaw && selectedFormat.layout.format != directEncoder::FORMAT_BMP
+                       && selectedFormat.layout.format != directEncoder::FORMAT_RAS && cheaperFormat.layout.format != directEncoder::FORMAT_NONE;
+    if (isAutotuneFormat && !canStepDown){
+      std::cout << imageFormat << " has no cheaper format for these frames, ignoring --autotune-format.\n";
+    }
+    tunerLimits limits = {1, maxSavers, std::min<size_t>(maxDepth, 16), maxDepth, canStepDown};
+    autotuner = new Autotuner(limits, saversNumber, maxDepth / 4);
+    withheldSlots = imagesList -> withhold(imagesList -> capacity() - autotuner -> queueDepth());
+    std::cout << "Autotuning " << saversNumber << " savers (at most " << maxSavers << ") and a queue depth of "
+              << autotuner -> queueDepth() << " frames (at most " << maxDepth << ")" << (canStepDown ? ", .bmp as cheaper format" : "") << std::endl;
+  }
+
+  framePacer = nullptr;
+  if (targetFps > 0){
+    std::cout << "Pacing the generators at " << targetFps << " fps ("
+              << (fpsPolicy == PACING_SKIP ? "skip" : "catch-up") << " policy)" << std::endl;
+    framePacer = new FramePacer(targetFps, fpsPolicy, std::chrono::milliseconds(fpsMaxLag));
+  }
+  startTime = std::chrono::steady_clock::now();
+  std::vector<generatorArgs> generators(producersNumber);
+  for (int i = 0; i < producersNumber; i++){
+    generators[i] = {properties, i};
+    cpuAffinity::createThread(&threads[i], threadCpus(producerCpus, i), generateLoop, &generators[i]);
+  }
+  if (output == OUTPUT_PACK){
+    saverLoop = saveImagePack;
+  } else if (output == OUTPUT_MMAP){
+    saverLoop = saveImageMapped;
+  } else if (output == OUTPUT_STREAM){
+    saverLoop = saveImageStream;
+  } else if (output == OUTPUT_VIDEO){
+    saverLoop = saveImageVideo;
+  } else {
+    saverLoop = isRaw && isAsyncIO ? saveImageRawAsync : saveImage;
+  }
+  cpuAffinity::createThread(&threads[producersNumber], threadCpus(controllerCpus, 0), controller, nullptr);
+  for (int i = producersNumber + 1; i < threadsNumber; i++){
+    std::vector<int> cpus = threadCpus(saverCpus, i - producersNumber - 1);
+    if (encodersNumber > 0){
+      cpuAffinity::createThread(&threads[i], cpus, i <= producersNumber + encodersNumber ? encodeImage : writeEncoded, nullptr);
+    } else {
+      cpuAffinity::createThread(&threads[i], cpus, saverLoop, nullptr);
+    }
+  }
+  pthread_t spillDrainer;
+  if (spillFile){
+    cpuAffinity::createThread(&spillDrainer, threadCpus(controllerCpus, 0), drainSpill, nullptr);
+  }
+  for (int i = 0; i < threadsNumber; i++){
+    pthread_join(threads[i],nullptr);
+  }
+  if (spillFile){
+    pthread_join(spillDrainer,nullptr);
+    // Frames still in the file at the end of the run, or that could not be read back, never reach a saver
+    metrics.local().add(COUNTER_LOST, spillFile -> size() + spillFile -> unreadable());
+  }
+  for (pthread_t saver : tunedSavers){ // The controller has finished, nothing adds to the list any more
+    pthread_join(saver,nullptr);
+  }
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  metricsSnapshot total = metrics.snapshot();
+  double frameMB = framePool -> frameBytes() / (1024.0 * 1024.0);
+  if (metricsExporter){
+    exportMetrics(); // Last export, after every thread has finished
+    delete metricsExporter;
+  }
+  if (mappedOutput){
+    mappedOutput -> close(nextFrame); // Every claimed frame number was generated in the file
+    delete mappedOutput;
+  }
+
+  // End of the program
   std::cout << "\n--- SUMMARY ---\n"
-        << "→ Total frames generated: " << totalFrames << "\n"
-        << "→ Total time: " << inputDuration << " seconds\n"
-        << "→ Total frames saved: " << counter << "\n"
-        << "→ Total frames in queue: " << imagesList.size() << "\n"
-        << "→ Total frames not queued: " << lostFrames << "\n"
-        << "Timer might not be accurate due to the multithreading nature of the program.\n";
+        << "→ Total frames generated: " << total.counters[COUNTER_GENERATED] << "\n"
+        << "→ Total time: " << elapsed << " seconds (" << inputDuration << " requested)\n"
+        << "→ Total frames saved: " << total.counters[COUNTER_SAVED] << "\n"
+        << "→ Total frames failed to save: " << total.counters[COUNTER_SAVE_FAILED] << "\n"
+        << "→ Total frames in queue: " << queuedFrames() << "\n"
+        << "→ Total frames not queued: " << total.counters[COUNTER_LOST] << "\n"
+        << (spillFile ? "→ Total frames spilled: " + std::to_string(total.counters[COUNTER_SPILLED]) + " (read back: "
+                        + std::to_string(total.counters[COUNTER_UNSPILLED]) + ", left in the file: " + std::to_string(spillFile -> size())
+                        + ", failed: " + std::to_string(spillFile -> failed()) + ")\n" : "")
+        << "→ Average generated: " << total.counters[COUNTER_GENERATED] / elapsed << " fps, "
+        << total.counters[COUNTER_GENERATED] * frameMB / elapsed << " MB/s\n"
+        << "→ Average saved: " << total.counters[COUNTER_SAVED] / elapsed << " fps, "
+        << total.counters[COUNTER_SAVED] * frameMB / elapsed << " MB/s\n"
+        << "→ Seed: " << seed << "\n";
+  for (int i = 0; i < STAGE_COUNT; i++){
+    const histogramSnapshot& stage = total.stages[i];
+    if (stage.count > 0){
+      std::cout << "→ " << STAGE_NAMES[i] << " latency (ms): p50 " << stage.percentile(50) / 1e6 << " | p99 "
+                << stage.percentile(99) / 1e6 << " | max " << stage.max / 1e6 << "\n";
+    }
+  }
+  for (size_t part = 0; isNuma && part < numaNodes.size(); part++){
+    metricsSnapshot node = metrics.snapshot(static_cast<int>(part));
+    std::cout << "→ Node " << numaNodes[part] << ": generated " << node.counters[COUNTER_GENERATED] << " ("
+              << node.counters[COUNTER_GENERATED] / elapsed << " fps, " << node.counters[COUNTER_GENERATED] * frameMB / elapsed << " MB/s)"
+              << " | saved " << node.counters[COUNTER_SAVED] << " (" << node.counters[COUNTER_SAVED] / elapsed << " fps, "
+              << node.counters[COUNTER_SAVED] * frameMB / elapsed << " MB/s)\n";
+  }
+  if (autotuner){
+    std::cout << "→ Autotuned savers: " << autotuner -> saverCount() << " | queue depth: " << autotuner -> queueDepth()
+              << " | format: " << saveFormat.load() -> extension << "\n";
+  }
+  if (packWriter){
+    std::cout << "→ Pack segments written: " << packWriter -> segmentCount() << "\n";
+    if (!packWriter -> close()){
+      std::cout << "→ Failed to write the pack index, the frames saved after the failure are not in it\n";
+    }
+    delete packWriter;
+  }
+  if (videoOutput){
+    videoOutput -> close(); // Finishes the last segment
+    std::cout << "→ Video segments written: " << videoOutput -> segmentCount() << "\n";
+    delete videoOutput;
+  }
+  delete streamOutput;
+  delete shmWriter; // Closes the ring, the readers still get the frames already published
+  delete spillFile;
+  delete framePacer;
+  delete autotuner;
+  delete writeList;
+  delete freeEncodedBuffers;
+  for (FrameQueue<queuedFrame>* list : nodeLists){
+    delete list;
+  }
+  delete framePool;
 }
@@ -0,0 +1,392 @@
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <pthread.h>
+#include <unistd.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <opencv2/core.hpp>
+#include <opencv2/imgcodecs.hpp>
+#include "random_image.hpp"
+#include "frame_queue.hpp"
+#include "direct_encoder.hpp"
+
+/**
+ * @file generator_bench.cpp
+ * @brief Repeatable microbenchmarks of the generator building blocks, to catch performance regressions.
+ *
+ * Groups:
+ * - fill: cv::randu (the old generation path) against every Philox fill kernel, on a 1920x1080 frame
+ * - generate: generateRandomImage at several resolutions
+ * - queue: FrameQueue push/pop with several producer and consumer threads
+ * - encode: cv::imencode per format, and the built-in encoders of the uncompressed formats
+ * - imwrite: cv::imwrite per format, one file per call
+ * - raw: raw frame writes, one file per frame and appended to a single file
+ *
+ * Every benchmark runs untimed warmup iterations, then times each iteration on its own and reports
+ * min, median, mean, standard deviation and max, plus the throughput at the median.
+ *
+ * Usage: ./generator_bench [--iterations N] [--warmup N] [--filter TEXT] [--json FILE] [--dir DIR]
+ * - --iterations N: timed iterations per benchmark (default is 20)
+ * - --warmup N: untimed iterations per benchmark (default is 3)
+ * - --filter TEXT: only run the benchmarks whose "group/name" contains TEXT
+ * - --json FILE: also write the results to FILE as JSON
+ * - --dir DIR: directory for the files written by the imwrite and raw groups (default is ./bench_files),
+ *   removed at the end if the benchmark created it
+ */
+
+struct benchOptions{
+  /**
+ * @brief Command line options shared by every benchmark.
+ */
+  int iterations = 20;
+  int warmup = 3;
+  std::string filter;
+  std::string jsonPath;
+  std::string directory = "./bench_files";
+};
+
+struct benchResult{
+  /**
+ * @brief Timings of one benchmark.
+ *
+ * work is what one iteration processes, in unit (bytes for MB/s, operations for Mops/s, frames for fps).
+ */
+  std::string group;
+  std::string name;
+  std::string unit;
+  double work;
+  std::vector<double> seconds; // One per timed iteration
+
+  double min() const { return *std::min_element(seconds.begin(), seconds.end()); }
+  double max() const { return *std::max_element(seconds.begin(), seconds.end()); }
+
+  double mean() const {
+    double sum = 0;
+    for (double s : seconds) {
+      sum += s;
+    }
+    return sum / seconds.size();
+  }
+
+  double median() const {
+    std::vector<double> sorted = seconds;
+    std::sort(sorted.begin(), sorted.end());
+    size_t n = sorted.size();
+    return n % 2 ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+  }
+
+  double stddev() const {
+    double m = mean();
+    double sum = 0;
+    for (double s : seconds) {
+      sum += (s - m) * (s - m);
+    }
+    return seconds.size() > 1 ? std::sqrt(sum / (seconds.size() - 1)) : 0;
+  }
+
+  double throughput() const {
+    /**
+ * @brief Work per second at the median time, bytes are reported in MB and operations in millions.
+ */
+    double scale = unit == "MB/s" ? 1024.0 * 1024.0 : (unit == "Mops/s" ? 1e6 : 1.0);
+    return work / median() / scale;
+  }
+};
+
+std::vector<benchResult> results;
+
+void runBench(const benchOptions& options, const std::string& group, const std::string& name,
+              const std::string& unit, double work, const std::function<void()>& iteration) {
+  /**
+ * @brief Runs one benchmark if it matches the filter, prints its line and keeps its result.
+ *
+ * @param work Bytes, operations or frames processed by one call of iteration.
+ */
+  std::string id = group + "/" + name;
+  if (!options.filter.empty() && id.find(options.filter) == std::string::npos) {
+    return;
+  }
+  for (int i = 0; i < options.warmup; i++) {
+    iteration();
+  }
+  benchResult result = {group, name, unit, work, {}};
+  for (int i = 0; i < options.iterations; i++) {
+    auto start = std::chrono::steady_clock::now();
+    iteration();
+    result.seconds.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+  }
+  std::cout << std::left << std::setw(32) << id << std::right << std::fixed << std::setprecision(3)
+            << std::setw(10) << result.median() * 1e3 << " ms  "
+            << std::setw(10) << result.min() * 1e3 << " ms  "
+            << std::setw(8) << (result.stddev() / result.mean() * 100) << " %  "
+            << std::setprecision(1) << std::setw(10) << result.throughput() << " " << unit << std::endl;
+  results.push_back(result);
+}
+
+void benchFill(const benchOptions& options) {
+  /**
+ * @brief cv::randu against every fill kernel supported by the CPU, on a 1920x1080 frame.
+ */
+  cv::Mat frame(1080, 1920, CV_8UC3);
+  size_t bytes = frame.total() * frame.elemSize();
+  runBench(options, "fill", "cv::randu", "MB/s", bytes, [&]() {
+    cv::randu(frame, cv::Scalar(0, 0, 0), cv::Scalar(255, 255, 255));
+  });
+
+  std::vector<randomFill::groupKernel> kernels = {randomFill::philoxGroupsScalar};
+#ifdef RANDOM_FILL_X86
+  kernels.push_back(randomFill::philoxGroupsSSE2);
+  if (__builtin_cpu_supports("avx2")) {
+    kernels.push_back(randomFill::philoxGroupsAVX2);
+  }
+#endif
+  for (auto kernel : kernels) {
+    uint64_t stream = 0;
+    runBench(options, "fill", std::string("philox ") + randomFill::kernelName(kernel), "MB/s", bytes, [&]() {
+      randomFill::fillRandomBytes(frame.data, bytes, 0x5EED, stream++, 0, kernel);
+    });
+  }
+}
+
+void benchGenerate(const benchOptions& options) {
+  /**
+ * @brief generateRandomImage (the path used by the generator threads) at several resolutions, then
+ * the pixel types that need a fixup pass (alpha, sample masking) and the patterns at 1080p.
+ */
+  const int sizes[][2] = {{640, 480}, {1280, 720}, {1920, 1080}, {3840, 2160}};
+  for (const auto& size : sizes) {
+    cv::Mat frame(size[1], size[0], CV_8UC3);
+    uint64_t index = 0;
+    runBench(options, "generate", std::to_string(size[0]) + "x" + std::to_string(size[1]), "MB/s",
+             frame.total() * frame.elemSize(), [&]() {
+      generateRandomImage(frame, 0x5EED, index++);
+    });
+  }
+  const int types[][3] = {{CV_8UC1, 8}, {CV_8UC4, 8}, {CV_16UC3, 10}, {CV_16UC3, 12}, {CV_16UC3, 16}, {CV_16UC4, 16}};
+  for (const auto& type : types) {
+    cv::Mat frame(1080, 1920, type[0]);
+    frameFiller fill = fillerOf(type[0], type[1]);
+    uint64_t index = 0;
+    runBench(options, "generate", "1080p " + std::to_string(frame.channels()) + "ch " + std::to_string(type[1]) + "-bit", "MB/s",
+             frame.total() * frame.elemSize(), [&]() {
+      fill(frame, 0x5EED, index++, 0, DEFAULT_ENTROPY);
+    });
+  }
+  for (int pattern = PATTERN_GRADIENT; pattern < PATTERN_COUNT; pattern++) {
+    cv::Mat frame(1080, 1920, CV_8UC3);
+    frameFiller fill = fillerOf(CV_8UC3, 8, static_cast<contentPattern>(pattern));
+    uint64_t index = 0;
+    runBench(options, "generate", std::string("1080p ") + PATTERN_NAMES[pattern], "MB/s", frame.total() * frame.elemSize(), [&]() {
+      fill(frame, 0x5EED, index++, 0, DEFAULT_ENTROPY);
+    });
+  }
+}
+
+struct queueJob{
+  /**
+ * @brief Shared state of the threads of a queue benchmark.
+ */
+  FrameQueue<int>* queue;
+  int items; // Items pushed by each producer
+};
+
+void* queueProducer(void* args) {
+  queueJob* job = static_cast<queueJob*>(args);
+  for (int i = 0; i < job -> items; i++) {
+    job -> queue -> push(i);
+  }
+  return NULL;
+}
+
+void* queueConsumer(void* args) {
+  queueJob* job = static_cast<queueJob*>(args);
+  int item;
+  while (job -> queue -> pop(item)) {
+  }
+  return NULL;
+}
+
+void benchQueue(const benchOptions& options) {
+  /**
+ * @brief Moves items through a FrameQueue of 500 slots (the default --queue-size) with P producers and C consumers.
+ *
+ * Every iteration starts the threads, pushes 100000 items per producer and waits until the
+ * consumers have drained the closed queue, so thread start up is included and amortized.
+ */
+  const int threadCounts[][2] = {{1, 1}, {2, 2}, {4, 4}, {8, 8}, {1, 4}, {4, 1}};
+  const int items = 100000;
+  for (const auto& counts : threadCounts) {
+    int producers = counts[0];
+    int consumers = counts[1];
+    runBench(options, "queue", std::to_string(producers) + "p" + std::to_string(consumers) + "c", "Mops/s",
+             static_cast<double>(producers) * items, [&]() {
+      FrameQueue<int> queue(500);
+      queueJob job = {&queue, items};
+      std::vector<pthread_t> threads(producers + consumers);
+      for (int i = 0; i < producers + consumers; i++) {
+        pthread_create(&threads[i], nullptr, i < producers ? queueProducer : queueConsumer, &job);
+      }
+      for (int i = 0; i < producers; i++) {
+        pthread_join(threads[i], nullptr);
+      }
+      queue.close();
+      for (int i = producers; i < producers + consumers; i++) {
+        pthread_join(threads[i], nullptr);
+      }
+    });
+  }
+}
+
+const char* const BENCH_FORMATS[] = {".png", ".jpg", ".bmp", ".tiff", ".ppm", ".ras", ".hdr"};
+
+void benchEncode(const benchOptions& options) {
+  /**
+ * @brief cv::imencode of a 1920x1080 frame per format, then the built-in encoders of the uncompressed formats.
+ */
+  cv::Mat frame(1080, 1920, CV_8UC3);
+  generateRandomImage(frame, 0x5EED, 0);
+  size_t bytes = frame.total() * frame.elemSize();
+  std::vector<uchar> encoded;
+  for (const char* format : BENCH_FORMATS) {
+    runBench(options, "encode", std::string("imencode ") + format, "MB/s", bytes, [&]() {
+      cv::imencode(format, frame, encoded);
+    });
+  }
+  for (const char* format : {".ppm", ".bmp", ".ras", ".tiff"}) {
+    directEncoder::frameLayout layout = directEncoder::layoutOf(directEncoder::formatOf(format), frame.cols, frame.rows);
+    runBench(options, "encode", std::string("direct ") + format, "MB/s", bytes, [&]() {
+      directEncoder::encode(layout, frame, encoded);
+    });
+  }
+}
+
+void benchImwrite(const benchOptions& options) {
+  /**
+ * @brief cv::imwrite of a 1920x1080 frame per format, the way saveImage does it.
+ */
+  cv::Mat frame(1080, 1920, CV_8UC3);
+  generateRandomImage(frame, 0x5EED, 0);
+  size_t bytes = frame.total() * frame.elemSize();
+  for (const char* format : BENCH_FORMATS) {
+    int file = 0;
+    runBench(options, "imwrite", format, "MB/s", bytes, [&]() {
+      cv::imwrite(options.directory + "/" + std::to_string(file++ % 8) + format, frame);
+    });
+  }
+}
+
+bool writeAll(int fd, const unsigned char* data, size_t length) {
+  while (length > 0) {
+    ssize_t n = write(fd, data, length);
+    if (n <= 0) {
+      return false;
+    }
+    data += n;
+    length -= n;
+  }
+  return true;
+}
+
+void benchRaw(const benchOptions& options) {
+  /**
+ * @brief Raw 1920x1080 frame writes: one new file per frame (like the .raw files of saveImage), appended to a single
+ * file (like the pack output), and the same with an fdatasync to include the device.
+ */
+  cv::Mat frame(1080, 1920, CV_8UC3);
+  generateRandomImage(frame, 0x5EED, 0);
+  size_t bytes = frame.total() * frame.elemSize();
+
+  int file = 0;
+  runBench(options, "raw", "file per frame", "MB/s", bytes, [&]() {
+    std::string path = options.directory + "/" + std::to_string(file++ % 8) + ".raw";
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || !writeAll(fd, frame.data, bytes)) {
+      std::cerr << "Failed to write " << path << std::endl;
+    }
+    close(fd);
+  });
+
+  std::string appendPath = options.directory + "/append.raw";
+  for (bool isSynced : {false, true}) {
+    int fd = open(appendPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    int frames = 0;
+    runBench(options, "raw", isSynced ? "append + fdatasync" : "append", "MB/s", bytes, [&]() {
+      // Start over every 64 frames so the file stays small
+      if (++frames % 64 == 0 && ftruncate(fd, 0) == 0) {
+        lseek(fd, 0, SEEK_SET);
+      }
+      if (!writeAll(fd, frame.data, bytes) || (isSynced && fdatasync(fd) != 0)) {
+        std::cerr << "Failed to write " << appendPath << std::endl;
+      }
+    });
+    close(fd);
+  }
+}
+
+void writeJson(const std::string& path, const benchOptions& options) {
+  /**
+ * @brief Writes every result with its statistics (times in seconds), one result per line.
+ */
+  std::ofstream file(path);
+  file << std::setprecision(9) << "{\n"
+       << "  \"fill_kernel\": \"" << randomFill::kernelName(randomFill::activeKernel()) << "\",\n"
+       << "  \"iterations\": " << options.iterations << ",\n"
+       << "  \"warmup\": " << options.warmup << ",\n"
+       << "  \"results\": [\n";
+  for (size_t i = 0; i < results.size(); i++) {
+    const benchResult& r = results[i];
+    file << "    {\"group\": \"" << r.group << "\", \"name\": \"" << r.name << "\", \"unit\": \"" << r.unit << "\""
+         << ", \"work\": " << r.work << ", \"min\": " << r.min() << ", \"median\": " << r.median()
+         << ", \"mean\": " << r.mean() << ", \"stddev\": " << r.stddev() << ", \"max\": " << r.max()
+         << ", \"throughput\": " << r.throughput() << "}" << (i + 1 < results.size() ? "," : "") << "\n";
+  }
+  file << "  ]\n}\n";
+}
+
+int main(int argc, char **argv) {
+  benchOptions options;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      options.iterations = std::max(1, std::stoi(argv[++i]));
+    } else if (strcmp(argv[i], "--warmup") == 0 && i + 1 < argc) {
+      options.warmup = std::max(0, std::stoi(argv[++i]));
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      options.filter = argv[++i];
+    } else if (strcmp(argv[i], "--json") == 0 && i + 1 < argc) {
+      options.jsonPath = argv[++i];
+    } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+      options.directory = argv[++i];
+    } else {
+      std::cout << "Usage: ./generator_bench [--iterations N] [--warmup N] [--filter TEXT] [--json FILE] [--dir DIR]\n";
+      return 1;
+    }
+  }
+  bool isDirectoryCreated = std::filesystem::create_directories(options.directory);
+
+  std::cout << "Fill kernel: " << randomFill::kernelName(randomFill::activeKernel()) << " | "
+            << options.warmup << " warmup + " << options.iterations << " timed iterations per benchmark\n"
+            << "Benchmark                           median         min    stddev  throughput\n";
+  benchFill(options);
+  benchGenerate(options);
+  benchQueue(options);
+  benchEncode(options);
+  benchImwrite(options);
+  benchRaw(options);
+
+  if (isDirectoryCreated) {
+    std::filesystem::remove_all(options.directory);
+  }
+  if (!options.jsonPath.empty()) {
+    writeJson(options.jsonPath, options);
+    std::cout << "Results written to " << options.jsonPath << std::endl;
+  }
+  return 0;
+}
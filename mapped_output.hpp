@@ -0,0 +1,159 @@
+#ifndef mapped_output_h
+#define mapped_output_h
+
+#include <cstdint>
+#include <fcntl.h>
+#include <map>
+#include <pthread.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ * @file mapped_output.hpp
+ * @brief Raw output file generated in place through a shared memory mapping.
+ *
+ * Frame N lives at byte N * frameBytes of a single file. The file is preallocated and mapped
+ * one chunk of frames at a time, generators fill the mapped pages directly and saving a frame
+ * only applies the selected msync policy, so no pixel is ever copied into the kernel.
+ * A chunk is unmapped as soon as all of its frames have been completed. Chunks rarely start on a
+ * page boundary, each one maps the whole pages covering its frames and shares the edge pages with its neighbours.
+ */
+
+enum mappedSyncPolicy {
+  /**
+ * @brief What completing a frame does with its dirty pages.
+ */
+  MAPPED_SYNC_NONE,  // Leave them to the kernel writeback
+  MAPPED_SYNC_ASYNC, // Start writing them back (msync MS_ASYNC)
+  MAPPED_SYNC_SYNC   // Write them back and wait (msync MS_SYNC)
+};
+
+class MappedOutput {
+  /**
+ * @brief Maps, preallocates and releases the chunks of the output file on demand.
+ */
+public:
+  MappedOutput(const std::string& path, size_t frameBytes, size_t chunkFrames)
+      : frameBytes(frameBytes), chunkFrames(chunkFrames ? chunkFrames : 1) {
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  }
+
+  ~MappedOutput() { close(0); }
+
+  MappedOutput(const MappedOutput&) = delete;
+  MappedOutput& operator=(const MappedOutput&) = delete;
+
+  bool isOpen() const { return fd >= 0; }
+
+  unsigned char* frameAddress(uint64_t index) {
+    /**
+ * @brief Address of frame index in the mapping, mapping (and preallocating) its chunk if needed.
+ *
+ * @return unsigned char* nullptr if the chunk could not be allocated or mapped.
+ */
+    uint64_t chunk = index / chunkFrames;
+    pthread_mutex_lock(&mutex);
+    auto it = chunks.find(chunk);
+    if (it == chunks.end()) {
+      it = chunks.emplace(chunk, mapChunk(chunk)).first;
+    }
+    unsigned char* frames = it -> second.frames;
+    pthread_mutex_unlock(&mutex);
+    return frames ? frames + (index % chunkFrames) * frameBytes : nullptr;
+  }
+
+  void complete(uint64_t index, mappedSyncPolicy policy) {
+    /**
+ * @brief Applies the sync policy to a generated frame and unmaps its chunk when it is full.
+ */
+    unsigned char* frame = frameAddress(index);
+    if (frame != nullptr && policy != MAPPED_SYNC_NONE) {
+      // msync needs a page aligned start
+      long page = sysconf(_SC_PAGESIZE);
+      uintptr_t start = reinterpret_cast<uintptr_t>(frame) / page * page;
+      size_t length = reinterpret_cast<uintptr_t>(frame) + frameBytes - start;
+      msync(reinterpret_cast<void*>(start), length, policy == MAPPED_SYNC_SYNC ? MS_SYNC : MS_ASYNC);
+    }
+
+    uint64_t chunk = index / chunkFrames;
+    pthread_mutex_lock(&mutex);
+    auto it = chunks.find(chunk);
+    if (it != chunks.end() && ++(it -> second.completed) == chunkFrames) {
+      unmapChunk(it -> second);
+      chunks.erase(it);
+    }
+    pthread_mutex_unlock(&mutex);
+  }
+
+  void close(uint64_t frames) {
+    /**
+ * @brief Unmaps every chunk and trims the file to the first frames frames.
+ *
+ * @param frames Number of frames generated, 0 keeps the file as it is.
+ */
+    pthread_mutex_lock(&mutex);
+    for (auto& entry : chunks) {
+      unmapChunk(entry.second);
+    }
+    chunks.clear();
+    if (fd >= 0) {
+      if (frames > 0 && ftruncate(fd, frames * frameBytes) != 0) {
+        frames = 0;
+      }
+      ::close(fd);
+      fd = -1;
+    }
+    pthread_mutex_unlock(&mutex);
+  }
+
+  size_t mappedChunks() {
+    pthread_mutex_lock(&mutex);
+    size_t n = chunks.size();
+    pthread_mutex_unlock(&mutex);
+    return n;
+  }
+
+  size_t framesPerChunk() const { return chunkFrames; }
+
+private:
+  struct mappedChunk {
+    unsigned char* base;   // Start of the mapping, on the page boundary at or before the first frame
+    size_t bytes;          // Length of the mapping, whole pages
+    unsigned char* frames; // First frame of the chunk, inside the first page
+    size_t completed;
+  };
+
+  mappedChunk mapChunk(uint64_t chunk) {
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    uint64_t start = chunk * chunkFrames * frameBytes;
+    uint64_t end = start + chunkFrames * frameBytes;
+    uint64_t mapStart = start / page * page;
+    size_t bytes = (end - mapStart + page - 1) / page * page;
+    if (fd < 0 || posix_fallocate(fd, static_cast<off_t>(start), static_cast<off_t>(end - start)) != 0) {
+      return {nullptr, 0, nullptr, 0};
+    }
+    void* base = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, static_cast<off_t>(mapStart));
+    if (base == MAP_FAILED) {
+      return {nullptr, 0, nullptr, 0};
+    }
+    madvise(base, bytes, MADV_SEQUENTIAL);
+    return {static_cast<unsigned char*>(base), bytes, static_cast<unsigned char*>(base) + (start - mapStart), 0};
+  }
+
+  void unmapChunk(mappedChunk& chunk) {
+    if (chunk.base != nullptr) {
+      munmap(chunk.base, chunk.bytes);
+      chunk.base = nullptr;
+      chunk.frames = nullptr;
+    }
+  }
+
+  size_t frameBytes;
+  size_t chunkFrames;
+  int fd;
+  std::map<uint64_t, mappedChunk> chunks; // Chunks currently mapped
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+};
+
+#endif // mapped_output_h
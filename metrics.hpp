@@ -0,0 +1,332 @@
+#ifndef metrics_h
+#define metrics_h
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <pthread.h>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @file metrics.hpp
+ * @brief Lock-free per-thread counters and latency histograms, merged on demand and exported
+ * as JSON lines or in the Prometheus text format.
+ *
+ * Every thread owns a ThreadMetrics block and is its only writer, so recording a value is a
+ * relaxed load and store with no lock and no shared cache line. Readers (the controller)
+ * sum the blocks of all threads into a metricsSnapshot.
+ */
+
+enum metricsCounter {
+  /**
+ * @brief Monotonic counters kept by every thread.
+ */
+  COUNTER_GENERATED,     // Frames generated
+  COUNTER_LOST,          // Frames dropped by the queue policy
+  COUNTER_SAVED,         // Frames saved
+  COUNTER_SAVE_FAILED,   // Frames whose encode or write failed
+  COUNTER_ENCODED,       // Frames encoded by the encoder stage
+  COUNTER_ENCODED_BYTES, // Bytes produced by the encoder stage
+  COUNTER_WRITTEN,       // Frames written by the writer stage
+  COUNTER_WRITTEN_BYTES, // Bytes written by the writer stage
+  COUNTER_SKIPPED,       // Ticks of the --fps schedule dropped by the pacing policy
+  COUNTER_SPILLED,       // Frames written to the spill file because the queue was full
+  COUNTER_UNSPILLED,     // Frames read back from the spill file into the queue
+  COUNTER_COUNT
+};
+
+enum metricsStage {
+  /**
+ * @brief Stages with a latency histogram.
+ */
+  STAGE_GENERATE,   // Filling a frame
+  STAGE_QUEUE_WAIT, // Time a frame spent in imagesList
+  STAGE_ENCODE,     // Encoding a frame
+  STAGE_WRITE,      // Writing a frame (with cv::imwrite it includes the encoding)
+  STAGE_PACE_JITTER, // How late a frame started against its --fps deadline
+  STAGE_COUNT
+};
+
+const char* const COUNTER_NAMES[COUNTER_COUNT] = {"generated", "lost", "saved", "save_failed", "encoded", "encoded_bytes", "written", "written_bytes", "skipped", "spilled", "unspilled"};
+const char* const STAGE_NAMES[STAGE_COUNT] = {"generate", "queue_wait", "encode", "write", "pace_jitter"};
+
+inline uint64_t metricsNow() {
+  /**
+ * @brief Monotonic time in nanoseconds, used for every latency.
+ */
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct histogramSnapshot {
+  /**
+ * @brief Merged copy of one or more LatencyHistogram.
+ */
+  std::vector<uint64_t> buckets;
+  uint64_t count = 0;
+  uint64_t sum = 0; // Nanoseconds
+  uint64_t max = 0;
+
+  double mean() const { return count ? static_cast<double>(sum) / count : 0; }
+
+  uint64_t percentile(double p) const;
+};
+
+class LatencyHistogram {
+  /**
+ * @brief HDR-style log-linear histogram of nanosecond latencies, single writer.
+ *
+ * Every power of two is split in SUB_BUCKETS linear buckets, so values are kept with a relative
+ * error below 1 / SUB_BUCKETS (3%) from 1 ns up to 2^MAX_BITS ns (about 18 minutes, larger values are clamped).
+ */
+public:
+  static const int SUB_BITS = 5;
+  static const uint64_t SUB_BUCKETS = 1 << SUB_BITS;
+  static const int MAX_BITS = 40;
+  static const size_t BUCKETS = (MAX_BITS - SUB_BITS + 1) * SUB_BUCKETS;
+
+  static size_t bucketOf(uint64_t value) {
+    if (value >= (1ULL << MAX_BITS)) {
+      value = (1ULL << MAX_BITS) - 1;
+    }
+    if (value < 2 * SUB_BUCKETS) {
+      return value;
+    }
+    int shift = 63 - __builtin_clzll(value) - SUB_BITS;
+    return shift * SUB_BUCKETS + (value >> shift);
+  }
+
+  static uint64_t valueOf(size_t bucket) {
+    /**
+ * @brief Middle of the values counted in a bucket.
+ */
+    if (bucket < 2 * SUB_BUCKETS) {
+      return bucket;
+    }
+    int shift = static_cast<int>(bucket / SUB_BUCKETS) - 1;
+    uint64_t low = (bucket % SUB_BUCKETS + SUB_BUCKETS) << shift;
+    return low + (1ULL << shift) / 2;
+  }
+
+  void record(uint64_t nanoseconds) {
+    bump(buckets[bucketOf(nanoseconds)], 1);
+    bump(count, 1);
+    bump(sum, nanoseconds);
+    if (nanoseconds > max.load(std::memory_order_relaxed)) {
+      max.store(nanoseconds, std::memory_order_relaxed);
+    }
+  }
+
+  void addTo(histogramSnapshot& snapshot) const {
+    snapshot.buckets.resize(BUCKETS);
+    for (size_t i = 0; i < BUCKETS; i++) {
+      snapshot.buckets[i] += buckets[i].load(std::memory_order_relaxed);
+    }
+    snapshot.count += count.load(std::memory_order_relaxed);
+    snapshot.sum += sum.load(std::memory_order_relaxed);
+    uint64_t m = max.load(std::memory_order_relaxed);
+    snapshot.max = m > snapshot.max ? m : snapshot.max;
+  }
+
+  static void bump(std::atomic<uint64_t>& value, uint64_t n) {
+    // Only the owner thread writes, a plain load and store is enough
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> buckets[BUCKETS] = {};
+  std::atomic<uint64_t> count{0};
+  std::atomic<uint64_t> sum{0};
+  std::atomic<uint64_t> max{0};
+};
+
+inline uint64_t histogramSnapshot::percentile(double p) const {
+  /**
+ * @brief Latency below which p percent of the recorded values are, 0 if nothing was recorded.
+ */
+  if (count == 0) {
+    return 0;
+  }
+  uint64_t rank = static_cast<uint64_t>(p / 100.0 * count + 0.5);
+  rank = rank < 1 ? 1 : rank;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < buckets.size(); i++) {
+    seen += buckets[i];
+    if (seen >= rank) {
+      uint64_t value = LatencyHistogram::valueOf(i);
+      return value < max ? value : max;
+    }
+  }
+  return max;
+}
+
+struct alignas(64) ThreadMetrics {
+  /**
+ * @brief Counters and histograms of one thread, only written by that thread.
+ */
+  std::atomic<uint64_t> counters[COUNTER_COUNT] = {};
+  LatencyHistogram stages[STAGE_COUNT];
+  std::atomic<int> group{-1}; // Group the thread reports to (its NUMA node index), -1 if none
+
+  void add(metricsCounter counter, uint64_t n = 1) { LatencyHistogram::bump(counters[counter], n); }
+  void record(metricsStage stage, uint64_t nanoseconds) { stages[stage].record(nanoseconds); }
+};
+
+struct metricsSnapshot {
+  /**
+ * @brief Sum of the metrics of every thread at one point in time.
+ */
+  uint64_t counters[COUNTER_COUNT] = {};
+  histogramSnapshot stages[STAGE_COUNT];
+};
+
+class MetricsRegistry {
+  /**
+ * @brief Owns the ThreadMetrics of every thread of the program.
+ *
+ * There is one registry per program: the block of the calling thread is found through a
+ * thread_local pointer and registered the first time the thread records something.
+ */
+public:
+  MetricsRegistry() = default;
+  ~MetricsRegistry() {
+    for (ThreadMetrics* block : blocks) {
+      delete block;
+    }
+  }
+
+  MetricsRegistry(const MetricsRegistry&) = delete;
+  MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+  ThreadMetrics& local() {
+    static thread_local ThreadMetrics* mine = nullptr;
+    if (mine == nullptr) {
+      mine = new ThreadMetrics();
+      pthread_mutex_lock(&mutex);
+      blocks.push_back(mine);
+      pthread_mutex_unlock(&mutex);
+    }
+    return *mine;
+  }
+
+  metricsSnapshot snapshot(int group = -1) {
+    /**
+ * @brief Sums the metrics of every thread, or only of the threads of a group if group >= 0.
+ */
+    metricsSnapshot total;
+    pthread_mutex_lock(&mutex);
+    for (const ThreadMetrics* block : blocks) {
+      if (group >= 0 && block -> group.load(std::memory_order_relaxed) != group) {
+        continue;
+      }
+      for (int i = 0; i < COUNTER_COUNT; i++) {
+        total.counters[i] += block -> counters[i].load(std::memory_order_relaxed);
+      }
+      for (int i = 0; i < STAGE_COUNT; i++) {
+        block -> stages[i].addTo(total.stages[i]);
+      }
+    }
+    pthread_mutex_unlock(&mutex);
+    return total;
+  }
+
+private:
+  std::vector<ThreadMetrics*> blocks;
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+};
+
+enum metricsFormat {
+  /**
+ * @brief File format of the exported metrics.
+ */
+  METRICS_JSON_LINES, // One JSON object appended per export
+  METRICS_PROMETHEUS  // Text exposition format, the file is replaced at every export
+};
+
+typedef std::vector<std::pair<std::string, double>> metricsGauges;
+
+class MetricsExporter {
+  /**
+ * @brief Writes snapshots to a file, as JSON lines or for the Prometheus node exporter textfile collector.
+ *
+ * Counters are cumulative since the start of the run, latencies are in nanoseconds (JSON)
+ * or seconds (Prometheus) and summarize every value recorded so far.
+ */
+public:
+  MetricsExporter(const std::string& path, metricsFormat format) : path(path), format(format) {
+    if (format == METRICS_JSON_LINES) {
+      lines.open(path, std::ios::trunc);
+    }
+  }
+
+  bool isOpen() const { return format == METRICS_PROMETHEUS || lines.is_open(); }
+
+  void write(const metricsSnapshot& snapshot, double seconds, const metricsGauges& gauges) {
+    if (format == METRICS_JSON_LINES) {
+      lines << jsonLine(snapshot, seconds, gauges) << std::endl;
+      return;
+    }
+    // Written next to the target and renamed, so a scraper never reads half a file
+    std::string temporary = path + ".tmp";
+    std::ofstream file(temporary, std::ios::trunc);
+    file << prometheusText(snapshot, seconds, gauges);
+    file.close();
+    std::rename(temporary.c_str(), path.c_str());
+  }
+
+  static std::string jsonLine(const metricsSnapshot& snapshot, double seconds, const metricsGauges& gauges) {
+    std::ostringstream out;
+    out << "{\"time\":" << seconds << ",\"counters\":{";
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+      out << (i ? "," : "") << "\"" << COUNTER_NAMES[i] << "\":" << snapshot.counters[i];
+    }
+    out << "},\"gauges\":{";
+    for (size_t i = 0; i < gauges.size(); i++) {
+      out << (i ? "," : "") << "\"" << gauges[i].first << "\":" << gauges[i].second;
+    }
+    out << "},\"latency_ns\":{";
+    for (int i = 0; i < STAGE_COUNT; i++) {
+      const histogramSnapshot& stage = snapshot.stages[i];
+      out << (i ? "," : "") << "\"" << STAGE_NAMES[i] << "\":{\"count\":" << stage.count << ",\"mean\":" << stage.mean()
+          << ",\"p50\":" << stage.percentile(50) << ",\"p90\":" << stage.percentile(90) << ",\"p99\":" << stage.percentile(99)
+          << ",\"p999\":" << stage.percentile(99.9) << ",\"max\":" << stage.max << "}";
+    }
+    out << "}}";
+    return out.str();
+  }
+
+  static std::string prometheusText(const metricsSnapshot& snapshot, double seconds, const metricsGauges& gauges) {
+    std::ostringstream out;
+    out << "# TYPE rig_uptime_seconds gauge\nrig_uptime_seconds " << seconds << "\n";
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+      out << "# TYPE rig_" << COUNTER_NAMES[i] << "_total counter\n"
+          << "rig_" << COUNTER_NAMES[i] << "_total " << snapshot.counters[i] << "\n";
+    }
+    for (const auto& gauge : gauges) {
+      out << "# TYPE rig_" << gauge.first << " gauge\nrig_" << gauge.first << " " << gauge.second << "\n";
+    }
+    out << "# TYPE rig_stage_latency_seconds summary\n";
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    for (int i = 0; i < STAGE_COUNT; i++) {
+      const histogramSnapshot& stage = snapshot.stages[i];
+      for (double q : quantiles) {
+        out << "rig_stage_latency_seconds{stage=\"" << STAGE_NAMES[i] << "\",quantile=\"" << q << "\"} "
+            << stage.percentile(q * 100) * 1e-9 << "\n";
+      }
+      out << "rig_stage_latency_seconds_sum{stage=\"" << STAGE_NAMES[i] << "\"} " << stage.sum * 1e-9 << "\n"
+          << "rig_stage_latency_seconds_count{stage=\"" << STAGE_NAMES[i] << "\"} " << stage.count << "\n";
+    }
+    return out.str();
+  }
+
+private:
+  std::string path;
+  metricsFormat format;
+  std::ofstream lines;
+};
+
+#endif // metrics_h
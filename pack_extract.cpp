@@ -0,0 +1,91 @@
+#include <iostream>
+#include <filesystem>
+#include <fstream>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "pack_file.hpp"
+
+/**
+ * @file pack_extract.cpp
+ * @brief Lists and extracts the frames stored by random_image_generator with --output pack.
+ *
+ * Usage: ./pack_extract [pack_directory] list
+ *        ./pack_extract [pack_directory] extract [frame_number|all] [output_directory]
+ * - pack_directory: directory holding pack.idx and the pack_*.bin segments (default is ./images)
+ * - extracted frames are written as {$frame_number}{$format} in output_directory (default is ./extracted)
+ */
+
+void listFrames(const PackReader& pack) {
+  /**
+ * @brief Prints the pack geometry and one line per frame with its location.
+ */
+  const packIndexHeader& info = pack.info();
+  std::cout << "Frames: " << pack.index().size() << " | Size: " << info.width << "x" << info.height
+            << " | OpenCV type: " << info.type << std::endl;
+  std::cout << "Frame | Format | Segment | Offset | Length" << std::endl;
+  for (const packIndexEntry& entry : pack.index()) {
+    std::cout << entry.frame << " | " << entry.format << " | " << entry.segment << " | "
+              << entry.offset << " | " << entry.length << std::endl;
+  }
+}
+
+int extractFrames(PackReader& pack, const std::string& which, const std::string& outputDirectory) {
+  /**
+ * @brief Writes the selected frames to their own files.
+ *
+ * @param which A frame number or "all".
+ * @return int Number of frames that could not be extracted.
+ */
+  std::filesystem::create_directories(outputDirectory);
+  pack.openSegments();
+  bool all = which == "all";
+  uint64_t wanted = all ? 0 : std::stoull(which);
+  int failures = 0;
+  int extracted = 0;
+  std::vector<char> data;
+  for (const packIndexEntry& entry : pack.index()) {
+    if (!all && entry.frame != wanted) {
+      continue;
+    }
+    std::string filename = outputDirectory + "/" + std::to_string(entry.frame) + entry.format;
+    std::ofstream file(filename, std::ios::binary);
+    if (!pack.read(entry, data) || !file.write(data.data(), data.size())) {
+      std::cerr << "Failed to extract frame " << entry.frame << std::endl;
+      failures++;
+    } else {
+      extracted++;
+    }
+  }
+  std::cout << "Extracted " << extracted << " frames to " << outputDirectory << std::endl;
+  if (!all && extracted == 0) {
+    std::cerr << "Frame " << wanted << " is not in the pack" << std::endl;
+    failures++;
+  }
+  return failures;
+}
+
+int main(int argc, char **argv) {
+  std::string directory = argc >= 2 ? argv[1] : "./images";
+  std::string command = argc >= 3 ? argv[2] : "list";
+
+  PackReader pack(directory);
+  if (!pack.isValid()) {
+    std::cout << "No valid pack index found in " << directory << "\n"
+              << "Usage: ./pack_extract [pack_directory] list\n"
+              << "       ./pack_extract [pack_directory] extract [frame_number|all] [output_directory]\n";
+    return 1;
+  }
+
+  if (command == "list") {
+    listFrames(pack);
+    return 0;
+  }
+  if (command == "extract") {
+    std::string which = argc >= 4 ? argv[3] : "all";
+    std::string outputDirectory = argc >= 5 ? argv[4] : "./extracted";
+    return extractFrames(pack, which, outputDirectory) == 0 ? 0 : 1;
+  }
+  std::cout << "Unknown command: " << command << ", valid commands: list, extract.\n";
+  return 1;
+}
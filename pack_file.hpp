@@ -0,0 +1,326 @@
+#ifndef pack_file_h
+#define pack_file_h
+
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * @file pack_file.hpp
+ * @brief Append-only pack output: frames are stored in a few large segment files plus an index.
+ *
+ * Layout of a pack directory:
+ * - pack_NNNNN.bin: segment files holding the encoded frames back to back.
+ * - pack.idx: a packIndexHeader followed by one packIndexEntry per frame, in the order
+ *   the frames were appended (not necessarily frame number order).
+ *
+ * Writers reserve their byte range under a short lock and then write it with pwritev(),
+ * so several saver threads append to the same segment at the same time, and a batch of
+ * frames costs a single system call. The index entries of a batch are written right after
+ * its frames, so a crash loses at most the batches being written.
+ */
+
+const char PACK_MAGIC[8] = {'R', 'I', 'G', 'P', 'A', 'C', 'K', '1'};
+
+struct packIndexHeader {
+  /**
+ * @brief Header of pack.idx, describes the frames of the pack.
+ */
+  char magic[8];
+  uint32_t width;
+  uint32_t height;
+  uint32_t type; // OpenCV type of the frames (CV_8UC3, ...)
+  uint32_t reserved;
+};
+
+struct packIndexEntry {
+  /**
+ * @brief Location of one frame inside the pack.
+ */
+  uint64_t frame;  // Frame number
+  uint32_t segment; // Segment file holding the frame
+  uint32_t reserved;
+  uint64_t offset; // Byte offset of the frame in the segment
+  uint64_t length; // Encoded size in bytes
+  char format[8];  // Extension of the encoding, e.g. ".png" or ".raw"
+};
+
+struct packBatchItem {
+  /**
+ * @brief One encoded frame of a batch given to PackWriter::appendBatch().
+ */
+  uint64_t frame;
+  const void* data;
+  size_t length;
+};
+
+inline std::string packSegmentPath(const std::string& directory, uint32_t segment) {
+  char name[32];
+  snprintf(name, sizeof(name), "/pack_%05u.bin", segment);
+  return directory + name;
+}
+
+inline std::string packIndexPath(const std::string& directory) {
+  return directory + "/pack.idx";
+}
+
+class PackWriter {
+  /**
+ * @brief Appends encoded frames to the segments of a pack directory and records them in the index.
+ */
+public:
+  PackWriter(const std::string& directory, uint64_t segmentBytes, int width, int height, int type)
+      : directory(directory), segmentBytes(segmentBytes) {
+    indexFd = ::open(packIndexPath(directory).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    packIndexHeader header = {};
+    std::memcpy(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC));
+    header.width = width;
+    header.height = height;
+    header.type = type;
+    if (indexFd >= 0 && !writeAll(indexFd, &header, sizeof(header))) {
+      ::close(indexFd);
+      indexFd = -1;
+    }
+    openSegment();
+  }
+
+  ~PackWriter() { close(); }
+
+  PackWriter(const PackWriter&) = delete;
+  PackWriter& operator=(const PackWriter&) = delete;
+
+  bool isOpen() const { return indexFd >= 0 && !isIndexFailed && !segments.empty() && segments.back() >= 0; }
+
+  bool append(uint64_t frame, const char* format, const void* data, size_t length) {
+    /**
+ * @brief Stores one encoded frame.
+ *
+ * @return false if the frame could not be written.
+ */
+    packBatchItem item = {frame, data, length};
+    return appendBatch(format, &item, 1);
+  }
+
+  bool appendBatch(const char* format, const packBatchItem* items, size_t count) {
+    /**
+ * @brief Stores several encoded frames back to back with a single pwritev().
+ *
+ * A batch never spans two segments; a new segment is started when the current one
+ * can't hold it (a batch bigger than segmentBytes gets a segment of its own).
+ *
+ * @return false if the batch or its index entries could not be written. Once an index write
+ * failed, the index can't be appended to any more and every later batch fails too.
+ */
+    size_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+      total += items[i].length;
+    }
+
+    int fd;
+    uint32_t segment;
+    uint64_t offset;
+    pthread_mutex_lock(&mutex);
+    if (segmentUsed > 0 && segmentUsed + total > segmentBytes) {
+      openSegment();
+    }
+    fd = segments.back();
+    segment = static_cast<uint32_t>(segments.size() - 1);
+    offset = segmentUsed;
+    segmentUsed += total;
+    pthread_mutex_unlock(&mutex);
+
+    std::vector<iovec> parts(count);
+    for (size_t i = 0; i < count; i++) {
+      parts[i].iov_base = const_cast<void*>(items[i].data);
+      parts[i].iov_len = items[i].length;
+    }
+    if (fd < 0 || !pwritevAll(fd, parts.data(), count, offset)) {
+      return false;
+    }
+
+    // The entries are recorded once their bytes are written, so the index never points to missing data
+    std::vector<packIndexEntry> entries(count);
+    for (size_t i = 0; i < count; i++) {
+      entries[i].frame = items[i].frame;
+      entries[i].segment = segment;
+      entries[i].offset = offset;
+      entries[i].length = items[i].length;
+      std::strncpy(entries[i].format, format, sizeof(entries[i].format) - 1);
+      offset += items[i].length;
+    }
+    pthread_mutex_lock(&mutex);
+    bool isIndexed = writeIndex(entries.data(), count);
+    pthread_mutex_unlock(&mutex);
+    return isIndexed;
+  }
+
+  bool close() {
+    /**
+ * @brief Closes every file.
+ *
+ * @return false if an index write failed during the run or the index could not be closed,
+ * some frames of the segments are then missing from the index.
+ */
+    pthread_mutex_lock(&mutex);
+    for (int fd : segments) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+    segments.clear();
+    bool isIndexed = !isIndexFailed;
+    if (indexFd >= 0) {
+      isIndexed = ::close(indexFd) == 0 && isIndexed;
+      indexFd = -1;
+    }
+    pthread_mutex_unlock(&mutex);
+    return isIndexed;
+  }
+
+  size_t segmentCount() const { return segments.size(); }
+
+private:
+  void openSegment() {
+    std::string path = packSegmentPath(directory, static_cast<uint32_t>(segments.size()));
+    segments.push_back(::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644));
+    segmentUsed = 0;
+  }
+
+  bool writeIndex(const packIndexEntry* entries, size_t count) {
+    // A failed write may leave part of an entry, the entries after it would be misread
+    if (indexFd < 0 || isIndexFailed || !writeAll(indexFd, entries, count * sizeof(packIndexEntry))) {
+      isIndexFailed = true;
+    }
+    return !isIndexFailed;
+  }
+
+  static bool writeAll(int fd, const void* data, size_t length) {
+    const char* p = static_cast<const char*>(data);
+    while (length > 0) {
+      ssize_t n = ::write(fd, p, length);
+      if (n <= 0) {
+        return false;
+      }
+      p += n;
+      length -= n;
+    }
+    return true;
+  }
+
+  static bool pwritevAll(int fd, iovec* parts, size_t count, uint64_t offset) {
+    while (count > 0) {
+      ssize_t n = ::pwritev(fd, parts, count < IOV_MAX ? count : IOV_MAX, offset);
+      if (n <= 0) {
+        return false;
+      }
+      offset += n;
+      // Skip what was written, the call may stop in the middle of a part
+      while (count > 0 && static_cast<size_t>(n) >= parts -> iov_len) {
+        n -= parts -> iov_len;
+        parts++;
+        count--;
+      }
+      if (count > 0) {
+        parts -> iov_base = static_cast<char*>(parts -> iov_base) + n;
+        parts -> iov_len -= n;
+      }
+    }
+    return true;
+  }
+
+  std::string directory;
+  uint64_t segmentBytes;
+  std::vector<int> segments; // File descriptors, the last one is being filled
+  uint64_t segmentUsed = 0;
+  int indexFd = -1;
+  bool isIndexFailed = false; // An index write failed, nothing more is recorded
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+};
+
+class PackReader {
+  /**
+ * @brief Reads the index of a pack directory and the frames it points to.
+ */
+public:
+  explicit PackReader(const std::string& directory) : directory(directory) {
+    FILE* index = fopen(packIndexPath(directory).c_str(), "rb");
+    if (index == nullptr) {
+      return;
+    }
+    if (fread(&header, sizeof(header), 1, index) == 1 && std::memcmp(header.magic, PACK_MAGIC, sizeof(PACK_MAGIC)) == 0) {
+      packIndexEntry entry;
+      while (fread(&entry, sizeof(entry), 1, index) == 1) {
+        entries.push_back(entry);
+      }
+      valid = true;
+    }
+    fclose(index);
+  }
+
+  ~PackReader() {
+    for (int fd : segments) {
+      if (fd >= 0) {
+        ::close(fd);
+      }
+    }
+  }
+
+  PackReader(const PackReader&) = delete;
+  PackReader& operator=(const PackReader&) = delete;
+
+  bool isValid() const { return valid; }
+  const packIndexHeader& info() const { return header; }
+  const std::vector<packIndexEntry>& index() const { return entries; }
+
+  bool read(const packIndexEntry& entry, std::vector<char>& data) {
+    /**
+ * @brief Reads the encoded bytes of a frame. Safe to call from several threads once
+ * every segment has been opened with openSegments().
+ *
+ * @return false if the segment is missing or shorter than the index says.
+ */
+    if (entry.segment >= segments.size() || segments[entry.segment] < 0) {
+      return false;
+    }
+    data.resize(entry.length);
+    size_t done = 0;
+    while (done < entry.length) {
+      ssize_t n = ::pread(segments[entry.segment], data.data() + done, entry.length - done, entry.offset + done);
+      if (n <= 0) {
+        return false;
+      }
+      done += n;
+    }
+    return true;
+  }
+
+  void openSegments() {
+    /**
+ * @brief Opens every segment referenced by the index.
+ */
+    uint32_t count = 0;
+    for (const packIndexEntry& entry : entries) {
+      count = entry.segment + 1 > count ? entry.segment + 1 : count;
+    }
+    while (segments.size() < count) {
+      segments.push_back(::open(packSegmentPath(directory, static_cast<uint32_t>(segments.size())).c_str(), O_RDONLY));
+    }
+  }
+
+private:
+  std::string directory;
+  packIndexHeader header = {};
+  std::vector<packIndexEntry> entries;
+  std::vector<int> segments;
+  bool valid = false;
+};
+
+#endif // pack_file_h
@@ -0,0 +1,225 @@
+#include <algorithm>
+#include <filesystem>
+#include <iostream>
+#include "pipeline.hpp"
+
+/**
+ * @file pipeline.cpp
+ * @brief Threads of Pipeline and the file sink, the rig_pipeline library.
+ */
+
+bool FileSink::open(const pipelineConfig& config) {
+  /**
+ * @brief Creates the directory and picks the encoder of the extension for the frames of config.
+ *
+ * @return bool false if the directory can't be created.
+ */
+  std::error_code error;
+  std::filesystem::create_directories(directory, error);
+  format = savedFormatOf(extension, config.width, config.height, config.type, config.bits);
+  return std::filesystem::is_directory(directory);
+}
+
+bool FileSink::consume(uint64_t index, const cv::Mat& frame) {
+  /**
+ * @brief Writes frame to {directory}/{index}{extension}.
+ *
+ * @return bool false if the file could not be written, which stops the pipeline.
+ */
+  std::string filename = directory + "/" + std::to_string(index) + extension;
+  bool isSaved = false;
+  try {
+    if (format.reordersFrame()) {
+      // The other sinks share the frame, reorder a copy
+      thread_local cv::Mat copy;
+      frame.copyTo(copy);
+      isSaved = saveFrameFile(format, filename, copy);
+    } else {
+      isSaved = saveFrameFile(format, filename, const_cast<cv::Mat&>(frame)); // Only read, the format stores the frame as it is
+    }
+  } catch (const cv::Exception& ex) {
+    std::cerr << "Failed to save image: " << ex.what() << std::endl;
+  }
+  if (!isSaved) {
+    std::cerr << "Failed to save image: " << filename << std::endl;
+  }
+  return isSaved;
+}
+
+Pipeline::Pipeline(const pipelineConfig& config) : config(config) {
+  source = std::make_shared<PatternSource>(config.seed, config.type, config.bits, config.pattern, config.entropy);
+}
+
+Pipeline::~Pipeline() {
+  stop();
+}
+
+void Pipeline::setSource(std::shared_ptr<FrameSource> frameSource) {
+  /**
+ * @brief Replaces the PatternSource of the config, only while the pipeline is not running.
+ */
+  if (!isStarted) {
+    source = std::move(frameSource);
+  }
+}
+
+void Pipeline::addSink(std::shared_ptr<FrameSink> sink) {
+  /**
+ * @brief Adds a sink after the ones already added, only while the pipeline is not running.
+ */
+  if (!isStarted) {
+    sinks.push_back(std::move(sink));
+  }
+}
+
+bool Pipeline::start() {
+  /**
+ * @brief Opens the sinks, allocates the pool and the queue and starts the threads.
+ *
+ * Frame numbers restart at 0 and the counters are reset.
+ *
+ * @return bool false if the pipeline is running, has no valid source or a sink failed to open.
+ */
+  PatternSource* patternSource = dynamic_cast<PatternSource*>(source.get());
+  if (isStarted || !source || (patternSource && !patternSource -> isValid())) {
+    return false;
+  }
+  for (size_t i = 0; i < sinks.size(); i++) {
+    if (!sinks[i] -> open(config)) {
+      while (i-- > 0) {
+        sinks[i] -> close();
+      }
+      return false;
+    }
+  }
+  int producers = std::max(1, config.producers);
+  int consumers = std::max(1, config.consumers);
+  // Every queued frame, plus the one each thread is working on
+  pool.reset(new FramePool(config.queueSize + producers + consumers, config.width, config.height, config.type));
+  queue.reset(new FrameQueue<queuedFrame>(config.queueSize));
+  nextFrame = 0;
+  generatedFrames = 0;
+  consumedFrames = 0;
+  droppedFrames = 0;
+  hasFailed = false;
+  isDiscarding = false;
+  isProducing = true;
+  activeProducers = producers;
+  isStarted = true;
+  threads.resize(producers + consumers);
+  for (int i = 0; i < producers + consumers; i++) {
+    pthread_create(&threads[i], nullptr, i < producers ? producerLoop : consumerLoop, this);
+  }
+  return true;
+}
+
+void Pipeline::drain() {
+  /**
+ * @brief Stops generating, waits until the sinks got every queued frame and closes them.
+ */
+  stopProducing(false);
+  wait();
+}
+
+void Pipeline::stop() {
+  /**
+ * @brief Stops generating, gives the queued frames back without passing them to the sinks and closes them.
+ */
+  stopProducing(true);
+  wait();
+}
+
+void Pipeline::wait() {
+  /**
+ * @brief Waits until the threads finish, which happens after maxFrames frames, drain(), stop() or a
+ * failed sink, then closes the sinks.
+ */
+  if (!isStarted) {
+    return;
+  }
+  for (pthread_t thread : threads) {
+    pthread_join(thread, nullptr);
+  }
+  threads.clear();
+  for (auto& sink : sinks) {
+    sink -> close();
+  }
+  isStarted = false;
+}
+
+void Pipeline::stopProducing(bool discard) {
+  if (!isStarted) {
+    return;
+  }
+  if (discard) {
+    isDiscarding = true;
+  }
+  isProducing = false;
+  pool -> close(); // Wakes up the producers waiting for a buffer
+}
+
+void* Pipeline::producerLoop(void* args) {
+  static_cast<Pipeline*>(args) -> produce();
+  return NULL;
+}
+
+void* Pipeline::consumerLoop(void* args) {
+  static_cast<Pipeline*>(args) -> consume();
+  return NULL;
+}
+
+void Pipeline::produce() {
+  /**
+ * @brief Fills frames until maxFrames or stopProducing(), the last producer out closes the queue so
+ * the consumers finish the queued frames and return.
+ */
+  while (isProducing) {
+    uint64_t index = nextFrame++;
+    if (config.maxFrames > 0 && index >= config.maxFrames) {
+      break;
+    }
+    int slot = pool -> acquire();
+    if (slot < 0) {
+      if (pool -> isFailed() && !hasFailed.exchange(true)) {
+        std::cerr << "Failed to allocate a frame buffer, stopping." << std::endl;
+        stopProducing(true);
+      }
+      break; // Stopped while waiting for a buffer
+    }
+    source -> fill(pool -> at(slot), index);
+    generatedFrames++;
+    queuedFrame rejected = {};
+    pushResult result = queue -> pushWith(config.queuePolicy, {slot, index}, rejected);
+    if (result != PUSH_QUEUED) {
+      pool -> release(rejected.slot);
+    }
+    if (result == PUSH_DROPPED) {
+      droppedFrames++;
+    }
+  }
+  if (--activeProducers == 0) {
+    queue -> close();
+  }
+}
+
+void Pipeline::consume() {
+  /**
+ * @brief Passes the queued frames to the sinks in order of addition, until the queue is closed and empty.
+ */
+  queuedFrame frame;
+  while (queue -> pop(frame)) {
+    if (!isDiscarding) {
+      const cv::Mat& image = pool -> at(frame.slot);
+      bool isConsumed = true;
+      for (auto& sink : sinks) {
+        isConsumed = sink -> consume(frame.index, image) && isConsumed;
+      }
+      if (isConsumed) {
+        consumedFrames++;
+      } else if (!hasFailed.exchange(true)) {
+        stopProducing(true);
+      }
+    }
+    pool -> release(frame.slot);
+  }
+}
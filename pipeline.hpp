@@ -0,0 +1,203 @@
+#ifndef pipeline_h
+#define pipeline_h
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <opencv2/core.hpp>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "frame_file.hpp"
+#include "frame_pool.hpp"
+#include "frame_queue.hpp"
+#include "random_image.hpp"
+
+/**
+ * @file pipeline.hpp
+ * @brief The generator as a library: a Pipeline object that fills frames from a source and hands them
+ * to sinks in the calling process, without global state. Frames only reach the filesystem through a FileSink.
+ *
+ * Producer threads take a buffer of a FramePool, fill it with the FrameSource and queue it; consumer
+ * threads pass every queued frame to each sink in turn, by reference, then give the buffer back. A
+ * process can run several independent pipelines. Built as the rig_pipeline library:
+ *
+ * @code
+ * pipelineConfig config;
+ * config.seed = 42;
+ * config.maxFrames = 1000;
+ * Pipeline pipeline(config);
+ * pipeline.addSink(std::make_shared<CallbackSink>([](uint64_t index, const cv::Mat& frame) {
+ *   return process(frame); // Runs on a consumer thread, frame is only valid during the call
+ * }));
+ * pipeline.start();
+ * pipeline.wait();
+ * @endcode
+ */
+
+struct pipelineConfig {
+  /**
+ * @brief Frames and threads of a Pipeline.
+ */
+  int width = 1920;
+  int height = 1080;
+  int type = CV_8UC3;  // OpenCV type of the frames: 8 or 16-bit, 1, 3 or 4 channels
+  int bits = 8;        // Significant bits per sample, 10 and 12-bit samples are stored in 16 bits
+  contentPattern pattern = PATTERN_NOISE; // Content of the frames of the default PatternSource
+  int entropy = DEFAULT_ENTROPY; // Percent of noise tiles of PATTERN_MIXED
+  uint64_t seed = 0;   // Frame N only depends on (seed, N), like in the generator
+  int producers = 1;   // Threads filling frames
+  int consumers = 1;   // Threads running the sinks, with 1 producer and 1 consumer the sinks see the frames in order
+  size_t queueSize = 64; // Maximum number of filled frames waiting for a consumer
+  fullQueuePolicy queuePolicy = QUEUE_BLOCK; // What producers do when the queue is full
+  uint64_t maxFrames = 0; // Frames to generate before draining by itself, 0 runs until stop() or drain()
+};
+
+class FrameSource {
+  /**
+ * @brief Fills the frames. fill() is called by every producer thread at the same time.
+ */
+public:
+  virtual ~FrameSource() = default;
+
+  // Fills frame index, a buffer of the pipeline's size and type
+  virtual void fill(cv::Mat& frame, uint64_t index) = 0;
+};
+
+class PatternSource : public FrameSource {
+  /**
+ * @brief Frame index of a seed, the frames of the generator with the same seed, type, pattern and entropy.
+ */
+public:
+  PatternSource(uint64_t seed, int type, int bits, contentPattern pattern = PATTERN_NOISE, int entropy = DEFAULT_ENTROPY)
+      : seed(seed), entropy(entropy), filler(fillerOf(type, bits, pattern)) {}
+
+  bool isValid() const { return filler != nullptr; }
+
+  void fill(cv::Mat& frame, uint64_t index) override { filler(frame, seed, index, 0, entropy); }
+
+private:
+  uint64_t seed;
+  int entropy;
+  frameFiller filler; // nullptr if the type, bits and pattern don't go together
+};
+
+class FrameSink {
+  /**
+ * @brief Receives the frames. consume() is called by every consumer thread at the same time.
+ */
+public:
+  virtual ~FrameSink() = default;
+
+  virtual bool open(const pipelineConfig& config) {
+    /**
+ * @brief Called by Pipeline::start() before any frame.
+ *
+ * @return bool false cancels the start.
+ */
+    return true;
+  }
+
+  // Gets frame index, shared with the other sinks: it goes back to the pool once every sink is done, so
+  // it must not be kept or modified. Returning false stops the pipeline, like stop().
+  virtual bool consume(uint64_t index, const cv::Mat& frame) = 0;
+
+  virtual void close() {}
+};
+
+class CallbackSink : public FrameSink {
+  /**
+ * @brief Passes the frames to a function, zero copies.
+ */
+public:
+  typedef std::function<bool(uint64_t index, const cv::Mat& frame)> frameCallback;
+
+  explicit CallbackSink(frameCallback callback) : callback(std::move(callback)) {}
+
+  bool consume(uint64_t index, const cv::Mat& frame) override { return callback(index, frame); }
+
+private:
+  frameCallback callback;
+};
+
+class FileSink : public FrameSink {
+  /**
+ * @brief Writes one file per frame, {directory}/{index}{extension}, with saveFrameFile() like the files output of the generator.
+ *
+ * The frame is written straight from the pool buffer when its format stores it as it is, from a
+ * per-thread copy when the format reorders it.
+ */
+public:
+  FileSink(const std::string& directory, const std::string& extension) : directory(directory), extension(extension) {}
+
+  bool open(const pipelineConfig& config) override;
+  bool consume(uint64_t index, const cv::Mat& frame) override;
+
+private:
+  std::string directory;
+  std::string extension;
+  savedFormat format; // extension for the frames of the running pipeline
+};
+
+class Pipeline {
+  /**
+ * @brief Producer and consumer threads between a source and a list of sinks.
+ *
+ * start() opens the sinks and starts the threads. drain() stops generating and returns once every
+ * queued frame went through the sinks; stop() also discards the queued frames. Both close the sinks,
+ * after which the pipeline can be started again. The destructor stops a running pipeline.
+ */
+public:
+  explicit Pipeline(const pipelineConfig& config);
+  ~Pipeline();
+
+  Pipeline(const Pipeline&) = delete;
+  Pipeline& operator=(const Pipeline&) = delete;
+
+  void setSource(std::shared_ptr<FrameSource> frameSource);
+  void addSink(std::shared_ptr<FrameSink> sink);
+
+  bool start();
+  void drain();
+  void stop();
+  void wait();
+
+  bool isRunning() const { return isStarted; }
+  bool isFailed() const { return hasFailed; }
+
+  uint64_t generated() const { return generatedFrames; }
+  uint64_t consumed() const { return consumedFrames; }
+  uint64_t dropped() const { return droppedFrames; }
+  size_t queued() const { return queue ? queue -> size() : 0; }
+
+private:
+  struct queuedFrame {
+    int slot;
+    uint64_t index;
+  };
+
+  static void* producerLoop(void* args);
+  static void* consumerLoop(void* args);
+  void produce();
+  void consume();
+  void stopProducing(bool discard);
+
+  pipelineConfig config;
+  std::shared_ptr<FrameSource> source;
+  std::vector<std::shared_ptr<FrameSink>> sinks;
+  std::unique_ptr<FramePool> pool;
+  std::unique_ptr<FrameQueue<queuedFrame>> queue;
+  std::vector<pthread_t> threads;
+  bool isStarted = false;
+  std::atomic<bool> isProducing{false};
+  std::atomic<bool> isDiscarding{false}; // Consumers give the frames back without running the sinks
+  std::atomic<bool> hasFailed{false};    // A sink returned false or a buffer could not be allocated
+  std::atomic<int> activeProducers{0};   // The last producer to finish closes the queue
+  std::atomic<uint64_t> nextFrame{0};
+  std::atomic<uint64_t> generatedFrames{0};
+  std::atomic<uint64_t> consumedFrames{0};
+  std::atomic<uint64_t> droppedFrames{0};
+};
+
+#endif // pipeline_h
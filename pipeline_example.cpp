@@ -0,0 +1,104 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <opencv2/core.hpp>
+#include "pipeline.hpp"
+
+/**
+ * @file pipeline_example.cpp
+ * @brief Example user of the rig_pipeline library: an in-process load generator consuming frames at
+ * memory speed through a callback sink, without files.
+ *
+ * Usage: ./pipeline_example [seconds] [producers] [consumers] [--pattern P] [--entropy PERCENT] [--seed S] [--verify] [--save DIR EXT]
+ * - seconds: how long to run before draining the pipeline (default is 5)
+ * - producers, consumers: threads filling frames and threads running the sinks (default is 1 and 1)
+ * - --verify: the callback regenerates every frame and compares it with the one it got
+ * - --save DIR EXT: also write every frame to DIR with a FileSink, e.g. --save ./images .raw
+ */
+
+int main(int argc, char **argv) {
+  pipelineConfig config;
+  int seconds = 5;
+  bool isVerify = false;
+  std::string saveDirectory;
+  std::string saveExtension;
+  int positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--verify") == 0) {
+      isVerify = true;
+    } else if (strcmp(argv[i], "--pattern") == 0 && i + 1 < argc) {
+      config.pattern = patternOf(argv[++i]);
+      if (config.pattern == PATTERN_COUNT) {
+        std::cout << "Invalid pattern, valid patterns: noise, gradient, gaussian, value-noise, checker, mixed.\n";
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--entropy") == 0 && i + 1 < argc) {
+      config.entropy = std::stoi(argv[++i]);
+      if (config.entropy < 0 || config.entropy > 100) {
+        std::cout << "Invalid entropy, valid entropies: 0 to 100 (percent of noise tiles).\n";
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      config.seed = std::stoull(argv[++i]);
+    } else if (strcmp(argv[i], "--save") == 0 && i + 2 < argc) {
+      saveDirectory = argv[++i];
+      saveExtension = argv[++i];
+    } else if (positional == 0) {
+      seconds = std::stoi(argv[i]);
+      positional++;
+    } else if (positional == 1) {
+      config.producers = std::max(1, std::stoi(argv[i]));
+      positional++;
+    } else {
+      config.consumers = std::max(1, std::stoi(argv[i]));
+    }
+  }
+
+  std::atomic<uint64_t> mismatched{0};
+  Pipeline pipeline(config);
+  pipeline.addSink(std::make_shared<CallbackSink>([&](uint64_t index, const cv::Mat& frame) {
+    if (isVerify) {
+      thread_local cv::Mat expected;
+      expected.create(frame.size(), frame.type());
+      generateRandomImage(expected, config.seed, index, config.bits, config.pattern, config.entropy);
+      if (std::memcmp(expected.data, frame.data, frame.total() * frame.elemSize()) != 0) {
+        mismatched++;
+      }
+    }
+    return true;
+  }));
+  if (!saveDirectory.empty()) {
+    pipeline.addSink(std::make_shared<FileSink>(saveDirectory, saveExtension));
+  }
+  if (!pipeline.start()) {
+    std::cout << "Could not start the pipeline.\n";
+    return 1;
+  }
+
+  const double frameMB = config.width * config.height * CV_ELEM_SIZE(config.type) / (1024.0 * 1024.0);
+  auto start = std::chrono::steady_clock::now();
+  uint64_t lastFrames = 0;
+  for (int second = 0; second < seconds && !pipeline.isFailed(); second++) {
+    std::this_thread::sleep_until(start + std::chrono::seconds(second + 1));
+    uint64_t frames = pipeline.consumed();
+    std::cout << "→ FPS: " << frames - lastFrames << " (" << (frames - lastFrames) * frameMB << " MB/s) | Frames: " << frames
+              << " | Queued: " << pipeline.queued() << std::endl;
+    lastFrames = frames;
+  }
+  pipeline.drain();
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+  std::cout << "\n--- SUMMARY ---\n"
+            << "→ Frames generated: " << pipeline.generated() << "\n"
+            << "→ Frames consumed: " << pipeline.consumed() << "\n";
+  if (isVerify) {
+    std::cout << "→ Frames mismatched: " << mismatched << "\n";
+  }
+  std::cout << "→ Average FPS: " << pipeline.consumed() / elapsed << " (" << pipeline.consumed() * frameMB / elapsed << " MB/s)\n";
+  return pipeline.isFailed() || mismatched > 0 ? 1 : 0;
+}
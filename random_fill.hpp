@@ -0,0 +1,264 @@
+#ifndef random_fill_h
+#define random_fill_h
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RANDOM_FILL_X86 1
+#endif
+
+/**
+ * @file random_fill.hpp
+ * @brief Vectorized uniform random byte generation with the Philox4x32-10 counter-based RNG.
+ *
+ * Byte p of a (key, stream) sequence is a pure function of (key, stream, p): every 16 byte block
+ * is Philox4x32-10 of the counter {block, stream} under the key. Groups of 8 blocks are stored
+ * word-major (word 0 of the 8 blocks, then word 1, ...) so that the SIMD kernels can write their
+ * lanes straight to memory. The scalar, SSE2 and AVX2 kernels produce exactly the same bytes,
+ * the fastest one supported by the CPU is picked at runtime.
+ */
+
+namespace randomFill {
+
+const size_t GROUP_BYTES = 128; // 8 Philox blocks of 16 bytes
+const uint32_t PHILOX_M0 = 0xD2511F53;
+const uint32_t PHILOX_M1 = 0xCD9E8D57;
+const uint32_t PHILOX_W0 = 0x9E3779B9;
+const uint32_t PHILOX_W1 = 0xBB67AE85;
+
+typedef void (*groupKernel)(uint32_t* out, uint64_t firstGroup, size_t groups, uint64_t key, uint64_t stream);
+
+inline void philoxGroupsScalar(uint32_t* out, uint64_t firstGroup, size_t groups, uint64_t key, uint64_t stream) {
+  /**
+ * @brief Portable kernel, computes one Philox block at a time.
+ *
+ * @param out Destination of groups * 32 words.
+ * @param firstGroup Index of the first group of 8 blocks in the sequence.
+ * @param groups Number of groups to generate.
+ * @param key Philox key.
+ * @param stream High half of the Philox counter.
+ */
+  for (size_t g = 0; g < groups; g++) {
+    uint64_t block = (firstGroup + g) * 8;
+    for (int j = 0; j < 8; j++) {
+      uint32_t c0 = static_cast<uint32_t>(block + j);
+      uint32_t c1 = static_cast<uint32_t>((block + j) >> 32);
+      uint32_t c2 = static_cast<uint32_t>(stream);
+      uint32_t c3 = static_cast<uint32_t>(stream >> 32);
+      uint32_t k0 = static_cast<uint32_t>(key);
+      uint32_t k1 = static_cast<uint32_t>(key >> 32);
+      for (int round = 0; round < 10; round++) {
+        uint64_t p0 = static_cast<uint64_t>(PHILOX_M0) * c0;
+        uint64_t p1 = static_cast<uint64_t>(PHILOX_M1) * c2;
+        uint32_t n0 = static_cast<uint32_t>(p1 >> 32) ^ c1 ^ k0;
+        uint32_t n2 = static_cast<uint32_t>(p0 >> 32) ^ c3 ^ k1;
+        c1 = static_cast<uint32_t>(p1);
+        c3 = static_cast<uint32_t>(p0);
+        c0 = n0;
+        c2 = n2;
+        k0 += PHILOX_W0;
+        k1 += PHILOX_W1;
+      }
+      out[j] = c0;
+      out[8 + j] = c1;
+      out[16 + j] = c2;
+      out[24 + j] = c3;
+    }
+    out += 32;
+  }
+}
+
+#ifdef RANDOM_FILL_X86
+inline void mulhiloSSE2(__m128i a, __m128i m, __m128i& lo, __m128i& hi) {
+  // 32x32->64 products of the even and the odd lanes, then recombined per lane
+  const __m128i lowHalf = _mm_set1_epi64x(0xFFFFFFFFLL);
+  __m128i even = _mm_mul_epu32(a, m);
+  __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), m);
+  lo = _mm_or_si128(_mm_and_si128(even, lowHalf), _mm_slli_epi64(odd, 32));
+  hi = _mm_or_si128(_mm_srli_epi64(even, 32), _mm_andnot_si128(lowHalf, odd));
+}
+
+inline void philoxGroupsSSE2(uint32_t* out, uint64_t firstGroup, size_t groups, uint64_t key, uint64_t stream) {
+  /**
+ * @brief SSE2 kernel, computes the two halves of a group (4 Philox blocks each) side by side.
+ */
+  const __m128i m0 = _mm_set1_epi32(static_cast<int>(PHILOX_M0));
+  const __m128i m1 = _mm_set1_epi32(static_cast<int>(PHILOX_M1));
+  const __m128i s0 = _mm_set1_epi32(static_cast<int>(stream));
+  const __m128i s1 = _mm_set1_epi32(static_cast<int>(stream >> 32));
+  for (size_t g = 0; g < groups; g++) {
+    uint64_t block = (firstGroup + g) * 8;
+    __m128i a0 = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(block)), _mm_set_epi32(3, 2, 1, 0));
+    __m128i b0 = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(block)), _mm_set_epi32(7, 6, 5, 4));
+    __m128i a1 = _mm_set1_epi32(static_cast<int>(block >> 32));
+    __m128i b1 = a1;
+    __m128i a2 = s0, b2 = s0;
+    __m128i a3 = s1, b3 = s1;
+    uint32_t k0 = static_cast<uint32_t>(key);
+    uint32_t k1 = static_cast<uint32_t>(key >> 32);
+    for (int round = 0; round < 10; round++) {
+      const __m128i key0 = _mm_set1_epi32(static_cast<int>(k0));
+      const __m128i key1 = _mm_set1_epi32(static_cast<int>(k1));
+      __m128i alo0, ahi0, alo1, ahi1, blo0, bhi0, blo1, bhi1;
+      mulhiloSSE2(a0, m0, alo0, ahi0);
+      mulhiloSSE2(b0, m0, blo0, bhi0);
+      mulhiloSSE2(a2, m1, alo1, ahi1);
+      mulhiloSSE2(b2, m1, blo1, bhi1);
+      a0 = _mm_xor_si128(_mm_xor_si128(ahi1, a1), key0);
+      b0 = _mm_xor_si128(_mm_xor_si128(bhi1, b1), key0);
+      a2 = _mm_xor_si128(_mm_xor_si128(ahi0, a3), key1);
+      b2 = _mm_xor_si128(_mm_xor_si128(bhi0, b3), key1);
+      a1 = alo1;
+      b1 = blo1;
+      a3 = alo0;
+      b3 = blo0;
+      k0 += PHILOX_W0;
+      k1 += PHILOX_W1;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), a0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), b0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 8), a1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 12), b1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), a2);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 20), b2);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 24), a3);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 28), b3);
+    out += 32;
+  }
+}
+
+__attribute__((target("avx2")))
+inline void mulhiloAVX2(__m256i a, __m256i m, __m256i& lo, __m256i& hi) {
+  __m256i even = _mm256_mul_epu32(a, m);
+  __m256i odd = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), m);
+  lo = _mm256_blend_epi32(even, _mm256_slli_epi64(odd, 32), 0xAA);
+  hi = _mm256_blend_epi32(_mm256_srli_epi64(even, 32), odd, 0xAA);
+}
+
+__attribute__((target("avx2")))
+inline void philoxGroupsAVX2(uint32_t* out, uint64_t firstGroup, size_t groups, uint64_t key, uint64_t stream) {
+  /**
+ * @brief AVX2 kernel, computes the 8 Philox blocks of a group in one vector.
+ */
+  const __m256i m0 = _mm256_set1_epi32(static_cast<int>(PHILOX_M0));
+  const __m256i m1 = _mm256_set1_epi32(static_cast<int>(PHILOX_M1));
+  const __m256i s0 = _mm256_set1_epi32(static_cast<int>(stream));
+  const __m256i s1 = _mm256_set1_epi32(static_cast<int>(stream >> 32));
+  const __m256i lanes = _mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0);
+  for (size_t g = 0; g < groups; g++) {
+    uint64_t block = (firstGroup + g) * 8;
+    __m256i c0 = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(block)), lanes);
+    __m256i c1 = _mm256_set1_epi32(static_cast<int>(block >> 32));
+    __m256i c2 = s0;
+    __m256i c3 = s1;
+    uint32_t k0 = static_cast<uint32_t>(key);
+    uint32_t k1 = static_cast<uint32_t>(key >> 32);
+    for (int round = 0; round < 10; round++) {
+      __m256i lo0, hi0, lo1, hi1;
+      mulhiloAVX2(c0, m0, lo0, hi0);
+      mulhiloAVX2(c2, m1, lo1, hi1);
+      c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), _mm256_set1_epi32(static_cast<int>(k0)));
+      c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), _mm256_set1_epi32(static_cast<int>(k1)));
+      c1 = lo1;
+      c3 = lo0;
+      k0 += PHILOX_W0;
+      k1 += PHILOX_W1;
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), c0);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 8), c1);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 16), c2);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 24), c3);
+    out += 32;
+  }
+}
+#endif
+
+inline groupKernel bestKernel() {
+  /**
+ * @brief Picks the fastest kernel supported by the running CPU.
+ */
+#ifdef RANDOM_FILL_X86
+  if (__builtin_cpu_supports("avx2")) {
+    return philoxGroupsAVX2;
+  }
+  return philoxGroupsSSE2;
+#else
+  return philoxGroupsScalar;
+#endif
+}
+
+inline const char* kernelName(groupKernel kernel) {
+  /**
+ * @brief Human readable name of a kernel, used by the stats and benchmarks.
+ */
+#ifdef RANDOM_FILL_X86
+  if (kernel == philoxGroupsAVX2) {
+    return "avx2";
+  }
+  if (kernel == philoxGroupsSSE2) {
+    return "sse2";
+  }
+#endif
+  return "scalar";
+}
+
+inline groupKernel activeKernel() {
+  static const groupKernel kernel = bestKernel();
+  return kernel;
+}
+
+inline void fillRandomBytes(void* dst, size_t bytes, uint64_t key, uint64_t stream, uint64_t firstByte = 0,
+                            groupKernel kernel = activeKernel()) {
+  /**
+ * @brief Writes bytes [firstByte, firstByte + bytes) of the (key, stream) sequence to dst.
+ *
+ * Whole groups are generated in place, the unaligned head and tail go through a small
+ * stack buffer, so filling a buffer in several pieces gives the same bytes as filling it at once.
+ *
+ * @param dst Destination buffer, no alignment required.
+ * @param bytes Number of bytes to write.
+ * @param key Philox key, e.g. the seed.
+ * @param stream Stream number, e.g. the frame number.
+ * @param firstByte Position in the sequence of the first byte written.
+ * @param kernel Kernel to use, the fastest supported one by default.
+ */
+  uint8_t* out = static_cast<uint8_t*>(dst);
+  uint32_t scratch[GROUP_BYTES / 4];
+  uint64_t group = firstByte / GROUP_BYTES;
+  size_t skip = firstByte % GROUP_BYTES;
+
+  if (skip != 0 && bytes > 0) {
+    size_t n = GROUP_BYTES - skip < bytes ? GROUP_BYTES - skip : bytes;
+    kernel(scratch, group, 1, key, stream);
+    std::memcpy(out, reinterpret_cast<uint8_t*>(scratch) + skip, n);
+    out += n;
+    bytes -= n;
+    group++;
+  }
+
+  size_t groups = bytes / GROUP_BYTES;
+  if (groups > 0) {
+    if (reinterpret_cast<uintptr_t>(out) % alignof(uint32_t) == 0) {
+      kernel(reinterpret_cast<uint32_t*>(out), group, groups, key, stream);
+    } else {
+      for (size_t g = 0; g < groups; g++) {
+        kernel(scratch, group + g, 1, key, stream);
+        std::memcpy(out + g * GROUP_BYTES, scratch, GROUP_BYTES);
+      }
+    }
+    out += groups * GROUP_BYTES;
+    bytes -= groups * GROUP_BYTES;
+    group += groups;
+  }
+
+  if (bytes > 0) {
+    kernel(scratch, group, 1, key, stream);
+    std::memcpy(out, scratch, bytes);
+  }
+}
+
+} // namespace randomFill
+
+#endif // random_fill_h
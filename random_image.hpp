@@ -0,0 +1,467 @@
+#ifndef random_image_h
+#define random_image_h
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <opencv2/core.hpp>
+#include "random_fill.hpp"
+
+/**
+ * @file random_image.hpp
+ * @brief Frame content of the generator: frame N of a run is a pure function of (seed, N).
+ *
+ * Shared by random_image_generator (generation and verify mode) and generator_bench.
+ *
+ * Every pixel type starts from the same random bytes. The types that can't take any byte value are fixed up
+ * by a kernel specialized at compile time for their sample type, channel count and bit depth:
+ * the alpha channel is made opaque and 10/12-bit samples stored in 16 bits get their unused high bits cleared.
+ * The kernel of a run is picked once with fillerOf(), so the fill loop itself has no type switch.
+ *
+ * Every byte of a frame is derived from its position, so an image too large for memory can be filled
+ * in stripes of rows, by any number of threads, and give the same pixels as a whole-frame fill.
+ *
+ * Besides uniform noise (the worst case for compression) the content can be a procedural pattern with a
+ * more realistic entropy: gradients, Gaussian noise, value noise, a checkerboard, or tiles mixing noise and
+ * flat color in a chosen ratio. The patterns are also pure functions of (seed, N, x, y), written as simple
+ * row loops the compiler vectorizes; the random parts use the same Philox kernels as the noise.
+ */
+
+typedef void (*frameFiller)(cv::Mat& image, uint64_t seed, uint64_t index, uint64_t firstRow, int entropy);
+
+enum contentPattern {
+  /**
+ * @brief Content of the frames.
+ */
+  PATTERN_NOISE,       // Uniform random samples, incompressible
+  PATTERN_GRADIENT,    // Diagonal triangle-wave ramps, one direction per channel
+  PATTERN_GAUSSIAN,    // Gaussian noise around mid-gray, sigma of 1/8 of the range
+  PATTERN_VALUE_NOISE, // Smooth fractal value noise (3 octaves), like clouds
+  PATTERN_CHECKER,     // Two color checkerboard of 64 pixel squares
+  PATTERN_MIXED,       // 64 pixel tiles, either noise or flat color, entropy percent of them noise
+  PATTERN_COUNT
+};
+
+const char* const PATTERN_NAMES[PATTERN_COUNT] = {"noise", "gradient", "gaussian", "value-noise", "checker", "mixed"};
+
+inline contentPattern patternOf(const char* name) {
+  /**
+ * @brief Pattern of a name of PATTERN_NAMES, PATTERN_COUNT if there is none.
+ */
+  for (int i = 0; i < PATTERN_COUNT; i++) {
+    if (strcmp(name, PATTERN_NAMES[i]) == 0) {
+      return static_cast<contentPattern>(i);
+    }
+  }
+  return PATTERN_COUNT;
+}
+
+// Percent of the PATTERN_MIXED tiles that are noise when none is given, 0 compresses like a flat image,
+// 100 is pure noise. The entropy is part of the content like the seed, the other patterns ignore it.
+const int DEFAULT_ENTROPY = 50;
+
+inline uint64_t splitMix64(uint64_t x) {
+  /**
+ * @brief Mixes a 64-bit value with the SplitMix64 finalizer.
+ *
+ * Used to turn the seed of the run into the key of the frame RNG.
+ *
+ * @param x The value to mix.
+ * @return uint64_t The mixed value.
+ */
+  x += 0x9E3779B97F4A7C15ULL;
+  x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+  x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+  return x ^ (x >> 31);
+}
+
+template <typename T, int Channels, int Bits>
+inline void fixupPixels(T* samples, size_t pixels) {
+  /**
+ * @brief Makes random samples valid for the pixel type: opaque alpha, no bit above Bits.
+ */
+  const T maxValue = static_cast<T>((1ULL << Bits) - 1);
+  const bool isMasked = Bits < static_cast<int>(sizeof(T) * 8);
+  for (size_t i = 0; i < pixels; i++, samples += Channels) {
+    for (int c = 0; c < Channels; c++) {
+      if (Channels == 4 && c == 3) {
+        samples[c] = maxValue;
+      } else if (isMasked) {
+        samples[c] &= maxValue;
+      }
+    }
+  }
+}
+
+template <typename T, int Channels, int Bits>
+inline void fillPixels(cv::Mat& image, uint64_t seed, uint64_t index, uint64_t firstRow, int entropy) {
+  /**
+ * @brief Fills an image of Channels samples of type T per pixel, each sample using its low Bits bits.
+ *
+ * The bytes are written straight into the buffer by the vectorized Philox kernel of random_fill.hpp,
+ * keyed by the seed and using the frame number as stream, so the result only depends on (seed, index).
+ * Types that need a fixup get it row by row, while the row is still in cache.
+ *
+ * @param firstRow Row of the frame the first row of image is, image holds a stripe of a taller frame.
+ * @param entropy Not used, the signature of every frameFiller.
+ */
+  const bool needsFixup = Channels == 4 || Bits < static_cast<int>(sizeof(T) * 8);
+  uint64_t key = splitMix64(seed);
+  size_t rowBytes = image.cols * image.elemSize();
+  if (image.isContinuous() && !needsFixup) {
+    randomFill::fillRandomBytes(image.data, rowBytes * image.rows, key, index, firstRow * rowBytes);
+    return;
+  }
+  for (int row = 0; row < image.rows; row++) {
+    randomFill::fillRandomBytes(image.ptr(row), rowBytes, key, index, (firstRow + row) * rowBytes);
+    if (needsFixup) {
+      fixupPixels<T, Channels, Bits>(image.ptr<T>(row), image.cols);
+    }
+  }
+}
+
+inline uint64_t latticeHash(uint64_t key, uint64_t index, uint64_t a, uint64_t b, uint64_t c) {
+  // Random 64 bits for a point of a pattern lattice (cell, tile or channel) of frame index
+  return splitMix64(key ^ splitMix64(index ^ splitMix64(a ^ splitMix64(b ^ (c << 56)))));
+}
+
+template <typename T, int Channels, int Bits>
+struct gradientRows {
+  /**
+ * @brief Ramps of period 2 * PERIOD pixels along a per-channel direction, shifting by 8 pixels every frame.
+ */
+  static const uint32_t PERIOD = 1024;
+  uint32_t dx[Channels];
+  uint32_t dy[Channels];
+  uint32_t phase[Channels];
+  T ramp[2 * PERIOD]; // Value at every position of a period
+
+  gradientRows(int width, uint64_t key, uint64_t index, int entropy) {
+    for (int c = 0; c < Channels; c++) {
+      uint64_t h = latticeHash(key, index / 1024, 0, 0, c); // Same directions for runs of frames
+      dx[c] = 1 + h % 3;
+      dy[c] = (h >> 8) % 3;
+      phase[c] = static_cast<uint32_t>((h >> 16) + index * 8);
+    }
+    const uint32_t maxValue = (1u << Bits) - 1;
+    for (uint32_t v = 0; v < 2 * PERIOD; v++) {
+      ramp[v] = static_cast<T>((v < PERIOD ? v : 2 * PERIOD - 1 - v) * maxValue / (PERIOD - 1));
+    }
+  }
+
+  void row(T* samples, int width, uint64_t y) {
+    uint32_t position[Channels];
+    for (int c = 0; c < Channels; c++) {
+      position[c] = static_cast<uint32_t>(y * dy[c]) + phase[c];
+    }
+    for (int x = 0; x < width; x++) {
+      for (int c = 0; c < Channels; c++) {
+        samples[x * Channels + c] = ramp[position[c] & (2 * PERIOD - 1)];
+        position[c] += dx[c];
+      }
+    }
+  }
+};
+
+template <typename T, int Channels, int Bits>
+struct gaussianRows {
+  /**
+ * @brief A random 16-bit word per sample mapped through the inverse CDF of a normal law around mid-gray,
+ * with a sigma of 1/8 of the range, clamped at the ends.
+ */
+  uint64_t key;
+  uint64_t index;
+  std::vector<uint16_t> words;
+
+  static const std::vector<T>& quantiles() {
+    // Sample of every 16-bit word: the words below CDF(v + 0.5) * 65536 and above the previous bound map to v
+    static const std::vector<T> table = [] {
+      const double maxValue = (1 << Bits) - 1;
+      std::vector<T> values(65536);
+      size_t word = 0;
+      for (int v = 0; v <= maxValue; v++) {
+        double z = (v + 0.5 - maxValue / 2) / (maxValue / 8);
+        size_t bound = v == maxValue ? values.size() : static_cast<size_t>(0.5 * std::erfc(-z / std::sqrt(2.0)) * 65536 + 0.5);
+        for (; word < bound; word++) {
+          values[word] = static_cast<T>(v);
+        }
+      }
+      return values;
+    }();
+    return table;
+  }
+
+  gaussianRows(int width, uint64_t key, uint64_t index, int entropy)
+      : key(key ^ 0x6A09E667F3BCC908ULL), index(index), words(static_cast<size_t>(width) * Channels) {}
+
+  void row(T* samples, int width, uint64_t y) {
+    const T* table = quantiles().data();
+    const size_t bytes = words.size() * sizeof(uint16_t);
+    randomFill::fillRandomBytes(words.data(), bytes, key, index, y * bytes);
+    for (size_t i = 0; i < words.size(); i++) {
+      samples[i] = table[words[i]];
+    }
+  }
+};
+
+template <typename T, int Channels, int Bits>
+struct valueNoiseRows {
+  /**
+ * @brief Random values on lattices of 128, 32 and 8 pixels, smoothly interpolated and summed with weights 4:2:1.
+ *
+ * The vertical interpolation is done once per lattice cell and row, the horizontal one per pixel with
+ * a table of weights, so a sample costs one multiply-add per octave.
+ */
+  static const int OCTAVES = 3;
+  uint64_t key;
+  uint64_t index;
+  int cells[OCTAVES];
+  std::vector<float> weights[OCTAVES]; // Smoothstep weight of every position in a cell
+  std::vector<float> top[OCTAVES];     // Lattice values of the cell row above and below the current row
+  std::vector<float> bottom[OCTAVES];
+  int64_t latticeRow[OCTAVES];          // Cell row of top, -1 before the first row
+  std::vector<float> columns;           // Values of the lattice columns interpolated at the current row
+  std::vector<float> sum;               // Sum of the octaves, one plane per channel so the loops vectorize
+
+  static int cellSize(int octave) { return 128 >> (2 * octave); }
+
+  valueNoiseRows(int width, uint64_t key, uint64_t index, int entropy)
+      : key(key), index(index), sum(static_cast<size_t>(width) * Channels) {
+    for (int o = 0; o < OCTAVES; o++) {
+      int size = cellSize(o);
+      cells[o] = width / size + 2;
+      for (int i = 0; i < size; i++) {
+        float t = static_cast<float>(i) / size;
+        weights[o].push_back(t * t * (3 - 2 * t));
+      }
+      top[o].resize(cells[o] * Channels);
+      bottom[o].resize(cells[o] * Channels);
+      latticeRow[o] = -1;
+    }
+    columns.resize((width / cellSize(OCTAVES - 1) + 2) * Channels);
+  }
+
+  void latticeValues(std::vector<float>& values, int octave, uint64_t cellRow) {
+    for (int cell = 0; cell < cells[octave]; cell++) {
+      for (int c = 0; c < Channels; c++) {
+        uint64_t h = latticeHash(key, index, (static_cast<uint64_t>(octave) << 32) | cell, cellRow, c);
+        values[cell * Channels + c] = static_cast<float>(h >> 40) * (1.0f / (1 << 24));
+      }
+    }
+  }
+
+  void row(T* samples, int width, uint64_t y) {
+    const float amplitudes[OCTAVES] = {4.0f / 7, 2.0f / 7, 1.0f / 7};
+    std::fill(sum.begin(), sum.end(), 0.0f);
+    for (int o = 0; o < OCTAVES; o++) {
+      int size = cellSize(o);
+      int64_t cellRow = static_cast<int64_t>(y / size);
+      if (cellRow != latticeRow[o]) {
+        if (cellRow == latticeRow[o] + 1) {
+          top[o].swap(bottom[o]);
+        } else {
+          latticeValues(top[o], o, cellRow);
+        }
+        latticeValues(bottom[o], o, cellRow + 1);
+        latticeRow[o] = cellRow;
+      }
+      float ty = weights[o][y % size];
+      for (int i = 0; i < cells[o] * Channels; i++) {
+        columns[i] = amplitudes[o] * (top[o][i] + (bottom[o][i] - top[o][i]) * ty);
+      }
+      const float* tx = weights[o].data();
+      for (int c = 0; c < Channels; c++) {
+        float* out = &sum[static_cast<size_t>(c) * width];
+        for (int x0 = 0; x0 < width; x0 += size) {
+          float base = columns[(x0 / size) * Channels + c];
+          float slope = columns[(x0 / size + 1) * Channels + c] - base;
+          int span = width - x0 < size ? width - x0 : size;
+          for (int i = 0; i < span; i++) {
+            out[x0 + i] += base + slope * tx[i];
+          }
+        }
+      }
+    }
+    const float maxValue = static_cast<float>((1 << Bits) - 1);
+    for (int x = 0; x < width; x++) {
+      for (int c = 0; c < Channels; c++) {
+        samples[x * Channels + c] = static_cast<T>(sum[static_cast<size_t>(c) * width + x] * maxValue + 0.5f);
+      }
+    }
+  }
+};
+
+template <typename T, int Channels, int Bits>
+struct checkerRows {
+  /**
+ * @brief Squares of SIZE pixels in two colors of the frame, scrolling diagonally by 4 pixels every frame.
+ */
+  static const int SIZE = 64;
+  T colors[2][Channels];
+  uint64_t offset;
+
+  checkerRows(int width, uint64_t key, uint64_t index, int entropy) : offset(index * 4) {
+    for (int c = 0; c < Channels; c++) {
+      uint64_t h = latticeHash(key, index, 1, 0, c);
+      colors[0][c] = static_cast<T>(h & ((1u << Bits) - 1));
+      colors[1][c] = static_cast<T>((h >> 32) & ((1u << Bits) - 1));
+    }
+  }
+
+  void row(T* samples, int width, uint64_t y) {
+    uint64_t rowParity = ((y + offset) / SIZE) & 1;
+    for (int x = 0; x < width; x++) {
+      const T* color = colors[(((x + offset) / SIZE) & 1) ^ rowParity];
+      for (int c = 0; c < Channels; c++) {
+        samples[x * Channels + c] = color[c];
+      }
+    }
+  }
+};
+
+template <typename T, int Channels, int Bits>
+struct mixedRows {
+  /**
+ * @brief Tiles of SIZE pixels, each one either noise (the bytes of PATTERN_NOISE at that place) or a flat color.
+ *
+ * The share of noise tiles, entropy percent, sets how well the frames compress.
+ */
+  static const int SIZE = 64;
+  uint64_t key;
+  uint64_t index;
+  uint64_t entropy;
+  size_t rowBytes;
+
+  mixedRows(int width, uint64_t key, uint64_t index, int entropy)
+      : key(key), index(index), entropy(entropy), rowBytes(static_cast<size_t>(width) * Channels * sizeof(T)) {}
+
+  void row(T* samples, int width, uint64_t y) {
+    for (int x = 0; x < width; x += SIZE) {
+      int span = width - x < SIZE ? width - x : SIZE;
+      uint64_t h = latticeHash(key, index, 2 + x / SIZE, y / SIZE, 0);
+      if (h % 100 < entropy) {
+        size_t pixelBytes = Channels * sizeof(T);
+        randomFill::fillRandomBytes(samples + x * Channels, span * pixelBytes, key, index, y * rowBytes + x * pixelBytes);
+        continue;
+      }
+      T color[Channels];
+      for (int c = 0; c < Channels; c++) {
+        color[c] = static_cast<T>((h >> (8 + 14 * c)) & ((1u << Bits) - 1));
+      }
+      for (int i = x; i < x + span; i++) {
+        for (int c = 0; c < Channels; c++) {
+          samples[i * Channels + c] = color[c];
+        }
+      }
+    }
+  }
+};
+
+template <typename T, int Channels, int Bits, template <typename, int, int> class Rows>
+inline void fillPattern(cv::Mat& image, uint64_t seed, uint64_t index, uint64_t firstRow, int entropy) {
+  /**
+ * @brief Fills an image row by row with a pattern, then fixes up the rows like fillPixels().
+ *
+ * @param firstRow Row of the frame the first row of image is, image holds a stripe of a taller frame.
+ * @param entropy Percent of noise tiles of PATTERN_MIXED.
+ */
+  const bool needsFixup = Channels == 4 || Bits < static_cast<int>(sizeof(T) * 8);
+  Rows<T, Channels, Bits> rows(image.cols, splitMix64(seed), index, entropy);
+  for (int row = 0; row < image.rows; row++) {
+    rows.row(image.ptr<T>(row), image.cols, firstRow + row);
+    if (needsFixup) {
+      fixupPixels<T, Channels, Bits>(image.ptr<T>(row), image.cols);
+    }
+  }
+}
+
+template <typename T, int Channels, int Bits>
+inline frameFiller fillerOfPattern(contentPattern pattern) {
+  switch (pattern) {
+  case PATTERN_NOISE:
+    return fillPixels<T, Channels, Bits>;
+  case PATTERN_GRADIENT:
+    return fillPattern<T, Channels, Bits, gradientRows>;
+  case PATTERN_GAUSSIAN:
+    return fillPattern<T, Channels, Bits, gaussianRows>;
+  case PATTERN_VALUE_NOISE:
+    return fillPattern<T, Channels, Bits, valueNoiseRows>;
+  case PATTERN_CHECKER:
+    return fillPattern<T, Channels, Bits, checkerRows>;
+  case PATTERN_MIXED:
+    return fillPattern<T, Channels, Bits, mixedRows>;
+  case PATTERN_COUNT:
+    break;
+  }
+  return nullptr;
+}
+
+template <typename T, int Bits>
+inline frameFiller fillerOfChannels(int channels, contentPattern pattern) {
+  switch (channels) {
+  case 1:
+    return fillerOfPattern<T, 1, Bits>(pattern);
+  case 3:
+    return fillerOfPattern<T, 3, Bits>(pattern);
+  case 4:
+    return fillerOfPattern<T, 4, Bits>(pattern);
+  }
+  return nullptr;
+}
+
+inline frameFiller fillerOf(int type, int bits, contentPattern pattern = PATTERN_NOISE) {
+  /**
+ * @brief Fill kernel of a pattern for an OpenCV type (8-bit or 16-bit, 1, 3 or 4 channels) with bits
+ * significant bits per sample.
+ *
+ * @return frameFiller nullptr if the combination is not supported.
+ */
+  int channels = CV_MAT_CN(type);
+  switch (CV_MAT_DEPTH(type)) {
+  case CV_8U:
+    return bits == 8 ? fillerOfChannels<uint8_t, 8>(channels, pattern) : nullptr;
+  case CV_16U:
+    switch (bits) {
+    case 10:
+      return fillerOfChannels<uint16_t, 10>(channels, pattern);
+    case 12:
+      return fillerOfChannels<uint16_t, 12>(channels, pattern);
+    case 16:
+      return fillerOfChannels<uint16_t, 16>(channels, pattern);
+    }
+    return nullptr;
+  }
+  return nullptr;
+}
+
+inline void generateRandomImage(cv::Mat& randomImage, uint64_t seed, uint64_t index, int bits = 0,
+                                contentPattern pattern = PATTERN_NOISE, int entropy = DEFAULT_ENTROPY) {
+  /**
+ * @brief Fills an image with random colors.
+ *
+ * The image is an already allocated buffer, usually taken from framePool, of any type supported by
+ * fillerOf(). The generator threads call the kernel picked once for the run, this function picks it for
+ * every call and is meant for the other callers (verify, benchmarks).
+ *
+ * @param randomImage The image to fill, its dimensions are kept.
+ * @param seed The seed of the run.
+ * @param index The frame number.
+ * @param bits Significant bits per sample, 0 uses the whole sample.
+ * @param pattern Content of the image.
+ * @param entropy Percent of noise tiles of PATTERN_MIXED.
+ */
+  if (randomImage.empty()) {
+    std::cerr << "Error: Image dimensions must be positive." << std::endl;
+    return;
+  }
+  frameFiller filler = fillerOf(randomImage.type(), bits > 0 ? bits : static_cast<int>(randomImage.elemSize1() * 8), pattern);
+  if (filler == nullptr) {
+    std::cerr << "Error: Unsupported image type." << std::endl;
+    return;
+  }
+  filler(randomImage, seed, index, 0, entropy);
+}
+
+#endif // random_image_h
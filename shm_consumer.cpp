@@ -0,0 +1,111 @@
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <string>
+#include <opencv2/core.hpp>
+#include "shm_ring.hpp"
+#include "random_image.hpp"
+
+/**
+ * @file shm_consumer.cpp
+ * @brief Example reader of the shared memory ring written by random_image_generator with --output shm.
+ *
+ * Reads the frames in place and prints the rate, the frames lost to the overwrite policy and the
+ * frames torn by an overwrite while they were read. With --verify every frame is regenerated from the
+ * seed stored in the ring and compared with the shared pixels.
+ *
+ * Usage: ./shm_consumer [shm_name] [seconds] [--verify]
+ * - shm_name: shared memory object given to --shm-name (default is /rig_frames)
+ * - seconds: how long to read, 0 reads until the generator closes the ring (default is 0)
+ */
+
+int main(int argc, char **argv) {
+  std::string name = "/rig_frames";
+  int seconds = 0;
+  bool isVerify = false;
+  int positional = 0;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--verify") == 0) {
+      isVerify = true;
+    } else if (positional++ == 0) {
+      name = argv[i];
+    } else {
+      seconds = std::stoi(argv[i]);
+    }
+  }
+
+  // The generator may not have created the ring yet
+  ShmRingReader* reader = nullptr;
+  for (int attempt = 0; attempt < 50; attempt++) {
+    reader = new ShmRingReader(name);
+    if (reader -> isOpen()) {
+      break;
+    }
+    delete reader;
+    reader = nullptr;
+    usleep(100000);
+  }
+  if (reader == nullptr) {
+    std::cout << "Could not open the shared memory ring " << name << " (missing, or every reader entry is taken).\n";
+    return 1;
+  }
+  const shmRingHeader& info = reader -> info();
+  std::cout << "Reading " << name << ": " << info.width << "x" << info.height << " frames ("
+            << CV_MAT_CN(info.type) << " channels, " << info.bits << "-bit), " << info.slots << " slots, "
+            << (info.policy == SHM_BLOCK ? "block" : "overwrite") << " policy, seed " << info.seed << ", "
+            << (info.pattern < PATTERN_COUNT ? PATTERN_NAMES[info.pattern] : "unknown") << " pattern" << std::endl;
+  if (isVerify && info.pattern >= PATTERN_COUNT) {
+    std::cout << "Unknown pattern " << info.pattern << ", the frames can't be verified.\n";
+    return 1;
+  }
+
+  cv::Mat expected(info.height, info.width, info.type);
+  uint64_t frames = 0;
+  uint64_t torn = 0;
+  uint64_t mismatched = 0;
+  uint64_t lastFrames = 0;
+  auto start = std::chrono::steady_clock::now();
+  auto nextReport = start + std::chrono::seconds(1);
+  while (true) {
+    auto now = std::chrono::steady_clock::now();
+    if (seconds > 0 && now - start >= std::chrono::seconds(seconds)) {
+      break;
+    }
+    if (now >= nextReport) {
+      std::cout << "→ FPS: " << frames - lastFrames << " | Frames: " << frames << " | Lost: " << reader -> lost()
+                << " | Torn: " << torn << (isVerify ? " | Mismatched: " + std::to_string(mismatched) : "") << std::endl;
+      lastFrames = frames;
+      nextReport += std::chrono::seconds(1);
+    }
+    const shmFrame* frame = reader -> next(100);
+    if (frame == nullptr) {
+      if (reader -> isClosed()) {
+        break;
+      }
+      continue;
+    }
+    bool matches = true;
+    if (isVerify) {
+      generateRandomImage(expected, info.seed, frame -> frame, info.bits, static_cast<contentPattern>(info.pattern), static_cast<int>(info.entropy));
+      matches = std::memcmp(expected.data, frame -> data, frame -> bytes) == 0;
+    }
+    if (!reader -> release()) {
+      torn++; // Overwritten while it was read, the comparison means nothing
+    } else if (!matches) {
+      mismatched++;
+    }
+    frames++;
+  }
+
+  double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  std::cout << "\n--- SUMMARY ---\n"
+            << "→ Frames read: " << frames << "\n"
+            << "→ Frames lost: " << reader -> lost() << "\n"
+            << "→ Frames torn: " << torn << "\n";
+  if (isVerify) {
+    std::cout << "→ Frames mismatched: " << mismatched << "\n";
+  }
+  std::cout << "→ Average FPS: " << frames / elapsed << "\n";
+  delete reader;
+  return mismatched == 0 ? 0 : 1;
+}
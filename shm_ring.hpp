@@ -0,0 +1,472 @@
+#ifndef shm_ring_h
+#define shm_ring_h
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <new>
+#include <sched.h>
+#include <signal.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * @file shm_ring.hpp
+ * @brief Ring of frame slots in POSIX shared memory, written in place by the generator and read in
+ * place by other processes on the same host.
+ *
+ * This header is also the client library: it only needs the C++ standard library and Linux, a
+ * consumer includes it and uses ShmRingReader, nothing else of the generator.
+ *
+ * Layout of the shared object: an shmRingHeader, the shmReaderEntry table and one shmSlotHeader per
+ * slot, then the page aligned slots. Frame sequence s lives in slot s % slots. The stamp of a slot says
+ * which sequence it holds and whether it is complete (s + 1) or being written (s | SHM_WRITING), like a
+ * seqlock, so a reader can tell a frame that is not there yet from one that was overwritten.
+ * Waiting is done with futexes on shared counters, only when somebody is actually sleeping.
+ *
+ * With SHM_OVERWRITE the writer never waits, a reader that falls behind by more than the ring loses
+ * the oldest frames. With SHM_BLOCK the writer waits for the slowest registered reader, readers that
+ * died without unregistering are dropped.
+ */
+
+enum shmRingPolicy {
+  /**
+ * @brief What the writer does when the oldest slot has not been read by every reader.
+ */
+  SHM_OVERWRITE, // Reuse it, slow readers lose frames
+  SHM_BLOCK      // Wait for the slowest reader
+};
+
+const uint32_t SHM_RING_MAGIC = 0x52494752; // "RIGR"
+const uint32_t SHM_RING_VERSION = 2;
+const int SHM_MAX_READERS = 16;
+const uint64_t SHM_WRITING = 1ULL << 63; // Stamp bit of a slot being written
+
+struct alignas(64) shmRingHeader {
+  /**
+ * @brief Geometry and shared state at the start of the object. magic is written last by the writer.
+ */
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint32_t width;
+  uint32_t height;
+  int32_t type;        // OpenCV type of the pixels (16 is CV_8UC3, BGR)
+  uint32_t slots;
+  uint32_t policy;     // shmRingPolicy
+  uint32_t bits;       // Significant bits per sample, 10 and 12-bit samples are stored in 16 bits
+  uint64_t frameBytes;
+  uint64_t slotStride; // Bytes between two slots, a whole number of pages
+  uint64_t dataOffset; // Offset of slot 0
+  uint64_t seed;       // Frame N of the generator only depends on (seed, N)
+  uint32_t pattern;    // contentPattern of random_image.hpp, 0 is uniform noise
+  uint32_t entropy;    // Percent of noise tiles of the mixed pattern
+  alignas(64) std::atomic<uint64_t> published; // Highest published sequence + 1
+  std::atomic<uint32_t> publishSignal;  // Futex word, bumped at every publish
+  std::atomic<uint32_t> sleepingReaders;
+  alignas(64) std::atomic<uint32_t> consumeSignal; // Futex word, bumped when a reader releases with SHM_BLOCK
+  std::atomic<uint32_t> sleepingWriters;
+  std::atomic<uint32_t> closed; // The writer is done, no frame is published any more
+};
+
+struct alignas(64) shmReaderEntry {
+  /**
+ * @brief A registered reader: its process and the next sequence it will read.
+ */
+  std::atomic<int32_t> pid; // 0 if the entry is free
+  std::atomic<uint64_t> position;
+};
+
+struct alignas(64) shmSlotHeader {
+  /**
+ * @brief What a slot holds.
+ */
+  std::atomic<uint64_t> stamp; // 0 never written, s + 1 complete, s | SHM_WRITING being written
+  uint64_t frame;              // Frame number of the generator
+  uint64_t timestamp;          // CLOCK_MONOTONIC nanoseconds of the publish
+};
+
+struct shmFrame {
+  /**
+ * @brief A frame handed to a reader, valid until release().
+ */
+  const unsigned char* data;
+  uint64_t sequence; // Position in the ring, consecutive for every published frame
+  uint64_t frame;
+  uint64_t timestamp;
+  uint32_t width;
+  uint32_t height;
+  int32_t type;
+  uint64_t bytes;
+};
+
+namespace shmRing {
+
+inline size_t metadataBytes(uint32_t slots) {
+  return sizeof(shmRingHeader) + SHM_MAX_READERS * sizeof(shmReaderEntry) + slots * sizeof(shmSlotHeader);
+}
+
+inline size_t pageRound(size_t bytes) {
+  size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+  return (bytes + page - 1) / page * page;
+}
+
+inline shmReaderEntry* readers(shmRingHeader* header) {
+  return reinterpret_cast<shmReaderEntry*>(reinterpret_cast<char*>(header) + sizeof(shmRingHeader));
+}
+
+inline shmSlotHeader* slotHeaders(shmRingHeader* header) {
+  return reinterpret_cast<shmSlotHeader*>(reinterpret_cast<char*>(readers(header)) + SHM_MAX_READERS * sizeof(shmReaderEntry));
+}
+
+inline void futexWait(std::atomic<uint32_t>& word, uint32_t expected, long timeoutNs) {
+  /**
+ * @brief Sleeps while word == expected, for at most timeoutNs. Shared (not private) futex, the
+ * word is in memory mapped by several processes.
+ */
+  timespec timeout = {timeoutNs / 1000000000L, timeoutNs % 1000000000L};
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+inline void futexWakeAll(std::atomic<uint32_t>& word) {
+  syscall(SYS_futex, reinterpret_cast<uint32_t*>(&word), FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+}
+
+inline uint64_t monotonicNs() {
+  timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return static_cast<uint64_t>(now.tv_sec) * 1000000000ULL + now.tv_nsec;
+}
+
+} // namespace shmRing
+
+class ShmRingWriter {
+  /**
+ * @brief Creates the ring and publishes frames into it. Several threads of the writing process can
+ * claim, fill and publish slots at the same time.
+ */
+public:
+  ShmRingWriter(const std::string& name, uint32_t width, uint32_t height, int32_t type, uint32_t bits,
+                size_t frameBytes, uint32_t slots, shmRingPolicy policy, uint64_t seed, uint32_t pattern = 0,
+                uint32_t entropy = 0)
+      : name(name), slots(slots ? slots : 1) {
+    shm_unlink(name.c_str()); // Leftover of a previous run
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+      return;
+    }
+    size_t dataOffset = shmRing::pageRound(shmRing::metadataBytes(this -> slots));
+    size_t stride = shmRing::pageRound(frameBytes);
+    mappedBytes = dataOffset + stride * this -> slots;
+    void* address = MAP_FAILED;
+    if (ftruncate(fd, mappedBytes) == 0) {
+      address = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (address == MAP_FAILED) {
+      shm_unlink(name.c_str());
+      return;
+    }
+    // ftruncate zero-filled the object, every counter, stamp and reader entry starts at 0
+    header = new (address) shmRingHeader();
+    header -> version = SHM_RING_VERSION;
+    header -> width = width;
+    header -> height = height;
+    header -> type = type;
+    header -> bits = bits;
+    header -> slots = this -> slots;
+    header -> policy = policy;
+    header -> frameBytes = frameBytes;
+    header -> slotStride = stride;
+    header -> dataOffset = dataOffset;
+    header -> seed = seed;
+    header -> pattern = pattern;
+    header -> entropy = entropy;
+    header -> magic.store(SHM_RING_MAGIC, std::memory_order_release);
+  }
+
+  ~ShmRingWriter() {
+    if (header) {
+      close();
+      munmap(header, mappedBytes);
+      shm_unlink(name.c_str());
+    }
+  }
+
+  ShmRingWriter(const ShmRingWriter&) = delete;
+  ShmRingWriter& operator=(const ShmRingWriter&) = delete;
+
+  bool isOpen() const { return header != nullptr; }
+
+  int64_t claim(uint64_t& overwritten) {
+    /**
+ * @brief Takes the slot of the next sequence, waiting for the readers with SHM_BLOCK.
+ *
+ * @param overwritten Receives 1 if the slot held a frame that a registered reader had not read yet
+ * (SHM_OVERWRITE), that reader will lose it.
+ * @return int64_t The sequence to fill and publish, -1 if stop() was called while waiting.
+ */
+    overwritten = 0;
+    uint64_t sequence = nextSequence.fetch_add(1, std::memory_order_relaxed);
+    if (header -> policy == SHM_BLOCK) {
+      while (sequence >= slowestReader(sequence) + slots) {
+        uint32_t signal = header -> consumeSignal.load(std::memory_order_acquire);
+        if (isStopping.load(std::memory_order_acquire)) {
+          return -1;
+        }
+        if (sequence < slowestReader(sequence) + slots) {
+          break;
+        }
+        header -> sleepingWriters.fetch_add(1, std::memory_order_acq_rel);
+        shmRing::futexWait(header -> consumeSignal, signal, 50000000L); // Wakes up to notice dead readers
+        header -> sleepingWriters.fetch_sub(1, std::memory_order_acq_rel);
+      }
+    } else if (sequence >= slots && slowestReader(sequence) <= sequence - slots) {
+      overwritten = 1;
+    }
+    // The previous frame of this slot may still be written by another thread
+    shmSlotHeader& slot = shmRing::slotHeaders(header)[sequence % slots];
+    while (sequence >= slots && slot.stamp.load(std::memory_order_acquire) != sequence - slots + 1) {
+      if (isStopping.load(std::memory_order_acquire)) {
+        return -1; // That frame was given up, it will never be published
+      }
+      sched_yield();
+    }
+    slot.stamp.store(sequence | SHM_WRITING, std::memory_order_release);
+    return static_cast<int64_t>(sequence);
+  }
+
+  unsigned char* slotData(uint64_t sequence) {
+    /**
+ * @brief Pixels of the slot of a claimed sequence, frameBytes long.
+ */
+    return reinterpret_cast<unsigned char*>(header) + header -> dataOffset + (sequence % slots) * header -> slotStride;
+  }
+
+  void publish(uint64_t sequence, uint64_t frame) {
+    /**
+ * @brief Makes a filled slot visible to the readers and wakes the sleeping ones.
+ */
+    shmSlotHeader& slot = shmRing::slotHeaders(header)[sequence % slots];
+    slot.frame = frame;
+    slot.timestamp = shmRing::monotonicNs();
+    slot.stamp.store(sequence + 1, std::memory_order_release);
+    uint64_t published = header -> published.load(std::memory_order_relaxed);
+    while (published < sequence + 1 && !header -> published.compare_exchange_weak(published, sequence + 1, std::memory_order_acq_rel)) {
+    }
+    header -> publishSignal.fetch_add(1, std::memory_order_acq_rel);
+    if (header -> sleepingReaders.load(std::memory_order_acquire) > 0) {
+      shmRing::futexWakeAll(header -> publishSignal);
+    }
+  }
+
+  void stop() {
+    /**
+ * @brief Makes the threads waiting in claim() give up.
+ */
+    isStopping.store(true, std::memory_order_release);
+    header -> consumeSignal.fetch_add(1, std::memory_order_acq_rel);
+    shmRing::futexWakeAll(header -> consumeSignal);
+  }
+
+  void close() {
+    /**
+ * @brief Tells the readers that nothing else will be published.
+ */
+    header -> closed.store(1, std::memory_order_release);
+    header -> publishSignal.fetch_add(1, std::memory_order_acq_rel);
+    shmRing::futexWakeAll(header -> publishSignal);
+  }
+
+  size_t readerCount() const {
+    size_t count = 0;
+    for (int i = 0; i < SHM_MAX_READERS; i++) {
+      count += shmRing::readers(header)[i].pid.load(std::memory_order_relaxed) != 0;
+    }
+    return count;
+  }
+
+  uint32_t slotCount() const { return slots; }
+
+private:
+  uint64_t slowestReader(uint64_t sequence) {
+    /**
+ * @brief Lowest position of the live readers, sequence if there is none. Entries of dead processes are freed.
+ */
+    uint64_t slowest = sequence;
+    shmReaderEntry* entries = shmRing::readers(header);
+    for (int i = 0; i < SHM_MAX_READERS; i++) {
+      int32_t pid = entries[i].pid.load(std::memory_order_acquire);
+      if (pid == 0) {
+        continue;
+      }
+      if (kill(pid, 0) != 0 && errno == ESRCH) {
+        entries[i].pid.compare_exchange_strong(pid, 0, std::memory_order_acq_rel);
+        continue;
+      }
+      slowest = std::min(slowest, entries[i].position.load(std::memory_order_acquire));
+    }
+    return slowest;
+  }
+
+  std::string name;
+  uint32_t slots;
+  shmRingHeader* header = nullptr;
+  size_t mappedBytes = 0;
+  std::atomic<uint64_t> nextSequence{0};
+  std::atomic<bool> isStopping{false};
+};
+
+class ShmRingReader {
+  /**
+ * @brief Client side: maps an existing ring, registers as a reader and reads frames in place.
+ *
+ * Usage:
+ *   ShmRingReader reader("/rig_frames");
+ *   while (const shmFrame* frame = reader.next(1000)) {
+ *     ... use frame -> data ...
+ *     if (!reader.release()) { the frame was overwritten while it was read }
+ *   }
+ */
+public:
+  explicit ShmRingReader(const std::string& name) {
+    int fd = shm_open(name.c_str(), O_RDWR, 0);
+    if (fd < 0) {
+      return;
+    }
+    struct stat info;
+    void* address = MAP_FAILED;
+    if (fstat(fd, &info) == 0 && static_cast<size_t>(info.st_size) >= sizeof(shmRingHeader)) {
+      mappedBytes = info.st_size;
+      address = mmap(nullptr, mappedBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    ::close(fd);
+    if (address == MAP_FAILED) {
+      return;
+    }
+    header = static_cast<shmRingHeader*>(address);
+    if (header -> magic.load(std::memory_order_acquire) != SHM_RING_MAGIC || header -> version != SHM_RING_VERSION
+        || mappedBytes < header -> dataOffset + header -> slotStride * header -> slots) {
+      munmap(address, mappedBytes);
+      header = nullptr;
+      return;
+    }
+    // Start with the next frame to be published
+    position = header -> published.load(std::memory_order_acquire);
+    shmReaderEntry* entries = shmRing::readers(header);
+    for (int i = 0; i < SHM_MAX_READERS && entry == nullptr; i++) {
+      int32_t free = 0;
+      if (entries[i].pid.load(std::memory_order_relaxed) == 0) {
+        entries[i].position.store(position, std::memory_order_release);
+        if (entries[i].pid.compare_exchange_strong(free, getpid(), std::memory_order_acq_rel)) {
+          entry = &entries[i];
+        }
+      }
+    }
+  }
+
+  ~ShmRingReader() {
+    if (entry) {
+      entry -> pid.store(0, std::memory_order_release);
+      wakeWriters();
+    }
+    if (header) {
+      munmap(header, mappedBytes);
+    }
+  }
+
+  ShmRingReader(const ShmRingReader&) = delete;
+  ShmRingReader& operator=(const ShmRingReader&) = delete;
+
+  bool isOpen() const { return header != nullptr && entry != nullptr; }
+
+  const shmRingHeader& info() const { return *header; }
+
+  const shmFrame* next(int timeoutMs) {
+    /**
+ * @brief Waits for the next frame and returns it in place, valid until release().
+ *
+ * Frames overwritten before this reader got to them are skipped and counted in lost().
+ *
+ * @return const shmFrame* nullptr on timeout (isClosed() false), or when the writer closed the ring and
+ * every frame was read.
+ */
+    uint64_t deadline = shmRing::monotonicNs() + static_cast<uint64_t>(timeoutMs) * 1000000ULL;
+    while (true) {
+      uint32_t signal = header -> publishSignal.load(std::memory_order_acquire);
+      shmSlotHeader& slot = shmRing::slotHeaders(header)[position % header -> slots];
+      uint64_t stamp = slot.stamp.load(std::memory_order_acquire);
+      uint64_t held = stamp & SHM_WRITING ? stamp & ~SHM_WRITING : stamp - 1; // Sequence in the slot
+      if (stamp != 0 && held > position) {
+        // Lapped by the writer, go on from the oldest frame that is still complete
+        uint64_t published = header -> published.load(std::memory_order_acquire);
+        uint64_t oldest = published > header -> slots ? published - header -> slots + 1 : 0;
+        lostFrames += std::max(oldest, position + 1) - position;
+        position = std::max(oldest, position + 1);
+        entry -> position.store(position, std::memory_order_release);
+        continue;
+      }
+      if (stamp == position + 1) {
+        current = {reinterpret_cast<const unsigned char*>(header) + header -> dataOffset + (position % header -> slots) * header -> slotStride,
+                   position, slot.frame, slot.timestamp, header -> width, header -> height, header -> type, header -> frameBytes};
+        return &current;
+      }
+      if (header -> closed.load(std::memory_order_acquire)) {
+        return nullptr; // Every frame was published before the ring was closed, this one will never come
+      }
+      uint64_t now = shmRing::monotonicNs();
+      if (now >= deadline) {
+        return nullptr;
+      }
+      header -> sleepingReaders.fetch_add(1, std::memory_order_acq_rel);
+      shmRing::futexWait(header -> publishSignal, signal, static_cast<long>(std::min<uint64_t>(deadline - now, 100000000ULL)));
+      header -> sleepingReaders.fetch_sub(1, std::memory_order_acq_rel);
+    }
+  }
+
+  bool release() {
+    /**
+ * @brief Gives the current frame back to the writer.
+ *
+ * @return bool false if the writer overwrote the frame while it was read (only with SHM_OVERWRITE),
+ * the data that was read may be torn.
+ */
+    bool intact = shmRing::slotHeaders(header)[position % header -> slots].stamp.load(std::memory_order_acquire) == position + 1;
+    position++;
+    entry -> position.store(position, std::memory_order_release);
+    if (header -> policy == SHM_BLOCK) {
+      wakeWriters();
+    }
+    return intact;
+  }
+
+  uint64_t lost() const { return lostFrames; }
+
+  bool isClosed() const { return header -> closed.load(std::memory_order_acquire) != 0; }
+
+private:
+  void wakeWriters() {
+    header -> consumeSignal.fetch_add(1, std::memory_order_acq_rel);
+    if (header -> sleepingWriters.load(std::memory_order_acquire) > 0) {
+      shmRing::futexWakeAll(header -> consumeSignal);
+    }
+  }
+
+  shmRingHeader* header = nullptr;
+  size_t mappedBytes = 0;
+  shmReaderEntry* entry = nullptr;
+  uint64_t position = 0; // Next sequence to read
+  uint64_t lostFrames = 0;
+  shmFrame current;
+};
+
+#endif // shm_ring_h
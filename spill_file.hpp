@@ -0,0 +1,243 @@
+#ifndef spill_file_h
+#define spill_file_h
+
+#include <cerrno>
+#include <cstdint>
+#include <fcntl.h>
+#include <pthread.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+/**
+ * @file spill_file.hpp
+ * @brief Overflow tier of the frame queue: frames that find the queue full are written to a scratch file
+ * and read back when the savers catch up, so a short write stall costs latency instead of frames.
+ *
+ * The file is a ring of fixed size records, one frame each, written at the tail and read at the head,
+ * so both sides do large sequential I/O. Its space is allocated when it is created, so a full disk shows
+ * up at the start of the run and not halfway. The path is unlinked right after it is opened: the file
+ * never outlives the process, even after a crash.
+ */
+
+class SpillFile {
+  /**
+ * @brief FIFO of frames on disk. Several threads may push at the same time, one thread pops.
+ *
+ * A push claims the tail record under the lock and writes it outside of it; the record only becomes
+ * readable once its write finished, so the reader never sees a partial frame.
+ */
+public:
+  static const size_t ALIGNMENT = 4096; // Records start on a page
+
+  SpillFile(const std::string& path, size_t frameBytes, uint64_t capacityBytes)
+      : frameBytes(frameBytes), recordBytes((frameBytes + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT) {
+    records.resize(capacityBytes / recordBytes);
+    if (records.empty()) {
+      return;
+    }
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0) {
+      return;
+    }
+    unlink(path.c_str());
+    if (posix_fallocate(fd, 0, records.size() * recordBytes) != 0) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+  ~SpillFile() {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+    pthread_mutex_destroy(&mutex);
+    pthread_cond_destroy(&readable);
+  }
+
+  SpillFile(const SpillFile&) = delete;
+  SpillFile& operator=(const SpillFile&) = delete;
+
+  bool isOpen() const { return fd >= 0; }
+
+  bool push(const void* frame, uint64_t index, uint64_t queuedAt) {
+    /**
+ * @brief Appends a frame to the file.
+ *
+ * @param queuedAt When the frame was generated, given back by pop() so the queue wait includes the spill.
+ * @return bool false if the file is full, closed or the write failed; the frame was not taken.
+ */
+    pthread_mutex_lock(&mutex);
+    if (isClosed || tail - head == records.size()) {
+      pthread_mutex_unlock(&mutex);
+      return false;
+    }
+    uint64_t sequence = tail++;
+    pthread_mutex_unlock(&mutex);
+
+    record& entry = records[sequence % records.size()];
+    entry.index = index;
+    entry.queuedAt = queuedAt;
+    bool isWritten = writeAt(frame, (sequence % records.size()) * recordBytes);
+    pthread_mutex_lock(&mutex);
+    entry.isFailed = !isWritten;
+    entry.isReady = true;
+    if (isWritten) {
+      spilledFrames++;
+    } else {
+      failedWrites++;
+    }
+    pthread_cond_signal(&readable);
+    pthread_mutex_unlock(&mutex);
+    return isWritten;
+  }
+
+  bool pop(void* frame, uint64_t& index, uint64_t& queuedAt) {
+    /**
+ * @brief Reads the oldest frame into frame, sleeping until there is one.
+ *
+ * Records whose write failed are skipped.
+ *
+ * @return bool false once the file is closed.
+ */
+    while (true) {
+      pthread_mutex_lock(&mutex);
+      while (!isClosed && (head == tail || !records[head % records.size()].isReady)) {
+        pthread_cond_wait(&readable, &mutex);
+      }
+      if (isClosed) {
+        pthread_mutex_unlock(&mutex);
+        return false;
+      }
+      uint64_t sequence = head;
+      record& entry = records[sequence % records.size()];
+      pthread_mutex_unlock(&mutex);
+
+      // Only this thread reads and the record is not reused before head moves, no lock needed
+      bool isRead = !entry.isFailed && readAt(frame, (sequence % records.size()) * recordBytes);
+      index = entry.index;
+      queuedAt = entry.queuedAt;
+      pthread_mutex_lock(&mutex);
+      entry.isReady = false;
+      head++;
+      if (!isRead && !entry.isFailed) {
+        failedReads++;
+      }
+      pthread_mutex_unlock(&mutex);
+      if (isRead) {
+        return true;
+      }
+    }
+  }
+
+  void close() {
+    /**
+ * @brief Wakes up the reader and makes every later push() and pop() fail, the frames left are given up.
+ */
+    pthread_mutex_lock(&mutex);
+    isClosed = true;
+    pthread_cond_broadcast(&readable);
+    pthread_mutex_unlock(&mutex);
+  }
+
+  size_t size() {
+    /**
+ * @brief Number of frames in the file, including the ones being written.
+ */
+    pthread_mutex_lock(&mutex);
+    size_t frames = tail - head;
+    pthread_mutex_unlock(&mutex);
+    return frames;
+  }
+
+  size_t capacity() const { return records.size(); }
+
+  uint64_t spilled() {
+    /**
+ * @brief Frames written to the file so far.
+ */
+    pthread_mutex_lock(&mutex);
+    uint64_t frames = spilledFrames;
+    pthread_mutex_unlock(&mutex);
+    return frames;
+  }
+
+  uint64_t unreadable() {
+    /**
+ * @brief Frames taken by push() that pop() could not read back, they are lost.
+ */
+    pthread_mutex_lock(&mutex);
+    uint64_t frames = failedReads;
+    pthread_mutex_unlock(&mutex);
+    return frames;
+  }
+
+  uint64_t failed() {
+    /**
+ * @brief Frames of a failed write or read.
+ */
+    pthread_mutex_lock(&mutex);
+    uint64_t frames = failedWrites + failedReads;
+    pthread_mutex_unlock(&mutex);
+    return frames;
+  }
+
+private:
+  struct record {
+    uint64_t index;
+    uint64_t queuedAt;
+    bool isReady = false;  // Written (or failed), readable by pop()
+    bool isFailed = false;
+  };
+
+  bool writeAt(const void* data, uint64_t offset) {
+    const char* in = static_cast<const char*>(data);
+    size_t bytes = frameBytes;
+    while (bytes > 0) {
+      ssize_t n = ::pwrite(fd, in, bytes, offset);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      in += n;
+      bytes -= n;
+      offset += n;
+    }
+    return true;
+  }
+
+  bool readAt(void* data, uint64_t offset) {
+    char* out = static_cast<char*>(data);
+    size_t bytes = frameBytes;
+    while (bytes > 0) {
+      ssize_t n = ::pread(fd, out, bytes, offset);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      out += n;
+      bytes -= n;
+      offset += n;
+    }
+    return true;
+  }
+
+  int fd = -1;
+  size_t frameBytes;
+  size_t recordBytes;          // frameBytes rounded up to ALIGNMENT
+  std::vector<record> records; // Sequence s lives in record s % records.size()
+  uint64_t head = 0;           // Sequence of the oldest frame
+  uint64_t tail = 0;           // Sequence of the next push
+  bool isClosed = false;
+  uint64_t spilledFrames = 0;
+  uint64_t failedWrites = 0;
+  uint64_t failedReads = 0;
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_cond_t readable = PTHREAD_COND_INITIALIZER; // A record became ready or the file was closed
+};
+
+#endif // spill_file_h
@@ -0,0 +1,141 @@
+#ifndef stream_output_h
+#define stream_output_h
+
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <fcntl.h>
+#include <opencv2/core.hpp>
+#include <opencv2/imgproc.hpp>
+#include <string>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <vector>
+#include "direct_encoder.hpp"
+
+/**
+ * @file stream_output.hpp
+ * @brief Frames written in order to a single byte stream: stdout, a FIFO, a file or a Unix domain socket.
+ *
+ * The stream is either raw BGR or RGB pixels (ffmpeg -f rawvideo -pix_fmt bgr24 / rgb24, or the gray,
+ * bgra and 16-bit little endian equivalents) or YUV4MPEG2 4:2:0 (ffmpeg -f yuv4mpegpipe), which carries
+ * its own size and rate and needs 8-bit BGR frames. Several frames go out in one
+ * writev(), and the writes block while the reader is behind, so a slow reader slows the run down
+ * instead of losing frames.
+ */
+
+enum streamFormat {
+  /**
+ * @brief Encoding of the frames in the stream.
+ */
+  STREAM_Y4M, // YUV4MPEG2 header, then FRAME and the I420 planes of every frame
+  STREAM_BGR, // Raw pixels, the frame buffer as it is
+  STREAM_RGB  // Raw pixels with the color channels in RGB(A) order
+};
+
+class StreamOutput {
+  /**
+ * @brief Converts and writes batches of frames to the stream.
+ */
+public:
+  static const int PIPE_BYTES = 1 << 20; // Pipe buffer asked for, a whole batch can sit in it while the reader wakes up
+
+  StreamOutput(int fd, streamFormat format, int width, int height, double fps) : fd(fd), format(format) {
+    // Only works on pipes and FIFOs, and may be capped by /proc/sys/fs/pipe-max-size
+    fcntl(fd, F_SETPIPE_SZ, PIPE_BYTES);
+    if (format == STREAM_Y4M) {
+      // Integer rates are written as N:1, the others with a millisecond precision
+      std::string rate = std::floor(fps) == fps ? std::to_string(static_cast<long>(fps)) + ":1"
+                                                : std::to_string(std::lround(fps * 1000)) + ":1000";
+      header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) + " F" + rate + " Ip A1:1 C420jpeg\n";
+    }
+  }
+
+  ~StreamOutput() {
+    if (fd >= 0) {
+      ::close(fd);
+    }
+  }
+
+  StreamOutput(const StreamOutput&) = delete;
+  StreamOutput& operator=(const StreamOutput&) = delete;
+
+  static int openTarget(const std::string& target) {
+    /**
+ * @brief Opens the stream: "unix:PATH" connects to a listening Unix domain socket, anything else is a
+ * FIFO or a file path (created if needed). Opening a FIFO waits for its reader.
+ *
+ * @return int The file descriptor, -1 on error.
+ */
+    if (target.compare(0, 5, "unix:") == 0) {
+      sockaddr_un address = {};
+      address.sun_family = AF_UNIX;
+      if (target.size() - 5 >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+      }
+      std::strcpy(address.sun_path, target.c_str() + 5);
+      int socketFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+      if (socketFd >= 0 && connect(socketFd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        ::close(socketFd);
+        return -1;
+      }
+      return socketFd;
+    }
+    return ::open(target.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  }
+
+  bool isOpen() const { return fd >= 0; }
+
+  bool write(cv::Mat* frames[], size_t count) {
+    /**
+ * @brief Writes count frames, in the given order, with a single gather write.
+ *
+ * The frame buffers belong to the caller until they are released, so RGB is swapped in place.
+ *
+ * @return bool false if the stream failed, errno is EPIPE when the reader went away.
+ */
+    static const char FRAME_HEADER[] = "FRAME\n";
+    parts.clear();
+    if (!isHeaderWritten) {
+      if (!header.empty()) {
+        parts.push_back({const_cast<char*>(header.data()), header.size()});
+      }
+      isHeaderWritten = true;
+    }
+    if (format == STREAM_Y4M && converted.size() < count) {
+      converted.resize(count);
+    }
+    for (size_t i = 0; i < count; i++) {
+      cv::Mat* frame = frames[i];
+      if (format == STREAM_Y4M) {
+        cv::cvtColor(*frame, converted[i], cv::COLOR_BGR2YUV_I420);
+        frame = &converted[i];
+        parts.push_back({const_cast<char*>(FRAME_HEADER), sizeof(FRAME_HEADER) - 1});
+      } else if (format == STREAM_RGB) {
+        directEncoder::reorderFrame(*frame, true, false); // BGR(A) to RGB(A) in place, gray frames are left as they are
+      }
+      size_t rowBytes = frame -> cols * frame -> elemSize();
+      if (frame -> isContinuous()) {
+        parts.push_back({frame -> data, rowBytes * frame -> rows});
+      } else {
+        for (int row = 0; row < frame -> rows; row++) {
+          parts.push_back({frame -> ptr(row), rowBytes});
+        }
+      }
+    }
+    return directEncoder::writevAll(fd, parts.data(), parts.size());
+  }
+
+private:
+  int fd;
+  streamFormat format;
+  std::string header; // Y4M stream header, written before the first frame
+  bool isHeaderWritten = false;
+  std::vector<cv::Mat> converted; // I420 planes of the frames of a batch, reused between batches
+  std::vector<iovec> parts;
+};
+
+#endif // stream_output_h
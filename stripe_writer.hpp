@@ -0,0 +1,238 @@
+#ifndef stripe_writer_h
+#define stripe_writer_h
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <opencv2/core.hpp>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "direct_encoder.hpp"
+
+/**
+ * @file stripe_writer.hpp
+ * @brief Writes one image that does not fit in memory, a stripe of rows at a time.
+ *
+ * The file is created at its final size and every stripe lands at an offset known from its first row, so
+ * several threads write their stripes with pwrite() at the same time, in any order, and only the stripes
+ * being written are in memory. The formats are:
+ * - raw: the rows back to back, like the .raw frames.
+ * - PPM: P5/P6 (8 or 16-bit), as written by direct_encoder.hpp.
+ * - TIFF: little-endian BigTIFF (no 4 GB limit) with uncompressed TILE_SIZE x TILE_SIZE tiles, so viewers
+ *   can read any region without going through the whole file. Stripes start on a tile row.
+ */
+
+enum stripeFormat {
+  /**
+ * @brief File format of the image.
+ */
+  STRIPE_RAW,
+  STRIPE_PPM,
+  STRIPE_TIFF
+};
+
+class StripeWriter {
+  /**
+ * @brief Creates the file and writes the stripes into it, write() can be called from several threads.
+ */
+public:
+  static const int TILE_SIZE = 256; // Width and height of the TIFF tiles
+  static const size_t DATA_ALIGNMENT = 4096; // TIFF tiles start on a page
+
+  StripeWriter(const std::string& path, stripeFormat format, int width, int height, int type, int bits)
+      : format(format), width(width), height(height) {
+    rowBytes = static_cast<uint64_t>(width) * CV_ELEM_SIZE(type);
+    if (format == STRIPE_PPM) {
+      layout = directEncoder::layoutOf(directEncoder::FORMAT_PPM, width, height, type, bits);
+      if (layout.format == directEncoder::FORMAT_NONE) {
+        return; // PPM has no alpha
+      }
+      header = layout.header;
+      dataOffset = header.size();
+      fileBytes = dataOffset + rowBytes * height;
+    } else if (format == STRIPE_TIFF) {
+      layout = {directEncoder::FORMAT_TIFF, {}, rowBytes, 0, height, -1, false};
+      buildTiffHeader(type);
+    } else {
+      layout = {directEncoder::FORMAT_NONE, {}, rowBytes, 0, height, -1, false};
+      fileBytes = rowBytes * height;
+    }
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    // The whole file exists from the start (sparse until written), a stripe can go anywhere
+    if (fd >= 0 && (ftruncate(fd, fileBytes) != 0 || !writeAt(header.data(), header.size(), 0))) {
+      ::close(fd);
+      fd = -1;
+    }
+  }
+
+  ~StripeWriter() { close(); }
+
+  StripeWriter(const StripeWriter&) = delete;
+  StripeWriter& operator=(const StripeWriter&) = delete;
+
+  bool isOpen() const { return fd >= 0; }
+
+  int rowAlignment() const { return format == STRIPE_TIFF ? TILE_SIZE : 1; }
+
+  uint64_t size() const { return fileBytes; }
+
+  bool write(cv::Mat& stripe, int firstRow, std::vector<unsigned char>& scratch) {
+    /**
+ * @brief Writes the rows of stripe as rows [firstRow, firstRow + stripe.rows) of the image.
+ *
+ * The stripe is put in the channel and byte order of the format in place. TIFF stripes must start on
+ * a tile row; their tiles are assembled in scratch, a buffer owned by the calling thread.
+ *
+ * @return bool false if a write failed, errno tells why.
+ */
+    directEncoder::prepareFrame(layout, stripe);
+    if (format != STRIPE_TIFF) {
+      uint64_t offset = dataOffset + firstRow * rowBytes;
+      if (stripe.isContinuous()) {
+        return writeAt(stripe.data, rowBytes * stripe.rows, offset);
+      }
+      for (int row = 0; row < stripe.rows; row++) {
+        if (!writeAt(stripe.ptr(row), rowBytes, offset + row * rowBytes)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // A row of tiles is contiguous in the file: tile by tile, each one TILE_SIZE rows of its columns
+    const size_t tileRowBytes = static_cast<size_t>(TILE_SIZE) * (rowBytes / width);
+    for (int band = 0; band < stripe.rows; band += TILE_SIZE) {
+      int bandRows = std::min(TILE_SIZE, stripe.rows - band);
+      scratch.assign(tilesAcross * tileBytes, 0); // Edge tiles are padded with zeros
+      for (uint64_t tile = 0; tile < tilesAcross; tile++) {
+        size_t columnBytes = std::min<uint64_t>(tileRowBytes, rowBytes - tile * tileRowBytes);
+        unsigned char* out = scratch.data() + tile * tileBytes;
+        for (int row = 0; row < bandRows; row++) {
+          std::memcpy(out + row * tileRowBytes, stripe.ptr(band + row) + tile * tileRowBytes, columnBytes);
+        }
+      }
+      uint64_t tileRow = (firstRow + band) / TILE_SIZE;
+      if (!writeAt(scratch.data(), scratch.size(), dataOffset + tileRow * tilesAcross * tileBytes)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool close() {
+    /**
+ * @brief Closes the file.
+ *
+ * @return bool false if the close reported a delayed write error.
+ */
+    if (fd < 0) {
+      return true;
+    }
+    bool isClosed = ::close(fd) == 0;
+    fd = -1;
+    return isClosed;
+  }
+
+private:
+  static void put64(std::vector<unsigned char>& out, uint64_t value, int bytes) {
+    for (int i = 0; i < bytes; i++) {
+      out.push_back(static_cast<unsigned char>(value >> (8 * i)));
+    }
+  }
+
+  static void putEntry(std::vector<unsigned char>& out, uint16_t tag, uint16_t type, uint64_t count, uint64_t value) {
+    // BigTIFF entry: the 8 byte value field holds the values when they fit, left-justified, else their offset
+    put64(out, tag, 2);
+    put64(out, type, 2);
+    put64(out, count, 8);
+    put64(out, value, 8);
+  }
+
+  void buildTiffHeader(int type) {
+    /**
+ * @brief BigTIFF header, a single IFD, then the tile offsets and byte counts, then the tiles.
+ */
+    const int channels = CV_MAT_CN(type);
+    const uint64_t sampleBits = CV_ELEM_SIZE1(type) * 8;
+    tilesAcross = (width + TILE_SIZE - 1) / TILE_SIZE;
+    uint64_t tiles = tilesAcross * ((height + TILE_SIZE - 1) / TILE_SIZE);
+    tileBytes = static_cast<uint64_t>(TILE_SIZE) * TILE_SIZE * CV_ELEM_SIZE(type);
+    const uint64_t entries = channels == 4 ? 12 : 11;
+    const uint64_t arraysOffset = 16 + 8 + entries * 20 + 8;
+    const bool isInline = tiles == 1; // One LONG8 fits in the value field
+    const uint64_t arraysBytes = isInline ? 0 : 2 * 8 * tiles;
+    dataOffset = (arraysOffset + arraysBytes + DATA_ALIGNMENT - 1) / DATA_ALIGNMENT * DATA_ALIGNMENT;
+    fileBytes = dataOffset + tiles * tileBytes;
+
+    uint64_t bitsPerSample = 0; // Up to 4 SHORTs, always inline
+    for (int c = 0; c < channels; c++) {
+      bitsPerSample |= sampleBits << (16 * c);
+    }
+    std::vector<unsigned char>& h = header;
+    h.push_back('I');
+    h.push_back('I');
+    put64(h, 43, 2);                                    // BigTIFF
+    put64(h, 8, 2);                                     // Size of the offsets
+    put64(h, 0, 2);
+    put64(h, 16, 8);                                    // First IFD
+    put64(h, entries, 8);
+    putEntry(h, 256, 4, 1, width);                      // ImageWidth
+    putEntry(h, 257, 4, 1, height);                     // ImageLength
+    putEntry(h, 258, 3, channels, bitsPerSample);       // BitsPerSample
+    putEntry(h, 259, 3, 1, 1);                          // Compression: none
+    putEntry(h, 262, 3, 1, channels == 1 ? 1 : 2);      // PhotometricInterpretation: BlackIsZero or RGB
+    putEntry(h, 277, 3, 1, channels);                   // SamplesPerPixel
+    putEntry(h, 284, 3, 1, 1);                          // PlanarConfiguration: interleaved
+    putEntry(h, 322, 4, 1, TILE_SIZE);                  // TileWidth
+    putEntry(h, 323, 4, 1, TILE_SIZE);                  // TileLength
+    putEntry(h, 324, 16, tiles, isInline ? dataOffset : arraysOffset);              // TileOffsets
+    putEntry(h, 325, 16, tiles, isInline ? tileBytes : arraysOffset + 8 * tiles);   // TileByteCounts
+    if (channels == 4) {
+      putEntry(h, 338, 3, 1, 2);                        // ExtraSamples: unassociated alpha
+    }
+    put64(h, 0, 8);                                     // No next IFD
+    if (!isInline) {
+      for (uint64_t tile = 0; tile < tiles; tile++) {
+        put64(h, dataOffset + tile * tileBytes, 8);
+      }
+      for (uint64_t tile = 0; tile < tiles; tile++) {
+        put64(h, tileBytes, 8);
+      }
+    }
+    layout.swapCode = channels == 3 ? cv::COLOR_BGR2RGB : (channels == 4 ? cv::COLOR_BGRA2RGBA : -1);
+  }
+
+  bool writeAt(const void* data, size_t bytes, uint64_t offset) {
+    const char* in = static_cast<const char*>(data);
+    while (bytes > 0) {
+      ssize_t n = ::pwrite(fd, in, bytes, offset);
+      if (n < 0 && errno == EINTR) {
+        continue;
+      }
+      if (n <= 0) {
+        return false;
+      }
+      in += n;
+      bytes -= n;
+      offset += n;
+    }
+    return true;
+  }
+
+  int fd = -1;
+  stripeFormat format;
+  int width;
+  int height;
+  uint64_t rowBytes;
+  directEncoder::frameLayout layout; // Channel and byte order of the samples
+  std::vector<unsigned char> header;
+  uint64_t dataOffset = 0;  // Offset of the first row or tile
+  uint64_t fileBytes = 0;
+  uint64_t tilesAcross = 0; // TIFF only
+  uint64_t tileBytes = 0;
+};
+
+#endif // stripe_writer_h
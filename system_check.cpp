@@ -7,6 +7,15 @@
 #include <opencv2/highgui.hpp>
 #include <filesystem>
 #include <iomanip>
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <thread>
+#include <vector>
+#include "direct_encoder.hpp"
 #ifndef system_check_h
 #define system_check_h
 
@@ -16,11 +25,22 @@
 * @brief Checks system properties such as disk space, RAM, and WSL status.
 *
 * This program provides functions to check if the system is running in WSL,
-* check available disk space, available RAM, save images in various formats,
-* and calculate disk write speed for different image formats.
+* check available disk space, available RAM, measure the encoding cost of every image format,
+* and measure the sustained disk write throughput with 1 to N writer threads.
 
-* It also provides a function to choose the best image format based on disk write speed
-* and available disk space.
+* It also provides a function to choose the best image format, saver thread count and queue size
+* for a target frame rate, and writes them to a config file loaded by random_image_generator.
+*
+* Usage: ./system_check [--duration S] [--fps F] [--test-seconds S] [--max-threads N]
+*                       [--sync none|file|end] [--direct-io] [--dir DIR] [--config FILE]
+* - --duration S: planned run duration in seconds, used for the disk space check (default is 60)
+* - --fps F: frames per second the run must save (default is 50)
+* - --test-seconds S: duration of each sustained write test (default is 3)
+* - --max-threads N: largest writer thread count tested (default is the number of CPUs)
+* - --sync P: none (page cache), file (fsync after every file) or end (one sync when the test ends, default)
+* - --direct-io: write the test files with O_DIRECT, bypassing the page cache
+* - --dir DIR: directory of the test files (default is ./test)
+* - --config FILE: config file written for random_image_generator (default is ./system_check.conf)
 */
 
 
@@ -79,28 +99,28 @@ long long checkAvailableRam(){
     return freePhysMem; // Return free RAM in bytes
 }
 
-float saveMatToRaw(const cv::Mat& image, const std::string& filename) {
+enum syncMode {
     /**
-     * @brief Saves a cv::Mat image to a raw binary file.
-     * 
-     * This function opens a binary file for writing and writes the image data to it.
-     * The image is saved in raw format, which is not compressed and contains pixel data only.
-     * 
-     * @param image The cv::Mat image to be saved.
-     * @param filename The name of the file where the image will be saved.
-     * @return float The write speed in MB/s.
+     * @brief When the sustained write test flushes the data to the device.
      */
-    auto start = std::chrono::steady_clock::now();
-    // Open binary file for writing
-    std::ofstream file(filename, std::ios::out | std::ios::binary);
-
-    // write the image data to the file
-    file.write(reinterpret_cast<const char*>(image.data), image.total() * image.elemSize());
-    auto end = std::chrono::steady_clock::now();
-    auto elapsed_time = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-    file.close();
-    return static_cast<float>(elapsed_time); // MB/s
-}
+    SYNC_NONE, // Never, the page cache absorbs the writes
+    SYNC_FILE, // fsync() after every file
+    SYNC_END   // One syncfs() when the test ends, included in the measured time
+};
+
+struct checkOptions {
+    /**
+     * @brief Command line options of system_check.
+     */
+    int duration = 60;
+    int fps = 50;
+    double testSeconds = 3;
+    int maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    syncMode sync = SYNC_END;
+    bool isDirectIO = false;
+    std::string directory = "./test";
+    std::string configPath = "./system_check.conf";
+};
 
 long long getFileSize(const std::string& filePath) {
     /**
@@ -118,90 +138,299 @@ struct imageInfo {
     /**
      * @brief Structure to hold information about an image format.
      * 
-     * This structure contains the format of the image, the time taken to write it,
-     * and the size of the file in bytes.
+     * This structure contains the format of the image, the time taken to encode a frame
+     * in microseconds and the size of the encoded file in bytes.
      */
     std::string format;
-    float writing_time;
+    float encoding_time;
     long long file_size;
 };
-std::vector<imageInfo> calculateDiskWriteSpeed(int height, int width) {
+
+struct writeTestArgs {
+    /**
+     * @brief Holds the arguments and results of a writer thread of the sustained write test.
+     */
+    int id;
+    const checkOptions* options;
+    const unsigned char* data; // Page aligned, padded to a multiple of 4096 bytes for O_DIRECT
+    size_t bytes;
+    std::chrono::steady_clock::time_point deadline;
+    long long files;
+    bool failed;
+};
+
+void* writeTestLoop(void* args) {
+    /**
+     * @brief Writes frame sized files until the deadline, the way the raw saver threads do.
+     * 
+     * Every thread cycles through 8 file names of its own, so the test keeps allocating blocks
+     * without filling the disk. With O_DIRECT the padded buffer is written and the file trimmed.
+     * 
+     * @param args Pointer to the writeTestArgs of this thread.
+     * @return void*
+     */
+    writeTestArgs* test = static_cast<writeTestArgs*>(args);
+    size_t padded = (test -> bytes + 4095) / 4096 * 4096;
+    bool isDirect = test -> options -> isDirectIO;
+    while (std::chrono::steady_clock::now() < test -> deadline) {
+        std::string filename = test -> options -> directory + "/write_" + std::to_string(test -> id) + "_"
+                               + std::to_string(test -> files % 8) + ".bin";
+        int flags = O_WRONLY | O_CREAT | O_TRUNC;
+        int fd = isDirect ? open(filename.c_str(), flags | O_DIRECT, 0644) : -1;
+        if (fd < 0 && isDirect) {
+            std::cerr << "O_DIRECT not supported in " << test -> options -> directory << ", using buffered writes" << std::endl;
+            isDirect = false;
+        }
+        if (fd < 0) {
+            fd = open(filename.c_str(), flags, 0644);
+        }
+        if (fd < 0) {
+            test -> failed = true;
+            return NULL;
+        }
+        size_t length = isDirect ? padded : test -> bytes;
+        size_t written = 0;
+        while (written < length) {
+            ssize_t n = write(fd, test -> data + written, length - written);
+            if (n <= 0) {
+                test -> failed = true;
+                break;
+            }
+            written += n;
+        }
+        if (isDirect && ftruncate(fd, test -> bytes) != 0) {
+            test -> failed = true;
+        }
+        if (test -> options -> sync == SYNC_FILE && fsync(fd) != 0) {
+            test -> failed = true;
+        }
+        close(fd); // The file is only done once it is closed, the time includes it
+        if (test -> failed) {
+            return NULL;
+        }
+        test -> files++;
+    }
+    return NULL;
+}
+
+double sustainedWriteSpeed(const checkOptions& options, int threads, const unsigned char* data, size_t bytes) {
+    /**
+     * @brief Measures the write throughput of several threads writing frame sized files for options.testSeconds.
+     * 
+     * The measured time starts before the threads are created and ends after they are joined
+     * (and after the final sync with SYNC_END), so it covers every byte counted.
+     * 
+     * @param threads Number of writer threads.
+     * @param data Frame to write, page aligned and padded.
+     * @param bytes Size of the frame.
+     * @return double Throughput in MB/s, 0 if a write failed.
+     */
+    std::vector<pthread_t> writers(threads);
+    std::vector<writeTestArgs> tests(threads);
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::microseconds(static_cast<long long>(options.testSeconds * 1e6));
+    for (int i = 0; i < threads; i++) {
+        tests[i] = {i, &options, data, bytes, deadline, 0, false};
+        pthread_create(&writers[i], nullptr, writeTestLoop, &tests[i]);
+    }
+    long long files = 0;
+    bool failed = false;
+    for (int i = 0; i < threads; i++) {
+        pthread_join(writers[i], nullptr);
+        files += tests[i].files;
+        failed = failed || tests[i].failed;
+    }
+    if (options.sync == SYNC_END) {
+        int fd = open(options.directory.c_str(), O_RDONLY);
+        if (fd >= 0) {
+            syncfs(fd);
+            close(fd);
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    if (failed) {
+        std::cerr << "A write failed with " << threads << " threads" << std::endl;
+        return 0;
+    }
+    return files * static_cast<double>(bytes) / (1024 * 1024) / elapsed;
+}
+
+std::vector<std::pair<int, double>> measureWriteScaling(const checkOptions& options, int height, int width) {
     /**
-     * @brief Calculates the disk write speed for various image formats.
+     * @brief Runs the sustained write test with 1, 2, 4, ... up to options.maxThreads writer threads.
      * 
-     * This function creates a test image and saves it in different formats,
-     * measuring the time taken to write each format and the resulting file size.
+     * @return std::vector<std::pair<int, double>> Thread count and MB/s of every test.
+     */
+    std::cout << "Measuring sustained disk write speed (" << options.testSeconds << " s per test, sync: "
+              << (options.sync == SYNC_NONE ? "none" : (options.sync == SYNC_FILE ? "every file" : "at the end"))
+              << (options.isDirectIO ? ", O_DIRECT" : "") << ")..." << std::endl;
+    std::filesystem::create_directory(options.directory);
+
+    cv::Mat frame(height, width, CV_8UC3);
+    size_t bytes = frame.total() * frame.elemSize();
+    size_t padded = (bytes + 4095) / 4096 * 4096;
+    unsigned char* data = static_cast<unsigned char*>(std::aligned_alloc(4096, padded));
+    cv::randu(frame, cv::Scalar(0, 0, 0), cv::Scalar(255, 255, 255));
+    std::memcpy(data, frame.data, bytes);
+    std::memset(data + bytes, 0, padded - bytes);
+
+    std::vector<int> counts;
+    for (int threads = 1; threads < options.maxThreads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(options.maxThreads);
+
+    std::vector<std::pair<int, double>> scaling;
+    std::cout << "----------------------------------------" << std::endl;
+    std::cout << "Writer threads | Write speed (MB/s) | Frames per second" << std::endl;
+    std::cout << "----------------------------------------" << std::endl;
+    for (int threads : counts) {
+        double speed = sustainedWriteSpeed(options, threads, data, bytes);
+        scaling.push_back({threads, speed});
+        std::cout << std::fixed << std::setprecision(2) << threads << " | " << speed << " MB/s | "
+                  << speed * 1024 * 1024 / bytes << " fps" << std::endl;
+    }
+    std::cout << "----------------------------------------" << std::endl;
+    std::free(data);
+    for (const auto& entry : std::filesystem::directory_iterator(options.directory)) {
+        if (entry.path().filename().string().rfind("write_", 0) == 0) {
+            std::filesystem::remove(entry.path());
+        }
+    }
+    return scaling;
+}
+
+std::vector<imageInfo> measureEncoding(int height, int width) {
+    /**
+     * @brief Measures the encoding time and file size of a frame in every image format.
+     * 
+     * The frame is encoded in memory, the way the generator does before writing (built-in encoder
+     * for the uncompressed formats, cv::imencode otherwise), for about half a second per format.
+     * Disk speed is measured separately by measureWriteScaling().
      * 
      * @param height The height of the test image.
      * @param width The width of the test image.
      * @return std::vector<imageInfo> A vector containing information about each image format,
+     * sorted by encoding time.
      */
 
-    std::cout << "Calculating disk write speed for various image formats..." << std::endl;
+    std::cout << "Measuring the encoding time of every image format..." << std::endl;
 
-    std::filesystem::create_directory("./test");
-    
     cv::Mat test_image(height, width, CV_8UC3);
     cv::randu(test_image, cv::Scalar(0, 0, 0), cv::Scalar(255, 255, 255));
 
     std::vector<imageInfo> image_info;
-    image_info.reserve(13); // Reserve space for 12 formats
+    image_info.reserve(13); // Reserve space for 13 formats
 
     std::vector<std::string> formats = {
         ".bmp",".dib",".jpeg",".jpg",".jpe",".png",
         ".ppm",".sr",".ras",".tiff",".tif",".hdr", ".raw"
     };
 
-    for (int i = 0; i < formats.size();i++){
-        if (i<formats.size()-1) {
-            auto start = std::chrono::steady_clock::now();
-            cv::imwrite("./test/test_image" + formats[i], test_image);
-            auto end = std::chrono::steady_clock::now();
-            auto elapsed_time = std::chrono::duration_cast<std::chrono::microseconds>(end - start).count();
-            image_info.push_back({formats[i], static_cast<float>(elapsed_time), getFileSize("./test/test_image" + formats[i])});
-        } else {
-            // For raw format, we handle it separately
-            image_info.push_back({formats[i], saveMatToRaw(test_image, "./test/test_image.raw"), getFileSize("./test/test_image" + formats[i])});
+    std::vector<uchar> encoded;
+    for (const std::string& format : formats) {
+        if (format == ".raw") {
+            // Raw frames are written as they are
+            image_info.push_back({format, 0, static_cast<long long>(test_image.total() * test_image.elemSize())});
+            continue;
         }
+        directEncoder::frameLayout layout = directEncoder::layoutOf(directEncoder::formatOf(format.c_str()), width, height);
+        int frames = 0;
+        auto start = std::chrono::steady_clock::now();
+        double elapsed;
+        do {
+            if (layout.format != directEncoder::FORMAT_NONE) {
+                directEncoder::encode(layout, test_image, encoded);
+            } else {
+                cv::imencode(format, test_image, encoded);
+            }
+            frames++;
+            elapsed = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+        } while (elapsed < 500000);
+        image_info.push_back({format, static_cast<float>(elapsed / frames), static_cast<long long>(encoded.size())});
     }
     
-    //sort the vector by writing time
+    //sort the vector by encoding time
     std::sort(image_info.begin(), image_info.end(), [](const imageInfo& a, const imageInfo& b) {
-        return a.writing_time < b.writing_time;
+        return a.encoding_time < b.encoding_time;
     });
     
     std::cout << "----------------------------------------" << std::endl;
-    std::cout << "Format | Writing time (ms) | File Size (MB)" << std::endl;
+    std::cout << "Format | Encoding time (ms) | File Size (MB)" << std::endl;
     std::cout << "----------------------------------------" << std::endl;
     for (auto element : image_info){
         std::cout << std::fixed << std::setprecision(2) << element.format << " | " 
-        <<  element.writing_time/1000 << " milliseconds | " << static_cast<float>(element.file_size)/(1024*1024) << " MB " << std::endl;
+        <<  element.encoding_time/1000 << " milliseconds | " << static_cast<float>(element.file_size)/(1024*1024) << " MB " << std::endl;
     }
     std::cout << "----------------------------------------" << std::endl;
 
     return image_info;
 }
-void chooseFormat(int duration, int minimunImages){
+
+bool writeConfig(const std::string& path, const std::string& format, int savers, long long queueMemory, const checkOptions& options) {
     /**
-     * @brief Chooses the best image format based on disk write speed and available disk space.
+     * @brief Writes the chosen setup as a random_image_generator config file.
      * 
-     * This function calculates the disk write speed for various image formats, checks if the
-     * available disk space is sufficient for saving a specified number of images and if it is posible 
-     * to save enough images per second.
+     * Every line is "option=value" with the name of a generator command line option; threads and
+     * format are used when the matching positional argument is "auto". The queue is given as a memory
+     * budget in MB, so it still fits in memory when the generator runs with larger frames.
      * 
-     * @param duration The duration in seconds for which the images will be saved.
-     * @param minimunImages The minimum number of images to be saved per second.
+     * @return bool false if the file could not be written.
      */
-    std::vector<imageInfo> image_info = calculateDiskWriteSpeed(1080, 1920);
+    std::ofstream config(path);
+    config << "# Written by system_check for " << options.fps << " fps during " << options.duration << " seconds\n"
+           << "# Load it with: ./random_image_generator s " << options.duration << " auto auto --config " << path << "\n"
+           << "format=" << format << "\n"
+           << "threads=" << savers + 2 << "\n" // 1 generator + 1 controller + savers
+           << "queue-memory=" << std::max(1LL, queueMemory / (1024 * 1024)) << "\n";
+    if (format == ".raw" && options.isDirectIO) {
+        config << "async-io=true\n"
+               << "direct-io=true\n";
+    }
+    return static_cast<bool>(config);
+}
+
+void chooseFormat(const checkOptions& options){
+    /**
+     * @brief Chooses the best image format based on encoding cost, sustained disk write speed and available disk space.
+     * 
+     * For every format and saver thread count, the achievable frame rate is the lower of the encoding rate
+     * (savers encode in parallel, up to the number of CPUs left by the generator and controller threads)
+     * and the measured disk speed divided by the file size. The first format, by encoding time, that fits on
+     * the disk and reaches options.fps is chosen with the fewest saver threads that reach it, and written
+     * to options.configPath.
+     */
+    std::vector<imageInfo> image_info = measureEncoding(1080, 1920);
+    std::vector<std::pair<int, double>> scaling = measureWriteScaling(options, 1080, 1920);
     long long freeSpace = isWSL() ? checkDiskSpace("/mnt/c") : checkDiskSpace("./");
     long long freeRam = checkAvailableRam();
+    int cpus = std::max(1u, std::thread::hardware_concurrency());
+    long long frameBytes = 1920LL * 1080 * 3;
+
     for (int i = 0; i < image_info.size(); i++){
-        if (minimunImages*duration*image_info[i].file_size < freeSpace
-            && 1000000/image_info[i].writing_time > minimunImages) { // Check if the format is suitable
-            std::cout << "You can use the format: " << image_info[i].format << std::endl
-            << "Your maximum queue size is: " << freeRam/image_info[i].file_size << std::endl;
-            
-            return; // Exit after finding the first suitable format
+        if (static_cast<long long>(options.fps) * options.duration * image_info[i].file_size >= freeSpace) {
+            continue;
+        }
+        for (const auto& test : scaling) {
+            int savers = test.first;
+            double encodeFps = image_info[i].encoding_time > 0
+                ? std::min(savers, std::max(1, cpus - 2)) * 1000000.0 / image_info[i].encoding_time : 1e9;
+            double diskFps = test.second * 1024 * 1024 / image_info[i].file_size;
+            double fps = std::min(encodeFps, diskFps);
+            if (fps >= options.fps) { // Check if the format is suitable
+                // The queue holds raw frames: half the free RAM at most, two seconds of frames is enough
+                long long queueSize = std::max(1LL, std::min(freeRam / 2 / frameBytes, 2LL * options.fps));
+                std::cout << "You can use the format: " << image_info[i].format << std::endl
+                << "Saver threads: " << savers << " (about " << static_cast<int>(fps) << " fps)" << std::endl
+                << "Your maximum queue size is: " << freeRam/frameBytes << ", suggested: " << queueSize << std::endl;
+                if (writeConfig(options.configPath, image_info[i].format, savers, queueSize * frameBytes, options)) {
+                    std::cout << "Config written to " << options.configPath << ", use it with:" << std::endl
+                              << "./random_image_generator s " << options.duration << " auto auto --config " << options.configPath << std::endl;
+                } else {
+                    std::cerr << "Could not write " << options.configPath << std::endl;
+                }
+                return; // Exit after finding the first suitable format
+            }
         }
     }
     std::cout << "No suitable format found for the given duration and minimum images per second." << std::endl;
@@ -209,6 +438,40 @@ void chooseFormat(int duration, int minimunImages){
 #endif // system_check_h
 
 int main(int argc, char **argv) {
-    chooseFormat(60, 50); // Example usage with 60 seconds duration and 50 images per second
+    checkOptions options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            options.duration = std::max(1, std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--fps") == 0 && i + 1 < argc) {
+            options.fps = std::max(1, std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--test-seconds") == 0 && i + 1 < argc) {
+            options.testSeconds = std::max(0.1, std::stod(argv[++i]));
+        } else if (strcmp(argv[i], "--max-threads") == 0 && i + 1 < argc) {
+            options.maxThreads = std::max(1, std::stoi(argv[++i]));
+        } else if (strcmp(argv[i], "--sync") == 0 && i + 1 < argc) {
+            i++;
+            if (strcmp(argv[i], "none") == 0) {
+                options.sync = SYNC_NONE;
+            } else if (strcmp(argv[i], "file") == 0) {
+                options.sync = SYNC_FILE;
+            } else if (strcmp(argv[i], "end") == 0) {
+                options.sync = SYNC_END;
+            } else {
+                std::cout << "Invalid sync mode, valid modes: none, file, end.\n";
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--direct-io") == 0) {
+            options.isDirectIO = true;
+        } else if (strcmp(argv[i], "--dir") == 0 && i + 1 < argc) {
+            options.directory = argv[++i];
+        } else if (strcmp(argv[i], "--config") == 0 && i + 1 < argc) {
+            options.configPath = argv[++i];
+        } else {
+            std::cout << "Usage: ./system_check [--duration S] [--fps F] [--test-seconds S] [--max-threads N]\n"
+                      << "                      [--sync none|file|end] [--direct-io] [--dir DIR] [--config FILE]\n";
+            return 1;
+        }
+    }
+    chooseFormat(options);
     return 0;
 }
\ No newline at end of file
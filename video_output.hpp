@@ -0,0 +1,152 @@
+#ifndef video_output_h
+#define video_output_h
+
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <opencv2/core.hpp>
+#include <opencv2/videoio.hpp>
+#include <string>
+#include <sys/stat.h>
+
+/**
+ * @file video_output.hpp
+ * @brief Frames encoded in order into rolling video files with cv::VideoWriter.
+ *
+ * Layout of the output directory:
+ * - video_NNNNN.avi / .mkv: segments, each one a playable video starting with a key frame.
+ * - video_index.txt: one "file first_frame frames" line per finished segment.
+ *
+ * A segment is closed and the next one started once it holds segmentFrames frames or its file reaches
+ * segmentBytes, whichever comes first (0 disables a limit), so a long run gives a handful of large
+ * sequential files instead of one file per frame.
+ */
+
+enum videoCodec {
+  /**
+ * @brief Codec of the segments.
+ */
+  VIDEO_AUTO, // FFV1 when the OpenCV build can write it, MJPG otherwise
+  VIDEO_FFV1, // Lossless, in a .mkv container
+  VIDEO_MJPG  // Motion JPEG, in a .avi container
+};
+
+class VideoOutput {
+  /**
+ * @brief Writes frames to the current segment and rotates the segments.
+ *
+ * cv::VideoWriter is not thread safe, a single thread writes every frame in order.
+ */
+public:
+  VideoOutput(const std::string& directory, videoCodec codec, int width, int height, bool isColor, double fps,
+              uint64_t segmentFrames, uint64_t segmentBytes)
+      : directory(directory), codec(codec), size(width, height), isColor(isColor), fps(fps),
+        segmentFrames(segmentFrames), segmentBytes(segmentBytes) {
+    index.open(directory + "/video_index.txt", std::ios::trunc);
+    if (index.is_open()) {
+      openSegment();
+    }
+  }
+
+  ~VideoOutput() { close(); }
+
+  VideoOutput(const VideoOutput&) = delete;
+  VideoOutput& operator=(const VideoOutput&) = delete;
+
+  bool isOpen() const { return writer.isOpened(); }
+
+  bool write(const cv::Mat& frame) {
+    /**
+ * @brief Encodes the next frame, starting a new segment first if the current one is full.
+ *
+ * @return bool false if the next segment could not be opened.
+ */
+    if (segmentFull() && (finishSegment(), !openSegment())) {
+      return false;
+    }
+    writer.write(frame);
+    written++;
+    return true;
+  }
+
+  void close() {
+    /**
+ * @brief Finishes the current segment, writes its index line and releases the writer.
+ */
+    if (writer.isOpened()) {
+      finishSegment();
+    }
+    index.close();
+  }
+
+  const char* codecName() const { return codec == VIDEO_FFV1 ? "FFV1" : "MJPG"; }
+
+  uint32_t segmentCount() const { return segment; }
+
+private:
+  static const int SIZE_CHECK_FRAMES = 16; // Frames between two checks of the segment file size
+
+  bool segmentFull() const {
+    if (segmentFrames > 0 && written >= segmentFrames) {
+      return true;
+    }
+    // The writer buffers a little, checking the file every few frames is close enough
+    if (segmentBytes > 0 && written > 0 && written % SIZE_CHECK_FRAMES == 0) {
+      struct stat info;
+      return stat(path.c_str(), &info) == 0 && static_cast<uint64_t>(info.st_size) >= segmentBytes;
+    }
+    return false;
+  }
+
+  bool openSegment() {
+    /**
+ * @brief Opens the next segment, falling back from FFV1 to MJPG if the first one can't be written.
+ */
+    if (codec != VIDEO_MJPG && tryOpen(VIDEO_FFV1)) {
+      codec = VIDEO_FFV1;
+      return true;
+    }
+    if (codec != VIDEO_FFV1 && tryOpen(VIDEO_MJPG)) {
+      codec = VIDEO_MJPG;
+      return true;
+    }
+    return false;
+  }
+
+  bool tryOpen(videoCodec candidate) {
+    char name[32];
+    snprintf(name, sizeof(name), "/video_%05u%s", segment, candidate == VIDEO_FFV1 ? ".mkv" : ".avi");
+    path = directory + name;
+    int fourcc = candidate == VIDEO_FFV1 ? cv::VideoWriter::fourcc('F', 'F', 'V', '1') : cv::VideoWriter::fourcc('M', 'J', 'P', 'G');
+    if (!writer.open(path, fourcc, fps, size, isColor)) {
+      std::remove(path.c_str()); // Some backends leave an empty file behind
+      return false;
+    }
+    return true;
+  }
+
+  void finishSegment() {
+    writer.release();
+    index << path.substr(directory.size() + 1) << " " << firstFrame << " " << written << "\n";
+    index.flush();
+    firstFrame += written;
+    written = 0;
+    segment++;
+  }
+
+  std::string directory;
+  videoCodec codec;
+  cv::Size size;
+  bool isColor;
+  double fps;
+  uint64_t segmentFrames;
+  uint64_t segmentBytes;
+  cv::VideoWriter writer;
+  std::ofstream index;
+  std::string path;       // File of the current segment
+  uint32_t segment = 0;   // Number of the current segment
+  uint64_t firstFrame = 0; // Frame number of the first frame of the current segment
+  uint64_t written = 0;   // Frames in the current segment
+};
+
+#endif // video_output_h